@@ -1,6 +1,8 @@
 #pragma once
 
 #include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 #define atomic _Atomic
 
@@ -47,3 +49,96 @@
 #else
 #define thread_fence(obj, order) atomic_thread_fence(memory_order_##order)
 #endif
+
+/* Double-word compare-and-swap, for ABA protection with a version counter
+ * next to a pointer. The operand must be aligned to twice the word size.
+ * x86-64 uses cmpxchg16b (missing only on the very first AMD64 CPUs);
+ * aarch64 uses an exclusive pair loop, which works with or without LSE.
+ */
+typedef struct {
+    uintptr_t lo, hi;
+} __attribute__((aligned(2 * sizeof(uintptr_t)))) dword_t;
+
+static inline bool compare_exchange_dword(dword_t *obj,
+                                          dword_t *expected,
+                                          dword_t desired)
+{
+#if defined(__x86_64__)
+    bool ok;
+    __asm__ __volatile__("lock cmpxchg16b %1"
+                         : "=@ccz"(ok), "+m"(*obj), "+a"(expected->lo),
+                           "+d"(expected->hi)
+                         : "b"(desired.lo), "c"(desired.hi)
+                         : "memory");
+    return ok;
+#elif defined(__aarch64__)
+    uintptr_t lo, hi;
+    uint32_t fail;
+    do {
+        __asm__ __volatile__("ldaxp %0, %1, %2"
+                             : "=&r"(lo), "=&r"(hi)
+                             : "Q"(*obj)
+                             : "memory");
+        if (lo != expected->lo || hi != expected->hi) {
+            /* Clear the exclusive monitor, storing back what we read */
+            __asm__ __volatile__("stlxp %w0, %1, %2, %3"
+                                 : "=&r"(fail)
+                                 : "r"(lo), "r"(hi), "Q"(*obj)
+                                 : "memory");
+            if (fail)
+                continue;
+            expected->lo = lo;
+            expected->hi = hi;
+            return false;
+        }
+        __asm__ __volatile__("stlxp %w0, %1, %2, %3"
+                             : "=&r"(fail)
+                             : "r"(desired.lo), "r"(desired.hi), "Q"(*obj)
+                             : "memory");
+    } while (fail);
+    return true;
+#else
+    /* Needs -latomic, and may not be lock-free */
+    return __atomic_compare_exchange(obj, expected, &desired, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/* The two halves are loaded separately and may tear. That is fine as the
+ * starting point of a compare_exchange_dword() loop, which fails and hands
+ * back a consistent value in that case.
+ */
+static inline dword_t load_dword(dword_t *obj)
+{
+    dword_t v;
+    v.lo = __atomic_load_n(&obj->lo, __ATOMIC_ACQUIRE);
+    v.hi = __atomic_load_n(&obj->hi, __ATOMIC_ACQUIRE);
+    return v;
+}
+
+/* Tagged pointers: a 16-bit version counter in the upper bits of a user
+ * space pointer, which are zero with 4-level (47-bit) and 48-bit address
+ * spaces. Fits into a single word, so plain compare_exchange_*() work on
+ * it, at the price of a tag which wraps after 65536 updates.
+ */
+#if UINTPTR_MAX > 0xffffffffu
+typedef uintptr_t tagptr_t;
+
+#define TAGPTR_SHIFT 48
+#define TAGPTR_MASK (((uintptr_t) 1 << TAGPTR_SHIFT) - 1)
+
+static inline tagptr_t tagptr_make(void *ptr, uintptr_t tag)
+{
+    return ((uintptr_t) ptr & TAGPTR_MASK) | (tag << TAGPTR_SHIFT);
+}
+
+static inline void *tagptr_ptr(tagptr_t tp)
+{
+    return (void *) (tp & TAGPTR_MASK);
+}
+
+static inline uintptr_t tagptr_tag(tagptr_t tp)
+{
+    return tp >> TAGPTR_SHIFT;
+}
+#endif
@@ -0,0 +1,152 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "biased.h"
+#include "mutex.h"
+
+/* Owner fast path: uncontended lock/unlock pairs from a single thread, for
+ * mutex_t, pthread_mutex_t and the biased lock.
+ *
+ * Revocation: a second thread takes the lock while the owner is idle, which
+ * for the biased lock means one membarrier() per acquisition.
+ *
+ * Maintenance: the owner hammers the lock while another thread takes it
+ * every MAINT_PERIOD_US, the pattern the biased lock is meant for. Both
+ * increment a shared counter, which is checked at the end.
+ */
+
+#define OWNER_OPS 20000000
+#define REVOKE_OPS 20000
+#define MAINT_PERIOD_US 1000
+
+enum { BENCH_MUTEX, BENCH_PTHREAD, BENCH_BIASED, N_BENCH };
+static const char *bench_name[N_BENCH] = {"mutex_t", "pthread", "biased"};
+
+static mutex_t mutex;
+static pthread_mutex_t pmutex = PTHREAD_MUTEX_INITIALIZER;
+static biased_lock_t biased;
+
+static int bench;
+static volatile long counter;
+static atomic bool stop;
+
+static inline void lock(void)
+{
+    switch (bench) {
+    case BENCH_MUTEX:
+        mutex_lock(&mutex);
+        break;
+    case BENCH_PTHREAD:
+        pthread_mutex_lock(&pmutex);
+        break;
+    case BENCH_BIASED:
+        biased_lock(&biased);
+        break;
+    }
+}
+
+static inline void unlock(void)
+{
+    switch (bench) {
+    case BENCH_MUTEX:
+        mutex_unlock(&mutex);
+        break;
+    case BENCH_PTHREAD:
+        pthread_mutex_unlock(&pmutex);
+        break;
+    case BENCH_BIASED:
+        biased_unlock(&biased);
+        break;
+    }
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* ns per lock/unlock pair */
+static double run_owner(void)
+{
+    double start = now();
+    for (long i = 0; i < OWNER_OPS; ++i) {
+        lock();
+        counter++;
+        unlock();
+    }
+    return (now() - start) * 1e9 / OWNER_OPS;
+}
+
+static void *revoker(void *arg)
+{
+    double *result = arg;
+    double start = now();
+    for (long i = 0; i < REVOKE_OPS; ++i) {
+        lock();
+        counter++;
+        unlock();
+    }
+    *result = (now() - start) * 1e9 / REVOKE_OPS;
+    return NULL;
+}
+
+static void *maintenance(void *arg)
+{
+    long *count = arg;
+    while (!load(&stop, relaxed)) {
+        lock();
+        counter++;
+        unlock();
+        ++*count;
+        usleep(MAINT_PERIOD_US);
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    double owner[N_BENCH], revoke[N_BENCH], maint[N_BENCH];
+
+    mutex_init(&mutex, NULL);
+    biased_lock_init(&biased);
+
+    for (bench = 0; bench < N_BENCH; ++bench) {
+        pthread_t thread;
+
+        counter = 0;
+        owner[bench] = run_owner();
+
+        pthread_create(&thread, NULL, revoker, &revoke[bench]);
+        pthread_join(thread, NULL);
+
+        long maint_ops = 0;
+        store(&stop, false, relaxed);
+        pthread_create(&thread, NULL, maintenance, &maint_ops);
+        maint[bench] = run_owner();
+        store(&stop, true, relaxed);
+        pthread_join(thread, NULL);
+
+        long expected = 2L * OWNER_OPS + REVOKE_OPS + maint_ops;
+        if (counter != expected) {
+            fprintf(stderr, "%s: counter %ld, expected %ld\n",
+                    bench_name[bench], counter, expected);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("membarrier: %s\n", biased.membarrier ? "yes" : "no (fence)");
+    printf("%10s %12s %12s %12s   (ns/op)\n", "", "owner", "revocation",
+           "maintenance");
+    for (bench = 0; bench < N_BENCH; ++bench)
+        printf("%10s %12.2f %12.1f %12.2f\n", bench_name[bench],
+               owner[bench], revoke[bench], maint[bench]);
+
+    biased_lock_destroy(&biased);
+    mutex_destroy(&mutex);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "channel.h"
+
+/* A producer and a consumer process on one channel, for record sizes from
+ * 64 B to 64 KB.
+ *
+ *   throughput  BYTES worth of records, flushed every BATCH records,
+ *               against write()/read() of the same records on a pipe
+ *   latency     round trip through a pair of channels, one record each way
+ *
+ * Every record carries its sequence number, checked on the receiving side.
+ */
+
+#define RING_SIZE (1 << 20)
+#define BYTES (64L << 20)
+#define BATCH 16
+#define ROUND_TRIPS 20000
+
+static const size_t sizes[] = {64, 256, 1024, 4096, 16384, 65536};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+__attribute__((noreturn)) static void fail(const char *msg)
+{
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static pid_t spawn(void (*func)(int, int, size_t), int a, int b, size_t size)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+        fail("fork");
+    if (pid == 0) {
+        func(a, b, size);
+        _exit(EXIT_SUCCESS);
+    }
+    return pid;
+}
+
+static void reap(pid_t pid)
+{
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status)) {
+        fprintf(stderr, "child failed\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void chan_consumer(int fd, int unused, size_t size)
+{
+    chan_t ch;
+    if (!chan_open(&ch, fd))
+        fail("chan_open");
+
+    long count = BYTES / size;
+    for (long i = 0; i < count; ++i) {
+        size_t len;
+        long *rec = chan_recv(&ch, &len);
+        if (len != size || *rec != i) {
+            fprintf(stderr, "record %ld: got %ld, %zu bytes\n", i, *rec, len);
+            exit(EXIT_FAILURE);
+        }
+        chan_release(&ch);
+    }
+    chan_close(&ch);
+}
+
+static double chan_throughput(size_t size)
+{
+    chan_t ch;
+    int fd = chan_create(&ch, RING_SIZE);
+    if (fd < 0)
+        fail("chan_create");
+
+    double start = now();
+    pid_t pid = spawn(chan_consumer, fd, -1, size);
+    long count = BYTES / size;
+    for (long i = 0; i < count; ++i) {
+        long *rec = chan_reserve(&ch, size);
+        *rec = i;
+        chan_commit(&ch);
+        if (i % BATCH == BATCH - 1)
+            chan_flush(&ch);
+    }
+    chan_flush(&ch);
+    reap(pid);
+    double elapsed = now() - start;
+
+    chan_close(&ch);
+    close(fd);
+    return elapsed;
+}
+
+static void read_full(int fd, char *buf, size_t size)
+{
+    while (size) {
+        ssize_t n = read(fd, buf, size);
+        if (n <= 0)
+            fail("read");
+        buf += n;
+        size -= n;
+    }
+}
+
+static void pipe_consumer(int fd, int unused, size_t size)
+{
+    char *buf = malloc(size);
+    long count = BYTES / size;
+    for (long i = 0; i < count; ++i) {
+        read_full(fd, buf, size);
+        if (*(long *) buf != i) {
+            fprintf(stderr, "record %ld: got %ld\n", i, *(long *) buf);
+            exit(EXIT_FAILURE);
+        }
+    }
+    free(buf);
+}
+
+static double pipe_throughput(size_t size)
+{
+    int fds[2];
+    if (pipe(fds))
+        fail("pipe");
+
+    char *buf = calloc(1, size);
+    double start = now();
+    pid_t pid = spawn(pipe_consumer, fds[0], -1, size);
+    long count = BYTES / size;
+    for (long i = 0; i < count; ++i) {
+        *(long *) buf = i;
+        for (size_t done = 0; done < size;) {
+            ssize_t n = write(fds[1], buf + done, size - done);
+            if (n <= 0)
+                fail("write");
+            done += n;
+        }
+    }
+    reap(pid);
+    double elapsed = now() - start;
+
+    free(buf);
+    close(fds[0]);
+    close(fds[1]);
+    return elapsed;
+}
+
+/* Send every record received on 'in' back on 'out' */
+static void echo(int in_fd, int out_fd, size_t size)
+{
+    chan_t in, out;
+    if (!chan_open(&in, in_fd) || !chan_open(&out, out_fd))
+        fail("chan_open");
+
+    for (long i = 0; i < ROUND_TRIPS; ++i) {
+        size_t len;
+        void *rec = chan_recv(&in, &len);
+        chan_send(&out, rec, len);
+        chan_release(&in);
+    }
+    chan_close(&in);
+    chan_close(&out);
+}
+
+static double chan_latency(size_t size)
+{
+    chan_t ping, pong;
+    int ping_fd = chan_create(&ping, RING_SIZE);
+    int pong_fd = chan_create(&pong, RING_SIZE);
+    if (ping_fd < 0 || pong_fd < 0)
+        fail("chan_create");
+
+    double start = now();
+    pid_t pid = spawn(echo, ping_fd, pong_fd, size);
+    for (long i = 0; i < ROUND_TRIPS; ++i) {
+        long *rec = chan_reserve(&ping, size);
+        *rec = i;
+        chan_commit(&ping);
+        chan_flush(&ping);
+
+        size_t len;
+        rec = chan_recv(&pong, &len);
+        if (len != size || *rec != i) {
+            fprintf(stderr, "round trip %ld: got %ld\n", i, *rec);
+            exit(EXIT_FAILURE);
+        }
+        chan_release(&pong);
+    }
+    reap(pid);
+    double elapsed = now() - start;
+
+    chan_close(&ping);
+    chan_close(&pong);
+    close(ping_fd);
+    close(pong_fd);
+    return elapsed;
+}
+
+int main(void)
+{
+    printf("%8s %12s %12s %12s %14s\n", "size", "chan (MB/s)", "pipe (MB/s)",
+           "chan (Mmsg/s)", "round trip (us)");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        size_t size = sizes[i];
+        double t_chan = chan_throughput(size);
+        double t_pipe = pipe_throughput(size);
+        double t_lat = chan_latency(size);
+        printf("%8zu %12.0f %12.0f %12.3f %14.2f\n", size, BYTES / t_chan / 1e6,
+               BYTES / t_pipe / 1e6, BYTES / size / t_chan / 1e6,
+               t_lat / ROUND_TRIPS * 1e6);
+        fflush(stdout);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,133 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "atomic.h"
+#include "counter.h"
+#include "mutex.h"
+
+/* Scaling benchmark: every thread bumps one shared counter 'ops' times.
+ * Compare a mutex_t protected long, a single atomic fetch_add and the
+ * sharded counter_t.
+ */
+
+#define DEFAULT_OPS 2000000
+#define MAX_THREADS 64
+
+enum { BENCH_MUTEX, BENCH_ATOMIC, BENCH_SHARDED, N_BENCH };
+static const char *bench_name[N_BENCH] = {"mutex", "fetch_add", "sharded"};
+
+static struct {
+    mutex_t mutex;
+    long value;
+} mutex_counter;
+static atomic long atomic_counter;
+static counter_t sharded_counter;
+
+static pthread_barrier_t barrier;
+static long ops;
+static int bench;
+
+static void *worker(void *arg)
+{
+    pthread_barrier_wait(&barrier);
+
+    switch (bench) {
+    case BENCH_MUTEX:
+        for (long i = 0; i < ops; ++i) {
+            mutex_lock(&mutex_counter.mutex);
+            mutex_counter.value++;
+            mutex_unlock(&mutex_counter.mutex);
+        }
+        break;
+    case BENCH_ATOMIC:
+        for (long i = 0; i < ops; ++i)
+            fetch_add(&atomic_counter, 1, relaxed);
+        break;
+    case BENCH_SHARDED:
+        for (long i = 0; i < ops; ++i)
+            counter_inc(&sharded_counter);
+        break;
+    }
+    return NULL;
+}
+
+static long read_counter(void)
+{
+    switch (bench) {
+    case BENCH_MUTEX:
+        return mutex_counter.value;
+    case BENCH_ATOMIC:
+        return load(&atomic_counter, relaxed);
+    default:
+        return counter_read(&sharded_counter);
+    }
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double run(int nthreads)
+{
+    pthread_t threads[MAX_THREADS];
+
+    mutex_init(&mutex_counter.mutex, NULL);
+    mutex_counter.value = 0;
+    atomic_init(&atomic_counter, 0);
+    if (!counter_init(&sharded_counter))
+        exit(EXIT_FAILURE);
+
+    pthread_barrier_init(&barrier, NULL, nthreads + 1);
+    for (int i = 0; i < nthreads; ++i) {
+        if (pthread_create(&threads[i], NULL, worker, NULL) != 0)
+            exit(EXIT_FAILURE);
+    }
+
+    pthread_barrier_wait(&barrier);
+    double start = now();
+    for (int i = 0; i < nthreads; ++i)
+        pthread_join(threads[i], NULL);
+    double elapsed = now() - start;
+    pthread_barrier_destroy(&barrier);
+
+    if (read_counter() != ops * nthreads) {
+        fprintf(stderr, "%s: lost updates (%ld != %ld)\n", bench_name[bench],
+                read_counter(), ops * nthreads);
+        exit(EXIT_FAILURE);
+    }
+    counter_destroy(&sharded_counter);
+    mutex_destroy(&mutex_counter.mutex);
+
+    return ops * nthreads / elapsed / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    ops = argc > 1 ? atol(argv[1]) : DEFAULT_OPS;
+
+    int max_threads = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_threads < 4)
+        max_threads = 4;
+    if (max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+
+    printf("%8s", "threads");
+    for (bench = 0; bench < N_BENCH; ++bench)
+        printf(" %12s", bench_name[bench]);
+    printf("   (Mops/s, %ld ops per thread)\n", ops);
+
+    for (int nthreads = 1; nthreads <= max_threads; nthreads <<= 1) {
+        printf("%8d", nthreads);
+        for (bench = 0; bench < N_BENCH; ++bench)
+            printf(" %12.2f", run(nthreads));
+        printf("\n");
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,159 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cond.h"
+#include "futex.h"
+#include "mutex.h"
+
+/* Futex hash bucket collisions. MUTEXES mutexes are held by the main thread
+ * with one thread blocked on each, so that many futexes have a waiter
+ * queued in the hash. Meanwhile PAIRS pairs of threads ping-pong through
+ * mutexes and condition variables of their own, and we time a round trip;
+ * then the held mutexes are released, which wakes every blocked thread.
+ *
+ * Each configuration runs in a child process, as the hash is set up per
+ * process: the global hash, the kernel's default private hash, and one
+ * sized by futex_hash_init() for MUTEXES futexes.
+ */
+
+#define MUTEXES 2048
+#define PAIRS 4
+#define ROUND_TRIPS 20000
+#define STACK_SIZE (64 * 1024)
+
+enum { HASH_GLOBAL, HASH_DEFAULT, HASH_SIZED, N_HASH };
+static const char *hash_name[N_HASH] = {"global", "default", "sized"};
+
+static mutex_t held[MUTEXES];
+
+static struct pair {
+    mutex_t mutex;
+    cond_t cond;
+    long turn;
+} pairs[PAIRS];
+
+static void *blocked(void *arg)
+{
+    mutex_t *mutex = arg;
+    mutex_lock(mutex);
+    mutex_unlock(mutex);
+    return NULL;
+}
+
+static void *pingpong(void *arg)
+{
+    struct pair *p = &pairs[(long) arg / 2];
+    long me = (long) arg & 1;
+
+    mutex_lock(&p->mutex);
+    for (long i = 0; i < ROUND_TRIPS; ++i) {
+        while ((p->turn & 1) != me)
+            cond_wait(&p->cond, &p->mutex);
+        p->turn++;
+        cond_signal(&p->cond, &p->mutex);
+    }
+    mutex_unlock(&p->mutex);
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run(int hash)
+{
+    static pthread_t blocked_threads[MUTEXES], pair_threads[2 * PAIRS];
+    pthread_attr_t attr;
+    int slots = 0;
+
+    switch (hash) {
+    case HASH_GLOBAL:
+        prctl(PR_FUTEX_HASH, PR_FUTEX_HASH_SET_SLOTS, 0, 0, 0);
+        break;
+    case HASH_SIZED:
+        slots = futex_hash_init(MUTEXES);
+        break;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, STACK_SIZE);
+    for (int i = 0; i < MUTEXES; ++i) {
+        mutex_init(&held[i], NULL);
+        mutex_lock(&held[i]);
+        if (pthread_create(&blocked_threads[i], &attr, blocked, &held[i])) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    /* Wait for every thread to be queued on its futex */
+    for (int i = 0; i < MUTEXES; ++i) {
+        while (!(load(&held[i].state, relaxed) & MUTEX_SLEEPING))
+            usleep(100);
+    }
+    usleep(10000);
+
+    if (hash == HASH_DEFAULT) {
+        slots = prctl(PR_FUTEX_HASH, PR_FUTEX_HASH_GET_SLOTS, 0, 0, 0);
+        if (slots < 0)
+            slots = 0;
+    }
+
+    double start = now();
+    for (long i = 0; i < PAIRS; ++i) {
+        mutex_init(&pairs[i].mutex, NULL);
+        cond_init(&pairs[i].cond);
+        pairs[i].turn = 0;
+    }
+    for (long i = 0; i < 2 * PAIRS; ++i)
+        pthread_create(&pair_threads[i], &attr, pingpong, (void *) i);
+    for (int i = 0; i < 2 * PAIRS; ++i)
+        pthread_join(pair_threads[i], NULL);
+    double t_pingpong = now() - start;
+
+    start = now();
+    for (int i = 0; i < MUTEXES; ++i)
+        mutex_unlock(&held[i]);
+    for (int i = 0; i < MUTEXES; ++i)
+        pthread_join(blocked_threads[i], NULL);
+    double t_release = now() - start;
+    pthread_attr_destroy(&attr);
+
+    for (int i = 0; i < PAIRS; ++i) {
+        if (pairs[i].turn != 2 * ROUND_TRIPS) {
+            fprintf(stderr, "pair %d: turn %ld\n", i, pairs[i].turn);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("%8s %8d %14.2f %14.2f\n", hash_name[hash], slots,
+           t_pingpong * 1e6 / (PAIRS * ROUND_TRIPS), t_release * 1e6 / MUTEXES);
+}
+
+int main(void)
+{
+    printf("%d blocked waiters, %d ping-pong pairs\n", MUTEXES, PAIRS);
+    printf("%8s %8s %14s %14s\n", "hash", "buckets", "round trip (us)",
+           "release (us)");
+    fflush(stdout);
+
+    for (int hash = 0; hash < N_HASH; ++hash) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            run(hash);
+            fflush(stdout);
+            _exit(EXIT_SUCCESS);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status))
+            return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "graph.h"
+#include "pool.h"
+
+/* A layered pipeline of LAYERS x WIDTH stages. Stage (l, j) depends on
+ * stages j and j + 1 of layer l - 1, and costs a pseudo-random amount of
+ * work, so some stages of a layer finish long before others.
+ *
+ * The lockstep version mimics the global clock of example/main.c: it runs a
+ * layer, waits for all of it, then starts the next one. The graph version
+ * starts a stage as soon as its own two inputs are ready.
+ */
+
+#define LAYERS 16
+#define WIDTH 16
+#define FRAMES 200
+#define MAX_WORK 20000
+
+struct stage {
+    struct stage *deps[2];
+    int ndeps;
+    unsigned int work;
+    long frame;
+    unsigned long value;
+};
+
+static struct stage stages[LAYERS][WIDTH];
+static long frame;
+
+static void stage_run(void *arg)
+{
+    struct stage *s = arg;
+    unsigned long value = s->work;
+
+    for (int i = 0; i < s->ndeps; ++i) {
+        if (s->deps[i]->frame != frame) {
+            fprintf(stderr, "stage ran before its dependency\n");
+            abort();
+        }
+        value += s->deps[i]->value;
+    }
+    for (unsigned int i = 0; i < s->work; ++i)
+        value = value * 6364136223846793005UL + 1442695040888963407UL;
+
+    s->value = value;
+    s->frame = frame;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static unsigned long checksum(void)
+{
+    unsigned long sum = 0;
+    for (int j = 0; j < WIDTH; ++j)
+        sum += stages[LAYERS - 1][j].value;
+    return sum;
+}
+
+int main(int argc, char *argv[])
+{
+    int nworkers = argc > 1 ? atoi(argv[1]) : 0;
+
+    pool_t pool;
+    if (!pool_init(&pool, nworkers))
+        return EXIT_FAILURE;
+
+    graph_t graph;
+    graph_init(&graph, &pool);
+
+    graph_node_t *nodes[LAYERS][WIDTH];
+    unsigned int seed = 1;
+    for (int l = 0; l < LAYERS; ++l) {
+        for (int j = 0; j < WIDTH; ++j) {
+            struct stage *s = &stages[l][j];
+            seed = seed * 1103515245 + 12345;
+            s->work = (seed >> 8) % MAX_WORK;
+            s->ndeps = 0;
+            if (l > 0) {
+                s->deps[s->ndeps++] = &stages[l - 1][j];
+                if (j + 1 < WIDTH)
+                    s->deps[s->ndeps++] = &stages[l - 1][j + 1];
+            }
+
+            nodes[l][j] = graph_add_node(&graph, stage_run, s);
+            if (!nodes[l][j])
+                return EXIT_FAILURE;
+            if (l > 0) {
+                graph_depend(nodes[l][j], nodes[l - 1][j]);
+                if (j + 1 < WIDTH)
+                    graph_depend(nodes[l][j], nodes[l - 1][j + 1]);
+            }
+        }
+    }
+
+    printf("%d stages, %d frames, %d workers\n", LAYERS * WIDTH, FRAMES,
+           pool.nworkers);
+
+    pool_task_t tasks[WIDTH];
+    double start = now();
+    for (frame = 1; frame <= FRAMES; ++frame) {
+        for (int l = 0; l < LAYERS; ++l) {
+            for (int j = 0; j < WIDTH; ++j) {
+                pool_task_init(&tasks[j], stage_run, &stages[l][j]);
+                pool_submit(&pool, &tasks[j]);
+            }
+            pool_wait(&pool);
+        }
+    }
+    double t_lockstep = now() - start;
+    unsigned long sum_lockstep = checksum();
+
+    start = now();
+    for (frame = 1; frame <= FRAMES; ++frame) {
+        if (!graph_run(&graph)) {
+            fprintf(stderr, "graph has a cycle\n");
+            return EXIT_FAILURE;
+        }
+    }
+    double t_graph = now() - start;
+
+    if (checksum() != sum_lockstep) {
+        fprintf(stderr, "graph and lockstep results differ\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("  layer lockstep : %8.1f frames/s\n", FRAMES / t_lockstep);
+    printf("  task graph     : %8.1f frames/s\n", FRAMES / t_graph);
+
+    graph_destroy(&graph);
+    pool_destroy(&pool);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,125 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hashmap.h"
+
+/* Mixed get/put workload on KEYS keys (90% lookups, 10% updates, which
+ * alternately insert and remove a key), with a single stripe, i.e. one lock
+ * around the whole table, against a striped map. The read path is picked at
+ * build time, see the Makefile.
+ */
+
+#define KEYS (1 << 16)
+#define OPS 1000000
+#define MAX_THREADS 64
+#define STRIPES 64
+
+struct entry {
+    struct hmap_node node;
+    unsigned long key;
+};
+
+/* Two nodes per key, so that a replaced node is not reused immediately */
+static struct entry entries[2][KEYS];
+static atomic int which[KEYS];
+
+static hmap_t map;
+static pthread_barrier_t barrier;
+
+static bool entry_eq(const struct hmap_node *node, const void *key)
+{
+    return hmap_entry(node, struct entry, node)->key == *(unsigned long *) key;
+}
+
+static inline unsigned long hash(unsigned long key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdUL;
+    key ^= key >> 33;
+    return key;
+}
+
+static void *worker(void *arg)
+{
+    unsigned long seed = (unsigned long) arg * 2654435761UL + 1;
+
+    pthread_barrier_wait(&barrier);
+    for (long i = 0; i < OPS; ++i) {
+        seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+        unsigned long key = (seed >> 33) % KEYS;
+        unsigned long h = hash(key);
+
+        if ((seed >> 20) % 10) {
+            struct hmap_node *n = hmap_get(&map, h, &key);
+            if (n && hmap_entry(n, struct entry, node)->key != key)
+                abort();
+        } else if ((seed >> 24) & 1) {
+            int w = fetch_xor(&which[key], 1, relaxed) ^ 1;
+            hmap_put(&map, &entries[w][key].node, h, &key);
+        } else {
+            hmap_del(&map, h, &key);
+        }
+    }
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double run(int nthreads, unsigned int nstripes)
+{
+    pthread_t threads[MAX_THREADS];
+
+    if (!hmap_init(&map, nstripes, entry_eq))
+        exit(EXIT_FAILURE);
+    for (unsigned long key = 0; key < KEYS; key += 2)
+        hmap_put(&map, &entries[0][key].node, hash(key), &key);
+
+    pthread_barrier_init(&barrier, NULL, nthreads + 1);
+    for (long i = 0; i < nthreads; ++i)
+        pthread_create(&threads[i], NULL, worker, (void *) i);
+    pthread_barrier_wait(&barrier);
+    double start = now();
+    for (int i = 0; i < nthreads; ++i)
+        pthread_join(threads[i], NULL);
+    double elapsed = now() - start;
+    pthread_barrier_destroy(&barrier);
+
+    hmap_destroy(&map, NULL);
+    return (double) OPS * nthreads / elapsed / 1e6;
+}
+
+int main(void)
+{
+    for (int w = 0; w < 2; ++w) {
+        for (unsigned long key = 0; key < KEYS; ++key)
+            entries[w][key].key = key;
+    }
+
+    int max_threads = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_threads < 4)
+        max_threads = 4;
+    if (max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+
+#if HMAP_SEQLOCK
+    printf("seqlock read path, 90%% get / 10%% put\n");
+#else
+    printf("locked read path, 90%% get / 10%% put\n");
+#endif
+    printf("%8s %12s %12s   (Mops/s)\n", "threads", "1 stripe", "64 stripes");
+    for (int nthreads = 1; nthreads <= max_threads; nthreads <<= 1) {
+        printf("%8d", nthreads);
+        printf(" %12.2f", run(nthreads, 1));
+        printf(" %12.2f\n", run(nthreads, STRIPES));
+    }
+
+    return EXIT_SUCCESS;
+}
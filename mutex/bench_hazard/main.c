@@ -0,0 +1,299 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "atomic.h"
+#include "hazard.h"
+#include "mutex.h"
+
+/* Lock-free Treiber stack and Michael-Scott queue whose nodes are reclaimed
+ * through hazard pointers, under reclamation pressure: every pop/dequeue
+ * retires a node and every push/enqueue allocates a fresh one. Baselines are
+ * the same containers behind a mutex_t, freeing nodes right away.
+ */
+
+#define OPS 500000
+#define PREFILL 1024
+#define MAX_THREADS 64
+
+struct node {
+    struct hp_node hp;
+    atomic(struct node *) next;
+    long value;
+};
+
+static hp_domain_t domain;
+static atomic long live_nodes, peak_retired;
+
+static struct node *node_new(long value)
+{
+    struct node *n = malloc(sizeof(*n));
+    if (!n)
+        abort();
+    atomic_init(&n->next, NULL);
+    n->value = value;
+    fetch_add(&live_nodes, 1, relaxed);
+    return n;
+}
+
+static void node_free(struct hp_node *hp)
+{
+    fetch_sub(&live_nodes, 1, relaxed);
+    free(container_of(hp, struct node, hp));
+}
+
+static void node_retire(hp_record_t *rec, struct node *n)
+{
+    hp_retire(&domain, rec, n, &n->hp, node_free);
+
+    long peak = load(&peak_retired, relaxed);
+    while (rec->nretired > peak &&
+           !compare_exchange_weak(&peak_retired, &peak, rec->nretired, relaxed,
+                                  relaxed))
+        ;
+}
+
+/* Treiber stack */
+static atomic(struct node *) stack_top;
+
+static void stack_push(struct node *n)
+{
+    struct node *top = load(&stack_top, relaxed);
+    do {
+        store(&n->next, top, relaxed);
+    } while (!compare_exchange_weak(&stack_top, &top, n, release, relaxed));
+}
+
+static struct node *stack_pop(hp_record_t *rec)
+{
+    struct node *top;
+    for (;;) {
+        top = hp_protect(rec, 0, (atomic(void *) *) &stack_top);
+        if (!top)
+            break;
+        struct node *next = load(&top->next, relaxed);
+        if (compare_exchange_weak(&stack_top, &top, next, acquire, relaxed))
+            break;
+    }
+    hp_clear(rec, 0);
+    return top;
+}
+
+/* Michael-Scott queue, 'head' always points to a dummy node */
+static atomic(struct node *) queue_head, queue_tail;
+
+static void queue_init(void)
+{
+    struct node *dummy = node_new(0);
+    atomic_init(&queue_head, dummy);
+    atomic_init(&queue_tail, dummy);
+}
+
+static void queue_push(hp_record_t *rec, struct node *n)
+{
+    for (;;) {
+        struct node *tail = hp_protect(rec, 0, (atomic(void *) *) &queue_tail);
+        struct node *next = load(&tail->next, acquire);
+        if (tail != load(&queue_tail, acquire))
+            continue;
+        if (next) {
+            /* Help a lagging enqueuer */
+            compare_exchange_weak(&queue_tail, &tail, next, release, relaxed);
+            continue;
+        }
+        struct node *null = NULL;
+        if (compare_exchange_weak(&tail->next, &null, n, release, relaxed)) {
+            compare_exchange_strong(&queue_tail, &tail, n, release, relaxed);
+            break;
+        }
+    }
+    hp_clear(rec, 0);
+}
+
+static bool queue_pop(hp_record_t *rec, long *value)
+{
+    struct node *head;
+    for (;;) {
+        head = hp_protect(rec, 0, (atomic(void *) *) &queue_head);
+        struct node *tail = load(&queue_tail, acquire);
+        struct node *next = hp_protect(rec, 1, (atomic(void *) *) &head->next);
+        if (head != load(&queue_head, acquire))
+            continue;
+        if (!next) {
+            hp_clear(rec, 0);
+            hp_clear(rec, 1);
+            return false;
+        }
+        if (head == tail) {
+            compare_exchange_weak(&queue_tail, &tail, next, release, relaxed);
+            continue;
+        }
+        *value = next->value;
+        if (compare_exchange_weak(&queue_head, &head, next, acquire, relaxed))
+            break;
+    }
+    hp_clear(rec, 0);
+    hp_clear(rec, 1);
+    node_retire(rec, head);
+    return true;
+}
+
+/* Locked baselines */
+static mutex_t lock;
+static struct node *locked_top, *locked_head, **locked_tail = &locked_head;
+
+enum { BENCH_STACK, BENCH_QUEUE, BENCH_LOCKED_STACK, BENCH_LOCKED_QUEUE, N_BENCH };
+static const char *bench_name[N_BENCH] = {"hp stack", "hp queue",
+                                          "mutex stack", "mutex queue"};
+static int bench;
+static pthread_barrier_t barrier;
+
+static void *worker(void *arg)
+{
+    long id = (long) arg;
+    hp_record_t *rec = hp_acquire(&domain);
+    long value;
+
+    pthread_barrier_wait(&barrier);
+    for (long i = 0; i < OPS; ++i) {
+        struct node *n = node_new(id * OPS + i);
+        switch (bench) {
+        case BENCH_STACK:
+            stack_push(n);
+            if ((n = stack_pop(rec)))
+                node_retire(rec, n);
+            break;
+        case BENCH_QUEUE:
+            queue_push(rec, n);
+            queue_pop(rec, &value);
+            break;
+        case BENCH_LOCKED_STACK:
+            mutex_lock(&lock);
+            store(&n->next, locked_top, relaxed);
+            locked_top = n;
+            n = locked_top;
+            locked_top = load(&n->next, relaxed);
+            mutex_unlock(&lock);
+            node_free(&n->hp);
+            break;
+        case BENCH_LOCKED_QUEUE:
+            mutex_lock(&lock);
+            *locked_tail = n;
+            locked_tail = (struct node **) &n->next;
+            n = locked_head;
+            locked_head = load(&n->next, relaxed);
+            if (!locked_head)
+                locked_tail = &locked_head;
+            mutex_unlock(&lock);
+            node_free(&n->hp);
+            break;
+        }
+    }
+    hp_release(rec);
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void drain(void)
+{
+    hp_record_t *rec = hp_acquire(&domain);
+    struct node *n;
+    long value;
+    while ((n = stack_pop(rec)))
+        node_retire(rec, n);
+    while (queue_pop(rec, &value))
+        ;
+    hp_release(rec);
+
+    while ((n = locked_top)) {
+        locked_top = load(&n->next, relaxed);
+        node_free(&n->hp);
+    }
+    while ((n = locked_head)) {
+        locked_head = load(&n->next, relaxed);
+        node_free(&n->hp);
+    }
+    locked_tail = &locked_head;
+}
+
+static double run(int nthreads)
+{
+    pthread_t threads[MAX_THREADS];
+
+    hp_domain_init(&domain);
+    queue_init();
+    store(&peak_retired, 0, relaxed);
+
+    /* Keep the containers non-empty so that pops do not just fail */
+    hp_record_t *rec = hp_acquire(&domain);
+    for (long i = 0; i < PREFILL; ++i) {
+        stack_push(node_new(i));
+        queue_push(rec, node_new(i));
+        struct node *n = node_new(i);
+        store(&n->next, locked_top, relaxed);
+        locked_top = n;
+        n = node_new(i);
+        *locked_tail = n;
+        locked_tail = (struct node **) &n->next;
+    }
+    hp_release(rec);
+
+    pthread_barrier_init(&barrier, NULL, nthreads + 1);
+    for (long i = 0; i < nthreads; ++i)
+        pthread_create(&threads[i], NULL, worker, (void *) i);
+    pthread_barrier_wait(&barrier);
+    double start = now();
+    for (int i = 0; i < nthreads; ++i)
+        pthread_join(threads[i], NULL);
+    double elapsed = now() - start;
+    pthread_barrier_destroy(&barrier);
+
+    drain();
+    struct node *dummy = load(&queue_head, relaxed);
+    node_free(&dummy->hp);
+    hp_domain_destroy(&domain);
+
+    if (load(&live_nodes, relaxed)) {
+        fprintf(stderr, "%s: leaked %ld nodes\n", bench_name[bench],
+                load(&live_nodes, relaxed));
+        exit(EXIT_FAILURE);
+    }
+    return 2.0 * OPS * nthreads / elapsed / 1e6;
+}
+
+int main(void)
+{
+    mutex_init(&lock, NULL);
+
+    int max_threads = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_threads < 4)
+        max_threads = 4;
+    if (max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+
+    printf("%8s", "threads");
+    for (bench = 0; bench < N_BENCH; ++bench)
+        printf(" %12s", bench_name[bench]);
+    printf("   (Mops/s, peak retired per thread)\n");
+
+    for (int nthreads = 1; nthreads <= max_threads; nthreads <<= 1) {
+        printf("%8d", nthreads);
+        long peak = 0;
+        for (bench = 0; bench < N_BENCH; ++bench) {
+            printf(" %12.2f", run(nthreads));
+            if (bench == BENCH_QUEUE)
+                peak = load(&peak_retired, relaxed);
+        }
+        printf("   %ld\n", peak);
+    }
+
+    return EXIT_SUCCESS;
+}
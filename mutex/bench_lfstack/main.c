@@ -0,0 +1,174 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lfstack.h"
+#include "spinlock.h"
+
+/* Pop/push pairs on a shared stack of NODES nodes: a spinlock_t protected
+ * list, the double-word CAS Treiber stack and its tagged-pointer variant.
+ * Then freelist_t allocation against malloc()/free() for small objects.
+ */
+
+#define OPS 1000000
+#define NODES 1024
+#define MAX_THREADS 64
+#define OBJ_SIZE 48
+
+enum { BENCH_SPIN, BENCH_DWORD, BENCH_TAGPTR, BENCH_FREELIST, BENCH_MALLOC,
+       N_BENCH };
+static const char *bench_name[N_BENCH] = {"spinlock", "dwcas", "tagptr",
+                                          "freelist", "malloc"};
+
+static struct lfs_node nodes[NODES];
+
+static spinlock_t spin;
+static struct lfs_node *spin_top;
+static lfstack_t dword_stack;
+static lfstack_tp_t tp_stack;
+static freelist_t freelist;
+
+static int bench;
+static pthread_barrier_t barrier;
+
+static void push(struct lfs_node *n)
+{
+    switch (bench) {
+    case BENCH_SPIN:
+        spin_lock(&spin);
+        store(&n->next, spin_top, relaxed);
+        spin_top = n;
+        spin_unlock(&spin);
+        break;
+    case BENCH_DWORD:
+        lfstack_push(&dword_stack, n);
+        break;
+    case BENCH_TAGPTR:
+        lfstack_tp_push(&tp_stack, n);
+        break;
+    }
+}
+
+static struct lfs_node *pop(void)
+{
+    struct lfs_node *n = NULL;
+    switch (bench) {
+    case BENCH_SPIN:
+        spin_lock(&spin);
+        if ((n = spin_top))
+            spin_top = load(&n->next, relaxed);
+        spin_unlock(&spin);
+        break;
+    case BENCH_DWORD:
+        n = lfstack_pop(&dword_stack);
+        break;
+    case BENCH_TAGPTR:
+        n = lfstack_tp_pop(&tp_stack);
+        break;
+    }
+    return n;
+}
+
+static void *worker(void *arg)
+{
+    void *objs[16];
+
+    pthread_barrier_wait(&barrier);
+    switch (bench) {
+    case BENCH_FREELIST:
+    case BENCH_MALLOC:
+        for (long i = 0; i < OPS; i += 16) {
+            for (int j = 0; j < 16; ++j) {
+                objs[j] = bench == BENCH_FREELIST ? freelist_alloc(&freelist)
+                                                  : malloc(OBJ_SIZE);
+                *(volatile char *) objs[j] = 0;
+            }
+            for (int j = 0; j < 16; ++j) {
+                if (bench == BENCH_FREELIST)
+                    freelist_free(&freelist, objs[j]);
+                else
+                    free(objs[j]);
+            }
+        }
+        break;
+    default:
+        for (long i = 0; i < OPS; ++i) {
+            struct lfs_node *n = pop();
+            if (n)
+                push(n);
+        }
+        break;
+    }
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double run(int nthreads)
+{
+    pthread_t threads[MAX_THREADS];
+
+    spin_init(&spin);
+    spin_top = NULL;
+    lfstack_init(&dword_stack);
+    lfstack_tp_init(&tp_stack);
+    freelist_init(&freelist, OBJ_SIZE);
+    if (bench < BENCH_FREELIST) {
+        for (int i = 0; i < NODES; ++i)
+            push(&nodes[i]);
+    }
+
+    pthread_barrier_init(&barrier, NULL, nthreads + 1);
+    for (int i = 0; i < nthreads; ++i)
+        pthread_create(&threads[i], NULL, worker, NULL);
+    pthread_barrier_wait(&barrier);
+    double start = now();
+    for (int i = 0; i < nthreads; ++i)
+        pthread_join(threads[i], NULL);
+    double elapsed = now() - start;
+    pthread_barrier_destroy(&barrier);
+
+    if (bench < BENCH_FREELIST) {
+        int count = 0;
+        while (pop())
+            count++;
+        if (count != NODES) {
+            fprintf(stderr, "%s: %d of %d nodes left\n", bench_name[bench],
+                    count, NODES);
+            exit(EXIT_FAILURE);
+        }
+    }
+    freelist_destroy(&freelist);
+
+    return 2.0 * OPS * nthreads / elapsed / 1e6;
+}
+
+int main(void)
+{
+    int max_threads = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_threads < 4)
+        max_threads = 4;
+    if (max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+
+    printf("%8s", "threads");
+    for (bench = 0; bench < N_BENCH; ++bench)
+        printf(" %10s", bench_name[bench]);
+    printf("   (Mops/s)\n");
+
+    for (int nthreads = 1; nthreads <= max_threads; nthreads <<= 1) {
+        printf("%8d", nthreads);
+        for (bench = 0; bench < N_BENCH; ++bench)
+            printf(" %10.2f", run(nthreads));
+        printf("\n");
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,189 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+/* Thread pool benchmarks:
+ *  - fan-out: a dotprod split into chunks, repeated in batches, with fresh
+ *    pthreads per batch versus pool_submit()/pool_wait()
+ *  - throughput: many empty tasks submitted from outside the pool
+ *  - spawn tree: tasks recursively submitting children from inside the pool,
+ *    which is where stealing kicks in
+ */
+
+#define NCHUNKS 8
+#define VECLEN 4096
+#define BATCHES 2000
+#define EMPTY_TASKS 1000000
+#define TREE_DEPTH 18
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double vec_a[NCHUNKS * VECLEN], vec_b[NCHUNKS * VECLEN];
+
+struct chunk {
+    long offset;
+    double sum;
+};
+
+static void dotprod(void *arg)
+{
+    struct chunk *c = arg;
+    double sum = 0;
+    for (long i = c->offset; i < c->offset + VECLEN; ++i)
+        sum += vec_a[i] * vec_b[i];
+    c->sum = sum;
+}
+
+static void *dotprod_thread(void *arg)
+{
+    dotprod(arg);
+    return NULL;
+}
+
+static double collect(struct chunk *chunks)
+{
+    double sum = 0;
+    for (int i = 0; i < NCHUNKS; ++i)
+        sum += chunks[i].sum;
+    return sum;
+}
+
+static void bench_fanout(pool_t *pool)
+{
+    struct chunk chunks[NCHUNKS];
+    pool_task_t tasks[NCHUNKS];
+    pthread_t threads[NCHUNKS];
+
+    for (int i = 0; i < NCHUNKS * VECLEN; ++i)
+        vec_a[i] = vec_b[i] = 1.0;
+    for (int i = 0; i < NCHUNKS; ++i)
+        chunks[i].offset = i * VECLEN;
+
+    double start = now();
+    for (int n = 0; n < BATCHES; ++n) {
+        for (int i = 0; i < NCHUNKS; ++i)
+            pthread_create(&threads[i], NULL, dotprod_thread, &chunks[i]);
+        for (int i = 0; i < NCHUNKS; ++i)
+            pthread_join(threads[i], NULL);
+        if (collect(chunks) != NCHUNKS * VECLEN)
+            abort();
+    }
+    double t_pthread = now() - start;
+
+    start = now();
+    for (int n = 0; n < BATCHES; ++n) {
+        for (int i = 0; i < NCHUNKS; ++i) {
+            pool_task_init(&tasks[i], dotprod, &chunks[i]);
+            pool_submit(pool, &tasks[i]);
+        }
+        pool_wait(pool);
+        if (collect(chunks) != NCHUNKS * VECLEN)
+            abort();
+    }
+    double t_pool = now() - start;
+
+    printf("fan-out (%d chunks x %d batches)\n", NCHUNKS, BATCHES);
+    printf("  pthread_create/join : %10.0f batches/s\n", BATCHES / t_pthread);
+    printf("  pool_submit/wait    : %10.0f batches/s\n", BATCHES / t_pool);
+}
+
+static void empty(void *arg) {}
+
+static void bench_throughput(pool_t *pool)
+{
+    pool_task_t *tasks = malloc(EMPTY_TASKS * sizeof(*tasks));
+    if (!tasks)
+        abort();
+
+    double start = now();
+    for (int i = 0; i < EMPTY_TASKS; ++i) {
+        pool_task_init(&tasks[i], empty, NULL);
+        pool_submit(pool, &tasks[i]);
+    }
+    pool_wait(pool);
+    double elapsed = now() - start;
+
+    printf("throughput (%d empty tasks from outside)\n", EMPTY_TASKS);
+    printf("  %10.2f Mtasks/s\n", EMPTY_TASKS / elapsed / 1e6);
+    free(tasks);
+}
+
+/* Each node of a complete binary tree is a task which submits its children */
+static pool_t *tree_pool;
+static pool_task_t *tree_tasks;
+
+static void tree_node(void *arg)
+{
+    long idx = (long) arg;
+    for (long child = 2 * idx + 1; child <= 2 * idx + 2; ++child) {
+        if (child < (1L << TREE_DEPTH) - 1) {
+            pool_task_init(&tree_tasks[child], tree_node, (void *) child);
+            pool_submit(tree_pool, &tree_tasks[child]);
+        }
+    }
+}
+
+static void bench_tree(pool_t *pool)
+{
+    long ntasks = (1L << TREE_DEPTH) - 1;
+    tree_tasks = malloc(ntasks * sizeof(*tree_tasks));
+    if (!tree_tasks)
+        abort();
+    tree_pool = pool;
+
+    pool_stats_t before, after;
+    pool_get_stats(pool, &before);
+
+    double start = now();
+    pool_task_init(&tree_tasks[0], tree_node, (void *) 0);
+    pool_submit(pool, &tree_tasks[0]);
+    pool_wait(pool);
+    double elapsed = now() - start;
+
+    pool_get_stats(pool, &after);
+    long executed = after.executed - before.executed;
+    long steals = after.steals - before.steals;
+    long attempts = after.steal_attempts - before.steal_attempts;
+
+    if (executed != ntasks) {
+        fprintf(stderr, "spawn tree: ran %ld of %ld tasks\n", executed, ntasks);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("spawn tree (depth %d, %ld tasks)\n", TREE_DEPTH, ntasks);
+    printf("  %10.2f Mtasks/s\n", ntasks / elapsed / 1e6);
+    printf("  steals %ld (%.2f%% of tasks), steal attempts %ld\n", steals,
+           100.0 * steals / ntasks, attempts);
+    free(tree_tasks);
+}
+
+int main(int argc, char *argv[])
+{
+    int nworkers = argc > 1 ? atoi(argv[1]) : 0;
+
+    pool_t pool;
+    if (!pool_init(&pool, nworkers))
+        return EXIT_FAILURE;
+    printf("pool with %d workers\n", pool.nworkers);
+
+    bench_fanout(&pool);
+    bench_throughput(&pool);
+    bench_tree(&pool);
+
+    pool_stats_t stats;
+    pool_get_stats(&pool, &stats);
+    printf("total: executed %ld, steals %ld, parks %ld\n", (long) stats.executed,
+           (long) stats.steals, (long) stats.parks);
+
+    pool_destroy(&pool);
+    return EXIT_SUCCESS;
+}
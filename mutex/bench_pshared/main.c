@@ -0,0 +1,174 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cond.h"
+#include "mutex.h"
+
+/* IPC between a parent and a forked child through a memfd mapping, with a
+ * process-shared mutex_t/cond_t against pthread pshared mutexes/conditions.
+ *
+ *   lock      uncontended lock/unlock pair in shared memory
+ *   pingpong  the two processes take turns incrementing a shared counter,
+ *             with cond_wait()/cond_signal(); reported per round trip
+ */
+
+#define LOCK_OPS 10000000
+#define PINGPONG_OPS 100000
+
+enum { BENCH_MUTEX, BENCH_PTHREAD, N_BENCH };
+static const char *bench_name[N_BENCH] = {"mutex_t", "pthread"};
+
+struct shared {
+    mutex_t mutex;
+    cond_t cond;
+    pthread_mutex_t pmutex;
+    pthread_cond_t pcond;
+    long turn;
+};
+
+static struct shared *shm;
+static int bench;
+
+static inline void lock(void)
+{
+    if (bench == BENCH_MUTEX)
+        mutex_lock(&shm->mutex);
+    else
+        pthread_mutex_lock(&shm->pmutex);
+}
+
+static inline void unlock(void)
+{
+    if (bench == BENCH_MUTEX)
+        mutex_unlock(&shm->mutex);
+    else
+        pthread_mutex_unlock(&shm->pmutex);
+}
+
+static inline void cond_wait_any(void)
+{
+    if (bench == BENCH_MUTEX)
+        cond_wait(&shm->cond, &shm->mutex);
+    else
+        pthread_cond_wait(&shm->pcond, &shm->pmutex);
+}
+
+static inline void cond_signal_any(void)
+{
+    if (bench == BENCH_MUTEX)
+        cond_signal(&shm->cond, &shm->mutex);
+    else
+        pthread_cond_signal(&shm->pcond);
+}
+
+static void shared_init(void)
+{
+    int fd = memfd_create("bench_pshared", 0);
+    if (fd < 0 || ftruncate(fd, sizeof(*shm))) {
+        perror("memfd_create");
+        exit(EXIT_FAILURE);
+    }
+    shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+
+    mutexattr_t mattr;
+    mutexattr_init(&mattr);
+    mutexattr_setpshared(&mattr, PROCESS_SHARED);
+    mutex_init(&shm->mutex, &mattr);
+    cond_init(&shm->cond);
+
+    pthread_mutexattr_t pmattr;
+    pthread_mutexattr_init(&pmattr);
+    pthread_mutexattr_setpshared(&pmattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&shm->pmutex, &pmattr);
+    pthread_mutexattr_destroy(&pmattr);
+
+    pthread_condattr_t pcattr;
+    pthread_condattr_init(&pcattr);
+    pthread_condattr_setpshared(&pcattr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&shm->pcond, &pcattr);
+    pthread_condattr_destroy(&pcattr);
+}
+
+/* Process 'me' (0 or 1) increments 'turn' whenever it is even or odd */
+static void pingpong(int me)
+{
+    lock();
+    for (long i = 0; i < PINGPONG_OPS; ++i) {
+        while ((shm->turn & 1) != me)
+            cond_wait_any();
+        shm->turn++;
+        cond_signal_any();
+    }
+    unlock();
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Run 'func' in both processes, return the elapsed time */
+static double run2(void (*func)(int))
+{
+    shm->turn = 0;
+    double start = now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        func(1);
+        _exit(EXIT_SUCCESS);
+    }
+    func(0);
+
+    int status;
+    waitpid(pid, &status, 0);
+    double elapsed = now() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "%s: child failed\n", bench_name[bench]);
+        exit(EXIT_FAILURE);
+    }
+    return elapsed;
+}
+
+int main(void)
+{
+    shared_init();
+
+    printf("%10s %12s %14s\n", "", "lock (ns)", "pingpong (us)");
+    for (bench = 0; bench < N_BENCH; ++bench) {
+        double start = now();
+        for (long i = 0; i < LOCK_OPS; ++i) {
+            lock();
+            unlock();
+        }
+        double t_lock = (now() - start) * 1e9 / LOCK_OPS;
+
+        double t_pingpong = run2(pingpong) * 1e6 / PINGPONG_OPS;
+        if (shm->turn != 2 * PINGPONG_OPS)
+            goto broken;
+
+        printf("%10s %12.2f %14.3f\n", bench_name[bench], t_lock, t_pingpong);
+        fflush(stdout);
+    }
+
+    return EXIT_SUCCESS;
+
+broken:
+    fprintf(stderr, "%s: turn %ld\n", bench_name[bench], shm->turn);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,190 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mutex.h"
+#include "rcu.h"
+
+/* Read-scaling benchmark over a routing-table-like structure: readers look
+ * up entries of the current table while a writer replaces the whole table
+ * every millisecond. The table is protected by a pthread rwlock, a mutex_t,
+ * or RCU (flavor picked at build time, see the Makefile).
+ */
+
+#define TABLE_SIZE 256
+#define DURATION_US 500000
+#define UPDATE_US 1000
+#define MAX_THREADS 64
+#define QS_INTERVAL 64
+
+struct table {
+    struct rcu_head rcu;
+    long version;
+    long entries[TABLE_SIZE];
+};
+
+enum { BENCH_RWLOCK, BENCH_MUTEX, BENCH_RCU, N_BENCH };
+static const char *bench_name[N_BENCH] = {"rwlock", "mutex", RCU_NAME};
+
+static atomic(struct table *) table;
+static pthread_rwlock_t rwlock;
+static mutex_t mutex;
+static atomic bool stop;
+static int bench;
+
+static struct table *table_new(long version)
+{
+    struct table *t = malloc(sizeof(*t));
+    if (!t)
+        abort();
+    t->version = version;
+    for (int i = 0; i < TABLE_SIZE; ++i)
+        t->entries[i] = version;
+    return t;
+}
+
+static void table_free(struct rcu_head *head)
+{
+    struct table *t = (struct table *) head;
+    t->version = -1;
+    free(t);
+}
+
+static inline void lookup(struct table *t, unsigned int key)
+{
+    if (t->entries[key % TABLE_SIZE] != t->version)
+        abort();
+}
+
+static void *reader(void *arg)
+{
+    long *reads = arg;
+    unsigned int key = (unsigned long) arg;
+
+    if (bench == BENCH_RCU)
+        rcu_register_thread();
+
+    long n = 0;
+    while (!load(&stop, relaxed)) {
+        key = key * 1103515245 + 12345;
+        switch (bench) {
+        case BENCH_RWLOCK:
+            pthread_rwlock_rdlock(&rwlock);
+            lookup(load(&table, relaxed), key);
+            pthread_rwlock_unlock(&rwlock);
+            break;
+        case BENCH_MUTEX:
+            mutex_lock(&mutex);
+            lookup(load(&table, relaxed), key);
+            mutex_unlock(&mutex);
+            break;
+        case BENCH_RCU:
+            rcu_read_lock();
+            lookup(rcu_dereference(table), key);
+            rcu_read_unlock();
+            if (!(n % QS_INTERVAL))
+                rcu_quiescent_state();
+            break;
+        }
+        n++;
+    }
+
+    if (bench == BENCH_RCU) {
+        rcu_thread_offline();
+        rcu_unregister_thread();
+    }
+    *reads = n;
+    return NULL;
+}
+
+static long update(long version)
+{
+    struct table *new = table_new(version), *old;
+
+    switch (bench) {
+    case BENCH_RWLOCK:
+        pthread_rwlock_wrlock(&rwlock);
+        old = exchange(&table, new, relaxed);
+        pthread_rwlock_unlock(&rwlock);
+        free(old);
+        break;
+    case BENCH_MUTEX:
+        mutex_lock(&mutex);
+        old = exchange(&table, new, relaxed);
+        mutex_unlock(&mutex);
+        free(old);
+        break;
+    case BENCH_RCU:
+        old = exchange(&table, new, release);
+        call_rcu(&old->rcu, table_free);
+        break;
+    }
+    return version;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double run(int nthreads)
+{
+    pthread_t threads[MAX_THREADS];
+    long reads[MAX_THREADS];
+
+    store(&table, table_new(0), relaxed);
+    store(&stop, false, relaxed);
+    for (int i = 0; i < nthreads; ++i)
+        pthread_create(&threads[i], NULL, reader, &reads[i]);
+
+    long version = 0;
+    double start = now();
+    while (now() - start < DURATION_US * 1e-6) {
+        usleep(UPDATE_US);
+        update(++version);
+    }
+    store(&stop, true, relaxed);
+    double elapsed = now() - start;
+
+    long total = 0;
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_join(threads[i], NULL);
+        total += reads[i];
+    }
+
+    if (bench == BENCH_RCU)
+        rcu_barrier();
+    free(load(&table, relaxed));
+
+    return total / elapsed / 1e6;
+}
+
+int main(void)
+{
+    pthread_rwlock_init(&rwlock, NULL);
+    mutex_init(&mutex, NULL);
+
+    int max_threads = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_threads < 4)
+        max_threads = 4;
+    if (max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+
+    printf("%8s", "readers");
+    for (bench = 0; bench < N_BENCH; ++bench)
+        printf(" %12s", bench_name[bench]);
+    printf("   (Mreads/s, table replaced every %d us)\n", UPDATE_US);
+
+    for (int nthreads = 1; nthreads <= max_threads; nthreads <<= 1) {
+        printf("%8d", nthreads);
+        for (bench = 0; bench < N_BENCH; ++bench)
+            printf(" %12.2f", run(nthreads));
+        printf("\n");
+    }
+
+    return EXIT_SUCCESS;
+}
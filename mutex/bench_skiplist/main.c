@@ -0,0 +1,509 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mutex.h"
+#include "skiplist.h"
+
+/* Ordered index under concurrent updates: the skip list against a plain
+ * list.h list behind a mutex_t, kept sorted by calling timsort() whenever a
+ * reader finds it dirty.
+ *
+ *   insert  every thread inserts its share of KEYS keys
+ *   lookup  random point lookups over the full index
+ *   range   half of the threads keep inserting while the others collect
+ *           windows of about RANGE_KEYS keys, anywhere in the key space,
+ *           into an array of node pointers
+ *
+ * Keys are spread over the whole unsigned long range by a bijective hash,
+ * so they are unique and arrive in random order.
+ */
+
+#define KEYS (1 << 16)
+#define MAX_THREADS 64
+#define LOOKUPS 200000
+#define RANGES 20000
+#define RANGE_KEYS 64
+#define RANGE_MAX (4 * RANGE_KEYS) /* room for a window, with margin */
+
+/* A linear scan of KEYS nodes per operation; fewer ops so it completes */
+#define LIST_LOOKUPS 500
+#define LIST_RANGES 500
+
+enum { BENCH_SKIPLIST, BENCH_LIST, N_BENCH };
+static const char *bench_name[N_BENCH] = {"skiplist", "list+timsort"};
+
+typedef int (*list_cmp_func_t)(void *,
+                               const struct list_head *,
+                               const struct list_head *);
+
+/* Implementation of timsort */
+
+static inline size_t run_size(struct list_head *head)
+{
+    if (!head)
+        return 0;
+    if (!head->next)
+        return 1;
+    return (size_t) (head->next->prev);
+}
+
+struct pair {
+    struct list_head *head, *next;
+};
+
+static size_t stk_size;
+
+static struct list_head *merge(void *priv,
+                               list_cmp_func_t cmp,
+                               struct list_head *a,
+                               struct list_head *b)
+{
+    struct list_head *head;
+    struct list_head **tail = &head;
+
+    for (;;) {
+        /* if equal, take 'a' -- important for sort stability */
+        if (cmp(priv, a, b) <= 0) {
+            *tail = a;
+            tail = &a->next;
+            a = a->next;
+            if (!a) {
+                *tail = b;
+                break;
+            }
+        } else {
+            *tail = b;
+            tail = &b->next;
+            b = b->next;
+            if (!b) {
+                *tail = a;
+                break;
+            }
+        }
+    }
+    return head;
+}
+
+static void build_prev_link(struct list_head *head,
+                            struct list_head *tail,
+                            struct list_head *list)
+{
+    tail->next = list;
+    do {
+        list->prev = tail;
+        tail = list;
+        list = list->next;
+    } while (list);
+
+    /* The final links to make a circular doubly-linked list */
+    tail->next = head;
+    head->prev = tail;
+}
+
+static void merge_final(void *priv,
+                        list_cmp_func_t cmp,
+                        struct list_head *head,
+                        struct list_head *a,
+                        struct list_head *b)
+{
+    struct list_head *tail = head;
+
+    for (;;) {
+        /* if equal, take 'a' -- important for sort stability */
+        if (cmp(priv, a, b) <= 0) {
+            tail->next = a;
+            a->prev = tail;
+            tail = a;
+            a = a->next;
+            if (!a)
+                break;
+        } else {
+            tail->next = b;
+            b->prev = tail;
+            tail = b;
+            b = b->next;
+            if (!b) {
+                b = a;
+                break;
+            }
+        }
+    }
+
+    /* Finish linking remainder of list b on to tail */
+    build_prev_link(head, tail, b);
+}
+
+static struct pair find_run(void *priv,
+                            struct list_head *list,
+                            list_cmp_func_t cmp)
+{
+    size_t len = 1;
+    struct list_head *next = list->next, *head = list;
+    struct pair result;
+
+    if (!next) {
+        result.head = head, result.next = next;
+        return result;
+    }
+
+    if (cmp(priv, list, next) > 0) {
+        /* decending run, also reverse the list */
+        struct list_head *prev = NULL;
+        do {
+            len++;
+            list->next = prev;
+            prev = list;
+            list = next;
+            next = list->next;
+            head = list;
+        } while (next && cmp(priv, list, next) > 0);
+        list->next = prev;
+    } else {
+        do {
+            len++;
+            list = next;
+            next = list->next;
+        } while (next && cmp(priv, list, next) <= 0);
+        list->next = NULL;
+    }
+    head->prev = NULL;
+    head->next->prev = (struct list_head *) len;
+    result.head = head, result.next = next;
+    return result;
+}
+
+static struct list_head *merge_at(void *priv,
+                                  list_cmp_func_t cmp,
+                                  struct list_head *at)
+{
+    size_t len = run_size(at) + run_size(at->prev);
+    struct list_head *prev = at->prev->prev;
+    struct list_head *list = merge(priv, cmp, at->prev, at);
+    list->prev = prev;
+    list->next->prev = (struct list_head *) len;
+    --stk_size;
+    return list;
+}
+
+static struct list_head *merge_force_collapse(void *priv,
+                                              list_cmp_func_t cmp,
+                                              struct list_head *tp)
+{
+    while (stk_size >= 3) {
+        if (run_size(tp->prev->prev) < run_size(tp)) {
+            tp->prev = merge_at(priv, cmp, tp->prev);
+        } else {
+            tp = merge_at(priv, cmp, tp);
+        }
+    }
+    return tp;
+}
+
+static struct list_head *merge_collapse(void *priv,
+                                        list_cmp_func_t cmp,
+                                        struct list_head *tp)
+{
+    int n;
+    while ((n = stk_size) >= 2) {
+        if ((n >= 3 &&
+             run_size(tp->prev->prev) <= run_size(tp->prev) + run_size(tp)) ||
+            (n >= 4 && run_size(tp->prev->prev->prev) <=
+                           run_size(tp->prev->prev) + run_size(tp->prev))) {
+            if (run_size(tp->prev->prev) < run_size(tp)) {
+                tp->prev = merge_at(priv, cmp, tp->prev);
+            } else {
+                tp = merge_at(priv, cmp, tp);
+            }
+        } else if (run_size(tp->prev) <= run_size(tp)) {
+            tp = merge_at(priv, cmp, tp);
+        } else {
+            break;
+        }
+    }
+
+    return tp;
+}
+
+static void timsort(void *priv, struct list_head *head, list_cmp_func_t cmp)
+{
+    stk_size = 0;
+
+    struct list_head *list = head->next, *tp = NULL;
+    if (head == head->prev)
+        return;
+
+    /* Convert to a null-terminated singly-linked list. */
+    head->prev->next = NULL;
+
+    do {
+        /* Find next run */
+        struct pair result = find_run(priv, list, cmp);
+        result.head->prev = tp;
+        tp = result.head;
+        list = result.next;
+        stk_size++;
+        tp = merge_collapse(priv, cmp, tp);
+    } while (list);
+
+    /* End of input; merge together all the runs. */
+    tp = merge_force_collapse(priv, cmp, tp);
+
+    /* The final merge; rebuild prev links */
+    struct list_head *stk0 = tp, *stk1 = stk0->prev;
+    while (stk1 && stk1->prev)
+        stk0 = stk0->prev, stk1 = stk1->prev;
+    if (stk_size <= 1) {
+        build_prev_link(head, head, stk0);
+        return;
+    }
+    merge_final(priv, cmp, head, stk1, stk0);
+}
+
+/* End of timsort implementation*/
+
+static struct sl_node nodes[2 * KEYS];
+
+static skiplist_t sl;
+
+static mutex_t list_lock;
+static LIST_HEAD(sorted);
+static bool dirty;
+
+static int bench, nthreads;
+static atomic long next_key;
+static pthread_barrier_t barrier;
+
+static inline unsigned long hash(unsigned long key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdUL;
+    key ^= key >> 33;
+    return key;
+}
+
+static int node_cmp(void *priv,
+                    const struct list_head *a,
+                    const struct list_head *b)
+{
+    unsigned long ka = list_entry(a, struct sl_node, list)->key;
+    unsigned long kb = list_entry(b, struct sl_node, list)->key;
+    return ka < kb ? -1 : ka > kb;
+}
+
+static void insert(long i)
+{
+    struct sl_node *node = &nodes[i];
+
+    if (bench == BENCH_SKIPLIST) {
+        if (!skiplist_insert(&sl, node))
+            abort();
+        return;
+    }
+    mutex_lock(&list_lock);
+    list_add_tail(&node->list, &sorted);
+    dirty = true;
+    mutex_unlock(&list_lock);
+}
+
+/* Called with list_lock held */
+static void list_refresh(void)
+{
+    if (dirty) {
+        timsort(NULL, &sorted, node_cmp);
+        dirty = false;
+    }
+}
+
+static bool lookup(unsigned long key)
+{
+    if (bench == BENCH_SKIPLIST)
+        return skiplist_lookup(&sl, key);
+
+    bool found = false;
+    mutex_lock(&list_lock);
+    list_refresh();
+    struct sl_node *node;
+    list_for_each_entry (node, &sorted, list) {
+        if (node->key >= key) {
+            found = node->key == key;
+            break;
+        }
+    }
+    mutex_unlock(&list_lock);
+    return found;
+}
+
+/* Collect [lo, hi] into 'nodes', at most 'max' of them, and check that they
+ * come out sorted. Returns how many there are.
+ */
+static size_t range(unsigned long lo,
+                    unsigned long hi,
+                    struct sl_node **nodes,
+                    size_t max)
+{
+    size_t n = 0;
+
+    if (bench == BENCH_SKIPLIST) {
+        n = skiplist_range(&sl, lo, hi, nodes, max);
+    } else {
+        mutex_lock(&list_lock);
+        list_refresh();
+        struct sl_node *node;
+        list_for_each_entry (node, &sorted, list) {
+            if (node->key > hi)
+                break;
+            if (node->key >= lo) {
+                if (n < max)
+                    nodes[n] = node;
+                n++;
+            }
+        }
+        mutex_unlock(&list_lock);
+    }
+
+    unsigned long prev = lo;
+    for (size_t i = 0; i < n && i < max; ++i) {
+        if (nodes[i]->key < prev || nodes[i]->key > hi)
+            abort();
+        prev = nodes[i]->key;
+    }
+    return n;
+}
+
+static void *insert_worker(void *arg)
+{
+    long id = (long) arg;
+
+    pthread_barrier_wait(&barrier);
+    for (long i = id; i < KEYS; i += nthreads)
+        insert(i);
+    return NULL;
+}
+
+static void *lookup_worker(void *arg)
+{
+    unsigned long seed = (unsigned long) arg * 2654435761UL + 1;
+    long ops = bench == BENCH_SKIPLIST ? LOOKUPS : LIST_LOOKUPS;
+
+    pthread_barrier_wait(&barrier);
+    for (long i = 0; i < ops; ++i) {
+        seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+        /* Every other lookup misses */
+        unsigned long idx = (seed >> 33) % (2 * KEYS);
+        if (lookup(nodes[idx].key) != (idx < KEYS))
+            abort();
+    }
+    return NULL;
+}
+
+static void *range_worker(void *arg)
+{
+    long id = (long) arg;
+    unsigned long seed = id * 2654435761UL + 1;
+    long ops = bench == BENCH_SKIPLIST ? RANGES : LIST_RANGES;
+
+    pthread_barrier_wait(&barrier);
+    if (id & 1) {
+        /* Inserters: the second half of the nodes */
+        long i;
+        while ((i = fetch_add(&next_key, 1, relaxed)) < 2 * KEYS)
+            insert(i);
+        return NULL;
+    }
+
+    /* Scanners share the whole key space, their windows may overlap */
+    struct sl_node *snapshot[RANGE_MAX];
+    unsigned long width = ULONG_MAX / KEYS * RANGE_KEYS;
+    for (long i = 0; i < ops; ++i) {
+        seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+        unsigned long lo = (seed >> 11) % (ULONG_MAX - width);
+        range(lo, lo + width - 1, snapshot, RANGE_MAX);
+    }
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double run(void *(*worker)(void *))
+{
+    pthread_t threads[MAX_THREADS];
+
+    pthread_barrier_init(&barrier, NULL, nthreads + 1);
+    for (long i = 0; i < nthreads; ++i)
+        pthread_create(&threads[i], NULL, worker, (void *) i);
+    pthread_barrier_wait(&barrier);
+    double start = now();
+    for (int i = 0; i < nthreads; ++i)
+        pthread_join(threads[i], NULL);
+    double elapsed = now() - start;
+    pthread_barrier_destroy(&barrier);
+    return elapsed;
+}
+
+/* Everything inserted must come back, in order */
+static void check(long count)
+{
+    static struct sl_node *all[2 * KEYS];
+    long n = range(0, ULONG_MAX, all, 2 * KEYS);
+    bool ordered = true;
+
+    for (long i = 1; i < n && i < 2 * KEYS; ++i) {
+        if (all[i - 1]->key >= all[i]->key)
+            ordered = false;
+    }
+
+    if (n != count || !ordered) {
+        fprintf(stderr, "%s: %ld of %ld nodes, %s\n", bench_name[bench], n,
+                count, ordered ? "sorted" : "out of order");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(void)
+{
+    int max_threads = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_threads < 4)
+        max_threads = 4;
+    if (max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+
+    mutex_init(&list_lock, NULL);
+
+    printf("%8s %14s %10s %10s %10s   (Mops/s)\n", "threads", "", "insert",
+           "lookup", "range");
+    for (nthreads = 2; nthreads <= max_threads; nthreads <<= 1) {
+        for (bench = 0; bench < N_BENCH; ++bench) {
+            skiplist_init(&sl);
+            INIT_LIST_HEAD(&sorted);
+            dirty = false;
+            for (long i = 0; i < 2 * KEYS; ++i)
+                sl_node_init(&nodes[i], hash(i));
+
+            double t = run(insert_worker);
+            printf("%8d %14s %10.3f", nthreads, bench_name[bench],
+                   KEYS / t / 1e6);
+            check(KEYS);
+
+            long ops = bench == BENCH_SKIPLIST ? LOOKUPS : LIST_LOOKUPS;
+            t = run(lookup_worker);
+            printf(" %10.3f", (double) ops * nthreads / t / 1e6);
+
+            ops = bench == BENCH_SKIPLIST ? RANGES : LIST_RANGES;
+            store(&next_key, KEYS, relaxed);
+            t = run(range_worker);
+            printf(" %10.3f\n", (double) ops * ((nthreads + 1) / 2) / t / 1e6);
+            check(2 * KEYS);
+        }
+    }
+
+    mutex_destroy(&list_lock);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,199 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cond.h"
+#include "mutex.h"
+#include "uring.h"
+
+/* Wake throughput: a waker thread releases NWAITERS sleeping threads per
+ * round, each parked on its own futex word. The syscall path issues one
+ * FUTEX_WAKE per waiter; the io_uring path queues NWAITERS wake requests and
+ * submits them with a single io_uring_enter().
+ *
+ * Afterwards, an event loop acquires a mutex_t and waits on a cond_t
+ * asynchronously while a pipe read is in flight on the same ring.
+ */
+
+#define NWAITERS 8
+#define ROUNDS 20000
+
+static atomic int gen[NWAITERS];
+static atomic int acks;
+
+static void *waiter(void *arg)
+{
+    atomic int *word = arg;
+    int seen = 0;
+
+    for (;;) {
+        int g;
+        while ((g = load(word, acquire)) == seen)
+            futex_wait(word, seen);
+        if (g < 0)
+            break;
+        seen = g;
+        if (fetch_add(&acks, 1, acq_rel) + 1 == seen * NWAITERS)
+            futex_wake(&acks, 1);
+    }
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double bench_wake(uring_t *ring)
+{
+    pthread_t threads[NWAITERS];
+
+    atomic_init(&acks, 0);
+    for (int i = 0; i < NWAITERS; ++i) {
+        atomic_init(&gen[i], 0);
+        pthread_create(&threads[i], NULL, waiter, &gen[i]);
+    }
+
+    double start = now();
+    for (int r = 1; r <= ROUNDS; ++r) {
+        for (int i = 0; i < NWAITERS; ++i) {
+            store(&gen[i], r, release);
+            if (ring)
+                uring_futex_wake(ring, &gen[i], 1);
+            else
+                futex_wake(&gen[i], 1);
+        }
+        if (ring)
+            uring_submit(ring);
+
+        int a;
+        while ((a = load(&acks, acquire)) < r * NWAITERS)
+            futex_wait(&acks, a);
+    }
+    double elapsed = now() - start;
+
+    for (int i = 0; i < NWAITERS; ++i) {
+        store(&gen[i], -1, release);
+        futex_wake(&gen[i], 1);
+    }
+    for (int i = 0; i < NWAITERS; ++i)
+        pthread_join(threads[i], NULL);
+
+    /* Failed wakes are the only completions the wake path produces */
+    struct io_uring_cqe *cqe;
+    while (ring && (cqe = uring_peek_cqe(ring)))
+        uring_handle_cqe(ring, cqe);
+
+    return (double) ROUNDS * NWAITERS / elapsed;
+}
+
+static mutex_t mutex;
+static cond_t cond;
+static bool flag;
+static int pipefd[2];
+
+static void *peer(void *arg)
+{
+    usleep(10000);
+    if (write(pipefd[1], "x", 1) != 1)
+        abort();
+    usleep(10000);
+    mutex_unlock(&mutex);
+
+    usleep(10000);
+    mutex_lock(&mutex);
+    flag = true;
+    mutex_unlock(&mutex);
+    cond_signal(&cond, &mutex);
+    return NULL;
+}
+
+static uring_t *loop_ring;
+static int events;
+
+static void locked(uring_op_t *op)
+{
+    printf("  mutex acquired asynchronously\n");
+    events++;
+}
+
+static void signaled(uring_op_t *op)
+{
+    if (!flag) {
+        /* Spurious wake-up, wait again as cond_wait() callers would */
+        uring_cond_wait_async(loop_ring, op, &cond, &mutex, signaled);
+        return;
+    }
+    printf("  condition signaled, mutex re-acquired\n");
+    events++;
+}
+
+static void demo_async(uring_t *ring)
+{
+    pthread_t thread;
+    char buf;
+    uring_op_t op;
+
+    mutex_init(&mutex, NULL);
+    cond_init(&cond);
+    if (pipe(pipefd))
+        abort();
+    loop_ring = ring;
+
+    /* The peer holds the mutex until after it has written to the pipe */
+    mutex_lock(&mutex);
+    pthread_create(&thread, NULL, peer, NULL);
+
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = pipefd[0];
+    sqe->addr = (uintptr_t) &buf;
+    sqe->len = 1;
+    sqe->user_data = 2;
+    uring_mutex_lock_async(ring, &op, &mutex, locked);
+
+    while (events < 2) {
+        struct io_uring_cqe *cqe = uring_wait_cqe(ring);
+        if (uring_handle_cqe(ring, cqe))
+            continue;
+        printf("  pipe read completed (%d byte)\n", cqe->res);
+        uring_cqe_seen(ring);
+        events++;
+    }
+
+    uring_cond_wait_async(ring, &op, &cond, &mutex, signaled);
+    while (events < 3)
+        uring_handle_cqe(ring, uring_wait_cqe(ring));
+    uring_mutex_unlock(ring, &mutex);
+    uring_submit(ring);
+
+    pthread_join(thread, NULL);
+    close(pipefd[0]);
+    close(pipefd[1]);
+}
+
+int main(void)
+{
+    uring_t ring;
+    bool have_uring = uring_init(&ring, 256);
+
+    printf("wake throughput, %d waiters x %d rounds\n", NWAITERS, ROUNDS);
+    printf("  futex syscall : %10.0f wakes/s (%d syscalls per round)\n",
+           bench_wake(NULL), NWAITERS);
+    if (!have_uring) {
+        printf("  io_uring      : futex operations not supported\n");
+        return EXIT_SUCCESS;
+    }
+    printf("  io_uring      : %10.0f wakes/s (1 syscall per round)\n",
+           bench_wake(&ring));
+
+    printf("asynchronous lock acquisition\n");
+    demo_async(&ring);
+
+    uring_exit(&ring);
+    return EXIT_SUCCESS;
+}
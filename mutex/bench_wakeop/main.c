@@ -0,0 +1,378 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "atomic.h"
+
+/* Count the futex system calls made by the primitives included below, in
+ * all and by the calling thread
+ */
+static atomic long nr_futex;
+static _Thread_local long my_futex;
+
+static inline void count_syscall(long nr, ...)
+{
+    if (nr == SYS_futex) {
+        fetch_add(&nr_futex, 1, relaxed);
+        my_futex++;
+    }
+}
+
+#define syscall(...) (count_syscall(__VA_ARGS__), syscall(__VA_ARGS__))
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "cond.h"
+#include "futex.h"
+#include "mutex.h"
+
+/* The clock and node graph of mutex/example, without the printing: a chain
+ * of N_NODES threads which counts to 1 << N_NODES clock ticks, run ROUNDS
+ * times. Once with mutex_unlock() followed by cond_signal() or
+ * cond_broadcast(), once with the fused cond_signal_unlock() and
+ * cond_broadcast_unlock(). Reports futex system calls and time per tick,
+ * thread creation included. The graph seldom has sleepers on a mutex when
+ * it signals, so the fused calls have little to save there.
+ *
+ * Then a producer hands ITEMS items to a consumer through a cond while
+ * N_CONTENDERS threads keep taking the same mutex, yielding the CPU while
+ * they hold it, as does the producer: the mutex has sleepers on most
+ * signals, which FUTEX_WAKE_OP wakes along with the consumer. Reported
+ * apart: the futex calls of the unlock and signal alone.
+ *
+ * Last, one broadcast wakes 1 to MAX_WAITERS waiters at once, ROUNDS times:
+ * cond_broadcast() requeues all but one onto the mutex, which then hands
+ * them over one at a time, while cond_broadcast_unlock() wakes them all to
+ * fight over it.
+ */
+
+#define N_NODES 6
+#define TICKS (1 << N_NODES)
+#define ROUNDS 500
+#define ITEMS 20000
+#define N_CONTENDERS 4
+#define MAX_WAITERS 32
+
+static bool fused;
+
+struct clock {
+    mutex_t mutex;
+    cond_t cond;
+    int ticks;
+};
+
+struct node {
+    struct clock *clock;
+    struct node *parent;
+    mutex_t mutex;
+    cond_t cond;
+    bool ready;
+};
+
+static void clock_init(struct clock *clock)
+{
+    mutex_init(&clock->mutex, NULL);
+    cond_init(&clock->cond);
+    clock->ticks = 0;
+}
+
+static bool clock_wait(struct clock *clock, int ticks)
+{
+    mutex_lock(&clock->mutex);
+    while (clock->ticks >= 0 && clock->ticks < ticks)
+        cond_wait(&clock->cond, &clock->mutex);
+    bool ret = clock->ticks >= ticks;
+    mutex_unlock(&clock->mutex);
+    return ret;
+}
+
+static void clock_broadcast_unlock(struct clock *clock)
+{
+    if (fused) {
+        cond_broadcast_unlock(&clock->cond, &clock->mutex);
+    } else {
+        mutex_unlock(&clock->mutex);
+        cond_broadcast(&clock->cond, &clock->mutex);
+    }
+}
+
+static void clock_tick(struct clock *clock)
+{
+    mutex_lock(&clock->mutex);
+    if (clock->ticks >= 0)
+        ++clock->ticks;
+    clock_broadcast_unlock(clock);
+}
+
+static void clock_stop(struct clock *clock)
+{
+    mutex_lock(&clock->mutex);
+    clock->ticks = -1;
+    clock_broadcast_unlock(clock);
+}
+
+static void node_init(struct clock *clock,
+                      struct node *parent,
+                      struct node *node)
+{
+    node->clock = clock;
+    node->parent = parent;
+    mutex_init(&node->mutex, NULL);
+    cond_init(&node->cond);
+    node->ready = false;
+}
+
+static void node_wait(struct node *node)
+{
+    mutex_lock(&node->mutex);
+    while (!node->ready)
+        cond_wait(&node->cond, &node->mutex);
+    node->ready = false;
+    mutex_unlock(&node->mutex);
+}
+
+static void node_signal(struct node *node)
+{
+    mutex_lock(&node->mutex);
+    node->ready = true;
+    if (fused) {
+        cond_signal_unlock(&node->cond, &node->mutex);
+    } else {
+        mutex_unlock(&node->mutex);
+        cond_signal(&node->cond, &node->mutex);
+    }
+}
+
+static void *thread_func(void *ptr)
+{
+    struct node *self = ptr;
+    bool bit = false;
+
+    for (int i = 1; clock_wait(self->clock, i); ++i) {
+        if (self->parent)
+            node_wait(self->parent);
+        if (bit)
+            node_signal(self);
+        else
+            clock_tick(self->clock);
+        bit = !bit;
+    }
+
+    node_signal(self);
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void round_run(void)
+{
+    struct clock clock;
+    struct node nodes[N_NODES];
+    pthread_t threads[N_NODES];
+
+    clock_init(&clock);
+    node_init(&clock, NULL, &nodes[0]);
+    for (int i = 1; i < N_NODES; ++i)
+        node_init(&clock, &nodes[i - 1], &nodes[i]);
+
+    for (int i = 0; i < N_NODES; ++i)
+        pthread_create(&threads[i], NULL, thread_func, &nodes[i]);
+    clock_tick(&clock);
+    clock_wait(&clock, TICKS);
+    clock_stop(&clock);
+    for (int i = 0; i < N_NODES; ++i)
+        pthread_join(threads[i], NULL);
+}
+
+static void run(void)
+{
+    store(&nr_futex, 0, relaxed);
+    double start = now();
+    for (int i = 0; i < ROUNDS; ++i)
+        round_run();
+    double elapsed = now() - start;
+
+    printf("%24s %14.2f %14.2f\n",
+           fused ? "cond_*_unlock()" : "mutex_unlock(), cond_*()",
+           (double) load(&nr_futex, relaxed) / (ROUNDS * TICKS),
+           elapsed * 1e6 / (ROUNDS * TICKS));
+}
+
+struct queue {
+    mutex_t mutex;
+    cond_t cond;
+    int items;
+    bool stop;
+};
+
+static void *contender_func(void *ptr)
+{
+    struct queue *q = ptr;
+
+    for (;;) {
+        mutex_lock(&q->mutex);
+        if (q->stop)
+            break;
+        sched_yield(); /* the others pile up on the mutex meanwhile */
+        mutex_unlock(&q->mutex);
+    }
+    mutex_unlock(&q->mutex);
+    return NULL;
+}
+
+static void *consumer_func(void *ptr)
+{
+    struct queue *q = ptr;
+
+    for (int i = 0; i < ITEMS; ++i) {
+        mutex_lock(&q->mutex);
+        while (!q->items)
+            cond_wait(&q->cond, &q->mutex);
+        q->items--;
+        mutex_unlock(&q->mutex);
+    }
+    return NULL;
+}
+
+static void run_contended(void)
+{
+    struct queue q = {.items = 0, .stop = false};
+    pthread_t consumer, contenders[N_CONTENDERS];
+
+    mutex_init(&q.mutex, NULL);
+    cond_init(&q.cond);
+    pthread_create(&consumer, NULL, consumer_func, &q);
+    for (int i = 0; i < N_CONTENDERS; ++i)
+        pthread_create(&contenders[i], NULL, contender_func, &q);
+
+    store(&nr_futex, 0, relaxed);
+    long sleepers = 0, signal_calls = 0;
+    double start = now();
+    for (int i = 0; i < ITEMS; ++i) {
+        mutex_lock(&q.mutex);
+        q.items++;
+        sched_yield();
+        if (load(&q.mutex.state, relaxed) & MUTEX_SLEEPING)
+            sleepers++;
+        long calls = my_futex;
+        if (fused) {
+            cond_signal_unlock(&q.cond, &q.mutex);
+        } else {
+            mutex_unlock(&q.mutex);
+            cond_signal(&q.cond, &q.mutex);
+        }
+        signal_calls += my_futex - calls;
+    }
+    pthread_join(consumer, NULL);
+    double elapsed = now() - start;
+    long calls = load(&nr_futex, relaxed);
+
+    mutex_lock(&q.mutex);
+    q.stop = true;
+    mutex_unlock(&q.mutex);
+    for (int i = 0; i < N_CONTENDERS; ++i)
+        pthread_join(contenders[i], NULL);
+
+    printf("%30s %14.2f %14.2f %14.2f %9.0f%%\n",
+           fused ? "cond_signal_unlock()" : "mutex_unlock(), cond_signal()",
+           (double) calls / ITEMS, (double) signal_calls / ITEMS,
+           elapsed * 1e6 / ITEMS, 100.0 * sleepers / ITEMS);
+}
+
+struct gate {
+    mutex_t mutex;
+    cond_t cond;
+    int round;
+    int waiting;
+};
+
+static void *waiter_func(void *ptr)
+{
+    struct gate *g = ptr;
+
+    mutex_lock(&g->mutex);
+    for (int i = 1; i <= ROUNDS; ++i) {
+        g->waiting++;
+        while (g->round < i)
+            cond_wait(&g->cond, &g->mutex);
+    }
+    mutex_unlock(&g->mutex);
+    return NULL;
+}
+
+static void run_broadcast(int nwaiters)
+{
+    struct gate g = {.round = 0, .waiting = 0};
+    pthread_t waiters[MAX_WAITERS];
+
+    mutex_init(&g.mutex, NULL);
+    cond_init(&g.cond);
+    for (int i = 0; i < nwaiters; ++i)
+        pthread_create(&waiters[i], NULL, waiter_func, &g);
+
+    store(&nr_futex, 0, relaxed);
+    double start = now();
+    for (int i = 1; i <= ROUNDS; ++i) {
+        /* every waiter is back in cond_wait() */
+        mutex_lock(&g.mutex);
+        while (g.waiting < i * nwaiters) {
+            mutex_unlock(&g.mutex);
+            sched_yield();
+            mutex_lock(&g.mutex);
+        }
+        g.round = i;
+        if (fused) {
+            cond_broadcast_unlock(&g.cond, &g.mutex);
+        } else {
+            mutex_unlock(&g.mutex);
+            cond_broadcast(&g.cond, &g.mutex);
+        }
+    }
+    for (int i = 0; i < nwaiters; ++i)
+        pthread_join(waiters[i], NULL);
+    double elapsed = now() - start;
+
+    printf("%8d %30s %14.2f %14.2f\n", nwaiters,
+           fused ? "cond_broadcast_unlock()" : "mutex_unlock(), broadcast()",
+           (double) load(&nr_futex, relaxed) / ROUNDS,
+           elapsed * 1e6 / ROUNDS);
+}
+
+int main(void)
+{
+    printf("%d nodes, %d rounds of %d ticks\n", N_NODES, ROUNDS, TICKS);
+    printf("%24s %14s %14s\n", "", "futex / tick", "us / tick");
+    for (int i = 0; i < 2; ++i) {
+        fused = i;
+        run();
+    }
+
+    printf("\n%d items, %d threads contending on the mutex\n", ITEMS,
+           N_CONTENDERS);
+    printf("%30s %14s %14s %14s %10s\n", "", "futex / item", "in signal",
+           "us / item", "sleepers");
+    for (int i = 0; i < 2; ++i) {
+        fused = i;
+        run_contended();
+    }
+
+    printf("\n%d broadcasts\n", ROUNDS);
+    printf("%8s %30s %14s %14s\n", "waiters", "", "futex / bcast",
+           "us / bcast");
+    for (int n = 1; n <= MAX_WAITERS; n *= 2) {
+        for (int i = 0; i < 2; ++i) {
+            fused = i;
+            run_broadcast(n);
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#if !USE_LINUX
+#error "biased.h relies on membarrier(2), build with -DUSE_LINUX"
+#endif
+
+#include <linux/membarrier.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "atomic.h"
+#include "mutex.h"
+#include "spinlock.h"
+
+/* Biased lock for mutexes taken almost always by the same thread.
+ *
+ * The thread holding the bias locks and unlocks with a plain store and a
+ * load of the 'revoke' flag, no read-modify-write, no fence. Every other
+ * thread goes through a regular mutex_t, then raises 'revoke' and waits for
+ * the owner to leave its critical section. This is Dekker's algorithm with
+ * the owner's store-load fence moved to the revoking side: membarrier(2)
+ * with MEMBARRIER_CMD_PRIVATE_EXPEDITED runs a full barrier on every CPU
+ * currently running one of our threads, so either the owner sees 'revoke'
+ * or the revoker sees 'locked'.
+ *
+ * Revocation costs a system call and IPIs, so this only pays off when the
+ * other threads come by rarely. Without membarrier support the owner falls
+ * back to a full fence, about as costly as the atomic in mutex_t.
+ */
+
+typedef struct {
+    /* Written by the owner only */
+    atomic int locked;
+
+    /* Set by a non-owner holding 'lock' */
+    atomic int revoke;
+
+    const void *owner;
+    mutex_t lock;
+    bool membarrier;
+} biased_lock_t;
+
+/* Spins while waiting for the owner before yielding the CPU */
+#define BIASED_SPINS 1000
+
+static _Thread_local char biased_self;
+
+#define biased_barrier_compiler() __asm__ __volatile__("" ::: "memory")
+
+static inline bool biased_membarrier_init(void)
+{
+    int cmds = syscall(__NR_membarrier, MEMBARRIER_CMD_QUERY, 0);
+    return cmds > 0 && (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED) &&
+           !syscall(__NR_membarrier,
+                    MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0);
+}
+
+/* The calling thread gets the bias, for the lifetime of the lock */
+static inline void biased_lock_init(biased_lock_t *b)
+{
+    atomic_init(&b->locked, 0);
+    atomic_init(&b->revoke, 0);
+    b->owner = &biased_self;
+    mutex_init(&b->lock, NULL);
+#if TSAN
+    /* ThreadSanitizer does not know about membarrier() */
+    b->membarrier = false;
+#else
+    b->membarrier = biased_membarrier_init();
+#endif
+}
+
+static inline bool biased_is_owner(biased_lock_t *b)
+{
+    return b->owner == &biased_self;
+}
+
+/* Owner side fence, paired with biased_revoker_fence() */
+static inline void biased_owner_fence(biased_lock_t *b)
+{
+    if (b->membarrier)
+        biased_barrier_compiler();
+    else
+        thread_fence(&b->locked, seq_cst);
+}
+
+static inline void biased_revoker_fence(biased_lock_t *b)
+{
+    if (b->membarrier)
+        syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+    else
+        thread_fence(&b->revoke, seq_cst);
+}
+
+/* Take 'lock' and wait until the owner is out of its critical section. The
+ * owner then keeps off the fast path until biased_revoke_end().
+ */
+static inline void biased_revoke_begin(biased_lock_t *b)
+{
+    mutex_lock(&b->lock);
+    store(&b->revoke, 1, relaxed);
+    biased_revoker_fence(b);
+    for (int i = 0; load(&b->locked, acquire); ++i) {
+        if (i < BIASED_SPINS)
+            spin_hint();
+        else
+            sched_yield();
+    }
+}
+
+static inline void biased_revoke_end(biased_lock_t *b)
+{
+    store(&b->revoke, 0, release);
+    mutex_unlock(&b->lock);
+}
+
+static inline void biased_lock(biased_lock_t *b)
+{
+    if (!biased_is_owner(b)) {
+        biased_revoke_begin(b);
+        return;
+    }
+
+    for (;;) {
+        store(&b->locked, 1, relaxed);
+        biased_owner_fence(b);
+        if (!load(&b->revoke, acquire))
+            return;
+        store(&b->locked, 0, release);
+
+        /* Wait behind the revoker, its unlock clears 'revoke' */
+        mutex_lock(&b->lock);
+        mutex_unlock(&b->lock);
+    }
+}
+
+static inline void biased_unlock(biased_lock_t *b)
+{
+    if (biased_is_owner(b))
+        store(&b->locked, 0, release);
+    else
+        biased_revoke_end(b);
+}
+
+static inline void biased_lock_destroy(biased_lock_t *b)
+{
+    mutex_destroy(&b->lock);
+}
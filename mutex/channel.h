@@ -0,0 +1,301 @@
+#pragma once
+
+#if !USE_LINUX
+#error "channel.h sleeps on shared futexes, build with -DUSE_LINUX"
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "atomic.h"
+#include "futex.h"
+#include "spinlock.h"
+
+/* Single-producer single-consumer channel between processes.
+ *
+ * The ring lives in a memfd, created by one side with chan_create() and
+ * mapped by the other with chan_open() on the inherited or passed file
+ * descriptor. Records are variable-length and read in place: the producer
+ * writes into the ring through chan_reserve()/chan_commit() and the
+ * consumer gets a pointer to the payload from chan_recv(), so nothing is
+ * copied unless the caller wants to.
+ *
+ * Both sides batch: committed records are published by chan_flush(), and
+ * consumed space is handed back to the producer only every quarter of the
+ * ring, or before the consumer goes to sleep. Either side spins briefly on
+ * an empty (full) ring, then parks on a futex doorbell; the peer rings it,
+ * with a system call, only if it sees the flag of a parked waiter.
+ *
+ * A record takes an 8-byte header plus its payload rounded up to 8 bytes,
+ * and may use at most half of the ring.
+ */
+
+struct chan_shared {
+    uint64_t size;
+
+    /* Producer side: published write position, consumer parked on it */
+    struct {
+        atomic unsigned long head;
+        atomic int parked;
+    } __attribute__((aligned(64))) prod;
+
+    /* Consumer side: released read position, producer parked on it */
+    struct {
+        atomic unsigned long tail;
+        atomic int parked;
+    } __attribute__((aligned(64))) cons;
+
+    char data[] __attribute__((aligned(64)));
+};
+
+struct chan_rec {
+    uint32_t len;
+    uint32_t pad;
+    char data[];
+};
+
+/* Length of the filler record which skips to the start of the ring */
+#define CHAN_WRAP UINT32_MAX
+
+#define CHAN_SPINS 1000
+
+/* Process-local view, for one side of the channel */
+typedef struct {
+    struct chan_shared *shm;
+    size_t mapped;
+    unsigned long mask;
+
+    /* Producer: local write position and last seen tail */
+    unsigned long head, tail_cache;
+    unsigned long reserved;
+
+    /* Consumer: local read position, last released tail, last seen head */
+    unsigned long tail, released, head_cache;
+} chan_t;
+
+static inline size_t chan_rec_size(size_t len)
+{
+    return sizeof(struct chan_rec) + ((len + 7) & ~(size_t) 7);
+}
+
+/* 'ring' is the ring size when creating the channel, 0 when opening it */
+static inline bool chan_map(chan_t *ch, int fd, size_t mapped, size_t ring)
+{
+    struct chan_shared *shm =
+        mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED)
+        return false;
+
+    if (ring) {
+        shm->size = ring;
+        atomic_init(&shm->prod.head, 0);
+        atomic_init(&shm->prod.parked, 0);
+        atomic_init(&shm->cons.tail, 0);
+        atomic_init(&shm->cons.parked, 0);
+    } else if (sizeof(*shm) + shm->size != mapped ||
+               (shm->size & (shm->size - 1))) {
+        munmap(shm, mapped);
+        return false;
+    }
+
+    ch->shm = shm;
+    ch->mapped = mapped;
+    ch->mask = shm->size - 1;
+    ch->head = ch->tail_cache = ch->reserved = 0;
+    ch->tail = ch->released = ch->head_cache = 0;
+    return true;
+}
+
+/* Create a channel with a ring of at least 'size' bytes, rounded up to a
+ * power of two. Returns the memfd to hand over to the peer, or -1.
+ */
+static inline int chan_create(chan_t *ch, size_t size)
+{
+    size_t ring = 4096;
+    while (ring < size)
+        ring <<= 1;
+
+    memset(ch, 0, sizeof(*ch));
+    int fd = memfd_create("chan", 0);
+    if (fd < 0)
+        return -1;
+    size_t mapped = sizeof(struct chan_shared) + ring;
+    if (ftruncate(fd, mapped) || !chan_map(ch, fd, mapped, ring)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Map the channel behind 'fd', as created by the peer */
+static inline bool chan_open(chan_t *ch, int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) || (size_t) st.st_size <= sizeof(struct chan_shared))
+        return false;
+    return chan_map(ch, fd, st.st_size, 0);
+}
+
+static inline void chan_close(chan_t *ch)
+{
+    munmap(ch->shm, ch->mapped);
+}
+
+/* Wake 'parked' if the peer sleeps on it. The caller just published its
+ * position; the fence pairs with the one in chan_park().
+ */
+static inline void chan_doorbell(atomic int *parked)
+{
+    thread_fence(parked, seq_cst);
+    if (load(parked, relaxed) && exchange(parked, 0, relaxed))
+        futex_wake_pshared(parked, 1, true);
+}
+
+/* Sleep on 'parked' unless '*pos' moves away from 'old' meanwhile */
+static inline void chan_park(atomic int *parked,
+                             atomic unsigned long *pos,
+                             unsigned long old)
+{
+    store(parked, 1, relaxed);
+    thread_fence(parked, seq_cst);
+    if (load(pos, relaxed) == old)
+        futex_wait_pshared(parked, 1, true);
+    store(parked, 0, relaxed);
+}
+
+/* Producer */
+
+/* Publish the committed records and wake the consumer if it is parked */
+static inline void chan_flush(chan_t *ch)
+{
+    if (load(&ch->shm->prod.head, relaxed) == ch->head)
+        return;
+    store(&ch->shm->prod.head, ch->head, release);
+    chan_doorbell(&ch->shm->prod.parked);
+}
+
+/* Wait until 'need' bytes are free past the local head */
+static inline void chan_wait_space(chan_t *ch, size_t need)
+{
+    struct chan_shared *shm = ch->shm;
+    int spins = 0;
+
+    while (shm->size - (ch->head - ch->tail_cache) < need) {
+        ch->tail_cache = load(&shm->cons.tail, acquire);
+        if (shm->size - (ch->head - ch->tail_cache) >= need)
+            break;
+        if (spins++ < CHAN_SPINS) {
+            spin_hint();
+            continue;
+        }
+        /* The consumer may be waiting for what we have so far */
+        chan_flush(ch);
+        chan_park(&shm->cons.parked, &shm->cons.tail, ch->tail_cache);
+    }
+}
+
+/* Room for a record of 'len' bytes, to be filled in and then passed on with
+ * chan_commit(). Blocks while the ring is full. Returns NULL if 'len' is
+ * too large for the ring.
+ */
+static inline void *chan_reserve(chan_t *ch, size_t len)
+{
+    size_t need = chan_rec_size(len);
+    if (need > ch->shm->size / 2)
+        return NULL;
+
+    size_t off = ch->head & ch->mask;
+    size_t room = ch->shm->size - off;
+    if (room < need) {
+        /* Skip the end of the ring with a filler record */
+        chan_wait_space(ch, room + need);
+        ((struct chan_rec *) (ch->shm->data + off))->len = CHAN_WRAP;
+        ch->head += room;
+        off = 0;
+    } else {
+        chan_wait_space(ch, need);
+    }
+
+    struct chan_rec *rec = (struct chan_rec *) (ch->shm->data + off);
+    rec->len = len;
+    ch->reserved = need;
+    return rec->data;
+}
+
+/* The consumer sees the record at the next chan_flush() */
+static inline void chan_commit(chan_t *ch)
+{
+    ch->head += ch->reserved;
+    ch->reserved = 0;
+}
+
+static inline bool chan_send(chan_t *ch, const void *buf, size_t len)
+{
+    void *p = chan_reserve(ch, len);
+    if (!p)
+        return false;
+    memcpy(p, buf, len);
+    chan_commit(ch);
+    chan_flush(ch);
+    return true;
+}
+
+/* Consumer */
+
+/* Hand the consumed space back to the producer */
+static inline void chan_release_flush(chan_t *ch)
+{
+    if (ch->released == ch->tail)
+        return;
+    ch->released = ch->tail;
+    store(&ch->shm->cons.tail, ch->tail, release);
+    chan_doorbell(&ch->shm->cons.parked);
+}
+
+/* Wait for the next record and return a pointer to its payload, valid until
+ * chan_release(). Blocks while the ring is empty.
+ */
+static inline void *chan_recv(chan_t *ch, size_t *len)
+{
+    struct chan_shared *shm = ch->shm;
+
+    for (;;) {
+        int spins = 0;
+        while (ch->head_cache == ch->tail) {
+            ch->head_cache = load(&shm->prod.head, acquire);
+            if (ch->head_cache != ch->tail)
+                break;
+            if (spins++ < CHAN_SPINS) {
+                spin_hint();
+                continue;
+            }
+            /* The producer may be waiting for room */
+            chan_release_flush(ch);
+            chan_park(&shm->prod.parked, &shm->prod.head, ch->tail);
+        }
+
+        struct chan_rec *rec =
+            (struct chan_rec *) (shm->data + (ch->tail & ch->mask));
+        if (rec->len == CHAN_WRAP) {
+            ch->tail += shm->size - (ch->tail & ch->mask);
+            continue;
+        }
+        *len = rec->len;
+        return rec->data;
+    }
+}
+
+/* Done with the record returned by chan_recv() */
+static inline void chan_release(chan_t *ch)
+{
+    struct chan_rec *rec =
+        (struct chan_rec *) (ch->shm->data + (ch->tail & ch->mask));
+    ch->tail += chan_rec_size(rec->len);
+    if (ch->tail - ch->released >= ch->shm->size / 4)
+        chan_release_flush(ch);
+}
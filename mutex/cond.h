@@ -10,6 +10,13 @@
 #define cond_wait(c, m) pthread_cond_wait(c, m)
 #define cond_signal(c, m) pthread_cond_signal(c)
 #define cond_broadcast(c, m) pthread_cond_broadcast(c)
+/* pthread_cond_clockwait() needs _GNU_SOURCE and glibc 2.30 */
+#define cond_timedwait(c, m, clock, abstime) \
+    (pthread_cond_clockwait(c, m, clock, abstime) == 0)
+#define cond_signal_unlock(c, m) \
+    (pthread_mutex_unlock(m), pthread_cond_signal(c))
+#define cond_broadcast_unlock(c, m) \
+    (pthread_mutex_unlock(m), pthread_cond_broadcast(c))
 
 #else
 
@@ -20,6 +27,9 @@
 #include "mutex.h"
 #include "spinlock.h"
 
+/* A cond_t is as process-shared as the mutex it is used with: place both in
+ * shared memory and initialize the mutex with PROCESS_SHARED.
+ */
 typedef struct {
     atomic int seq;
 } cond_t;
@@ -44,23 +54,101 @@ static inline void cond_wait(cond_t *cond, mutex_t *mutex)
         spin_hint();
     }
 
-    futex_wait(&cond->seq, seq);
+    futex_wait_pshared(&cond->seq, seq, mutex->pshared);
 
     mutex_lock(mutex);
 
-    fetch_or(&mutex->state, MUTEX_SLEEPING, relaxed);  // AAAA
+    /* Waiters may have been requeued onto the mutex by cond_broadcast() */
+    if (mutex->protocol != PRIO_INHERIT)
+        fetch_or(&mutex->state, MUTEX_SLEEPING, relaxed);  // AAAA
+}
+
+/* cond_wait() with an absolute timeout on 'clock'. Returns false if it
+ * expired; the mutex is held again either way.
+ */
+static inline bool cond_timedwait(cond_t *cond,
+                                  mutex_t *mutex,
+                                  clockid_t clock,
+                                  const struct timespec *abstime)
+{
+    int seq = load(&cond->seq, relaxed);
+
+    mutex_unlock(mutex);
+    bool woken = futex_wait_until_pshared(&cond->seq, seq, clock, abstime,
+                                          mutex->pshared);
+    mutex_lock(mutex);
+
+    if (mutex->protocol != PRIO_INHERIT)
+        fetch_or(&mutex->state, MUTEX_SLEEPING, relaxed);
+    return woken;
 }
 
 static inline void cond_signal(cond_t *cond, mutex_t *mutex)
 {
     fetch_add(&cond->seq, 1, relaxed);  // BBBB
-    futex_wake(&cond->seq, 1);          // EEEE
+    futex_wake_pshared(&cond->seq, 1, mutex->pshared);  // EEEE
 }
 
 static inline void cond_broadcast(cond_t *cond, mutex_t *mutex)
 {
-    fetch_add(&cond->seq, 1, relaxed);            // CCCC
-    futex_requeue(&cond->seq, 1, &mutex->state);  // DDDD
+    fetch_add(&cond->seq, 1, relaxed);  // CCCC
+
+    /* The state of a PI mutex belongs to the kernel: a plain requeue onto it
+     * would corrupt it, so wake everybody instead.
+     */
+    if (mutex->protocol == PRIO_INHERIT)
+        futex_wake_pshared(&cond->seq, INT_MAX, mutex->pshared);
+    else
+        futex_requeue_pshared(&cond->seq, 1, &mutex->state,
+                              mutex->pshared);  // DDDD
+}
+
+/* Release 'mutex' and wake the waiters of 'cond' in one go. Equivalent to
+ * mutex_unlock() followed by cond_signal() (or cond_broadcast()), but a
+ * contended mutex is released by the kernel with FUTEX_WAKE_OP, which also
+ * wakes one of its sleepers: one system call instead of two.
+ */
+static inline void cond_wake_unlock(cond_t *cond, mutex_t *mutex, int limit)
+{
+    fetch_add(&cond->seq, 1, relaxed);
+
+    /* PI mutexes are released through the kernel's own protocol */
+    if (mutex->protocol == PRIO_INHERIT) {
+        mutex_unlock(mutex);
+        futex_wake_pshared(&cond->seq, limit, mutex->pshared);
+        return;
+    }
+
+    /* Nobody sleeps on the mutex: unlock it here and only wake the cond */
+    int state = MUTEX_LOCKED;
+    if (compare_exchange_strong(&mutex->state, &state, 0, release, relaxed)) {
+        futex_wake_pshared(&cond->seq, limit, mutex->pshared);
+        return;
+    }
+
+    /* state = 0, then wake one mutex sleeper if the old state was above
+     * MUTEX_LOCKED, i.e. had MUTEX_SLEEPING set
+     */
+    futex_wake_op_pshared(&cond->seq, limit, &mutex->state, 1,
+                          FUTEX_OP(FUTEX_OP_SET, 0, FUTEX_OP_CMP_GT,
+                                   MUTEX_LOCKED),
+                          mutex->pshared);
+}
+
+static inline void cond_signal_unlock(cond_t *cond, mutex_t *mutex)
+{
+    cond_wake_unlock(cond, mutex, 1);
+}
+
+/* Unlike cond_broadcast(), wakes every waiter instead of requeueing them
+ * onto the mutex, as FUTEX_WAKE_OP can not requeue: they all run only to
+ * fight over the mutex, most of them going back to sleep on it. With more
+ * than a few waiters this is slower than mutex_unlock() followed by
+ * cond_broadcast(), which should be preferred then.
+ */
+static inline void cond_broadcast_unlock(cond_t *cond, mutex_t *mutex)
+{
+    cond_wake_unlock(cond, mutex, INT_MAX);
 }
 
 #endif
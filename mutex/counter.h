@@ -0,0 +1,127 @@
+#pragma once
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "atomic.h"
+
+/* A sharded counter spreads updates over cache-line padded slots so that
+ * writers running on different CPUs never bounce the same line. Readers pay
+ * instead: counter_read() walks every slot and sums them up, which is the
+ * right trade-off for statistics that are bumped millions of times per
+ * second and read once in a while.
+ */
+
+#define CACHE_LINE_SIZE 64
+
+typedef struct {
+    union {
+        atomic long count;
+        atomic double sum;
+    };
+    char pad[CACHE_LINE_SIZE - sizeof(long)];
+} __attribute__((aligned(CACHE_LINE_SIZE))) counter_slot_t;
+
+typedef struct {
+    counter_slot_t *slots;
+    unsigned int mask;
+} counter_t;
+
+/* The shard is picked from the CPU number the kernel publishes in the rseq
+ * area that glibc (>= 2.35) registers for every thread, so reading it costs a
+ * single load. The update itself is not a restartable sequence: a thread may
+ * migrate between reading cpu_id and updating the slot, hence the slot is
+ * still updated with an (uncontended, CPU-local) atomic RMW.
+ *
+ * Without rseq, each thread gets a sequential index on first use instead.
+ */
+#if defined(__GLIBC__) && __has_include(<sys/rseq.h>) && !defined(COUNTER_NO_RSEQ)
+#include <sys/rseq.h>
+#define COUNTER_RSEQ 1
+#endif
+
+static _Thread_local unsigned int counter_thread_id = UINT_MAX;
+static atomic unsigned int counter_next_id;
+
+static inline unsigned int counter_shard(void)
+{
+#if COUNTER_RSEQ
+    if (__rseq_size) {
+        struct rseq *rs = (struct rseq *) ((char *) __builtin_thread_pointer() +
+                                           __rseq_offset);
+        return *(volatile __u32 *) &rs->cpu_id;
+    }
+#endif
+    if (counter_thread_id == UINT_MAX)
+        counter_thread_id = fetch_add(&counter_next_id, 1, relaxed);
+    return counter_thread_id;
+}
+
+static inline bool counter_init(counter_t *counter)
+{
+    long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    unsigned int nslots = 1;
+    while (nslots < ncpus)
+        nslots <<= 1;
+
+    counter->slots =
+        aligned_alloc(CACHE_LINE_SIZE, nslots * sizeof(counter_slot_t));
+    if (!counter->slots)
+        return false;
+    memset(counter->slots, 0, nslots * sizeof(counter_slot_t));
+    counter->mask = nslots - 1;
+    return true;
+}
+
+static inline void counter_destroy(counter_t *counter)
+{
+    free(counter->slots);
+    counter->slots = NULL;
+}
+
+static inline void counter_add(counter_t *counter, long value)
+{
+    counter_slot_t *slot = &counter->slots[counter_shard() & counter->mask];
+    fetch_add(&slot->count, value, relaxed);
+}
+
+#define counter_inc(counter) counter_add(counter, 1)
+
+/* The sum is not a snapshot: updates racing with the walk may or may not be
+ * included, but every update that happened-before the call is.
+ */
+static inline long counter_read(counter_t *counter)
+{
+    long sum = 0;
+    for (unsigned int i = 0; i <= counter->mask; ++i)
+        sum += load(&counter->slots[i].count, relaxed);
+    return sum;
+}
+
+/* Floating-point accumulator, e.g. for the partial sums of a dot product.
+ * C11 has no fetch_add for floating types, so fall back to a CAS loop. It is
+ * rarely retried since the slot is almost always private to the CPU.
+ */
+typedef counter_t accum_t;
+
+#define accum_init(accum) counter_init(accum)
+#define accum_destroy(accum) counter_destroy(accum)
+
+static inline void accum_add(accum_t *accum, double value)
+{
+    counter_slot_t *slot = &accum->slots[counter_shard() & accum->mask];
+    double old = load(&slot->sum, relaxed);
+    while (!compare_exchange_weak(&slot->sum, &old, old + value, relaxed,
+                                  relaxed))
+        ;
+}
+
+static inline double accum_read(accum_t *accum)
+{
+    double sum = 0;
+    for (unsigned int i = 0; i <= accum->mask; ++i)
+        sum += load(&accum->slots[i].sum, relaxed);
+    return sum;
+}
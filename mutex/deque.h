@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include "atomic.h"
+
+/* Chase-Lev work-stealing deque, following the C11 formulation in
+ * "Correct and Efficient Work-Stealing for Weak Memory Models" (Lê et al.,
+ * PPoPP 2013). The owner pushes and takes at the bottom, thieves steal from
+ * the top. Only the owner may call deque_push() and deque_take().
+ */
+
+typedef struct deque_array {
+    long size;
+    struct deque_array *retired; /* older, smaller arrays */
+    atomic(void *) buffer[];
+} deque_array_t;
+
+typedef struct {
+    atomic long top, bottom;
+    atomic(deque_array_t *) array;
+} deque_t;
+
+#define DEQUE_EMPTY NULL
+#define DEQUE_ABORT ((void *) 1)
+
+#define DEQUE_INIT_SIZE 64
+
+static inline deque_array_t *deque_array_new(long size)
+{
+    deque_array_t *a = malloc(sizeof(*a) + size * sizeof(a->buffer[0]));
+    if (a) {
+        a->size = size;
+        a->retired = NULL;
+    }
+    return a;
+}
+
+static inline bool deque_init(deque_t *q)
+{
+    deque_array_t *a = deque_array_new(DEQUE_INIT_SIZE);
+    if (!a)
+        return false;
+    atomic_init(&q->top, 0);
+    atomic_init(&q->bottom, 0);
+    atomic_init(&q->array, a);
+    return true;
+}
+
+static inline void deque_destroy(deque_t *q)
+{
+    deque_array_t *a = load(&q->array, relaxed);
+    while (a) {
+        deque_array_t *next = a->retired;
+        free(a);
+        a = next;
+    }
+}
+
+/* Thieves may still be reading the old array, so it can not be freed until
+ * the deque itself is destroyed. The arrays only ever double, so the retired
+ * ones take less memory than the live one.
+ */
+static inline deque_array_t *deque_grow(deque_t *q,
+                                        deque_array_t *a,
+                                        long top,
+                                        long bottom)
+{
+    deque_array_t *new = deque_array_new(a->size << 1);
+    if (!new)
+        abort();
+    for (long i = top; i < bottom; ++i)
+        store(&new->buffer[i % new->size], load(&a->buffer[i % a->size], relaxed),
+              relaxed);
+    new->retired = a;
+    store(&q->array, new, release);
+    return new;
+}
+
+static inline void deque_push(deque_t *q, void *x)
+{
+    long b = load(&q->bottom, relaxed);
+    long t = load(&q->top, acquire);
+    deque_array_t *a = load(&q->array, relaxed);
+    if (b - t > a->size - 1)
+        a = deque_grow(q, a, t, b);
+    store(&a->buffer[b % a->size], x, relaxed);
+    thread_fence(&q->bottom, release);
+    store(&q->bottom, b + 1, relaxed);
+}
+
+/* Returns DEQUE_EMPTY if there is nothing left to take */
+static inline void *deque_take(deque_t *q)
+{
+    long b = load(&q->bottom, relaxed) - 1;
+    deque_array_t *a = load(&q->array, relaxed);
+    store(&q->bottom, b, relaxed);
+    thread_fence(&q->top, seq_cst);
+    long t = load(&q->top, relaxed);
+
+    void *x = DEQUE_EMPTY;
+    if (t <= b) {
+        x = load(&a->buffer[b % a->size], relaxed);
+        if (t == b) {
+            /* Last element, race against the thieves for it */
+            if (!compare_exchange_strong(&q->top, &t, t + 1, seq_cst, relaxed))
+                x = DEQUE_EMPTY;
+            store(&q->bottom, b + 1, relaxed);
+        }
+    } else {
+        store(&q->bottom, b + 1, relaxed);
+    }
+    return x;
+}
+
+/* Returns DEQUE_EMPTY, DEQUE_ABORT if another thread won the race, or the
+ * stolen element.
+ */
+static inline void *deque_steal(deque_t *q)
+{
+    long t = load(&q->top, acquire);
+    thread_fence(&q->top, seq_cst);
+    long b = load(&q->bottom, acquire);
+
+    if (t >= b)
+        return DEQUE_EMPTY;
+
+    deque_array_t *a = load(&q->array, acquire);
+    void *x = load(&a->buffer[t % a->size], relaxed);
+    if (!compare_exchange_strong(&q->top, &t, t + 1, seq_cst, relaxed))
+        return DEQUE_ABORT;
+    return x;
+}
+
+static inline long deque_size(deque_t *q)
+{
+    long b = load(&q->bottom, relaxed);
+    long t = load(&q->top, relaxed);
+    return b > t ? b - t : 0;
+}
@@ -87,8 +87,7 @@ static void node_signal(struct node *node)
 {
     mutex_lock(&node->mutex);
     node->ready = true;
-    mutex_unlock(&node->mutex);
-    cond_signal(&node->cond, &node->mutex);
+    cond_signal_unlock(&node->cond, &node->mutex);
 }
 
 static void *thread_func(void *ptr)
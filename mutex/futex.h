@@ -2,29 +2,126 @@
 
 #if USE_LINUX
 
+#include <errno.h>
 #include <limits.h>
+#include <stdbool.h>
 #include <linux/futex.h>
+#include <sys/prctl.h>
 #include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 
+/* Futexes in memory shared between processes (a MAP_SHARED mapping or a
+ * memfd) need the non-private operations, which the kernel keys on the
+ * backing page instead of on the address space. The *_pshared() variants
+ * pick one or the other at runtime.
+ */
+static inline int futex_flags(bool pshared)
+{
+    return pshared ? 0 : FUTEX_PRIVATE_FLAG;
+}
+
 /* Atomically check if '*futex == value', and if so, go to sleep */
+static inline void futex_wait_pshared(atomic int *futex, int value, bool pshared)
+{
+    syscall(SYS_futex, futex, FUTEX_WAIT | futex_flags(pshared), value, NULL);
+}
+
 static inline void futex_wait(atomic int *futex, int value)
 {
-    syscall(SYS_futex, futex, FUTEX_WAIT_PRIVATE, value, NULL);
+    futex_wait_pshared(futex, value, false);
+}
+
+/* futex_wait() with an absolute timeout on CLOCK_REALTIME or
+ * CLOCK_MONOTONIC. Returns false once 'abstime' has passed.
+ */
+static inline bool futex_wait_until_pshared(atomic int *futex,
+                                            int value,
+                                            clockid_t clock,
+                                            const struct timespec *abstime,
+                                            bool pshared)
+{
+    int op = FUTEX_WAIT_BITSET | futex_flags(pshared);
+    if (clock == CLOCK_REALTIME)
+        op |= FUTEX_CLOCK_REALTIME;
+    return syscall(SYS_futex, futex, op, value, abstime, NULL,
+                   FUTEX_BITSET_MATCH_ANY) == 0 ||
+           errno != ETIMEDOUT;
 }
 
 /* Wake up 'limit' threads currently waiting on 'futex' */
+static inline void futex_wake_pshared(atomic int *futex, int limit, bool pshared)
+{
+    syscall(SYS_futex, futex, FUTEX_WAKE | futex_flags(pshared), limit);
+}
+
 static inline void futex_wake(atomic int *futex, int limit)
 {
-    syscall(SYS_futex, futex, FUTEX_WAKE_PRIVATE, limit);
+    futex_wake_pshared(futex, limit, false);
 }
 
 /* Wake up 'limit' waiters, and re-queue the rest onto a different futex */
+static inline void futex_requeue_pshared(atomic int *futex,
+                                         int limit,
+                                         atomic int *other,
+                                         bool pshared)
+{
+    syscall(SYS_futex, futex, FUTEX_REQUEUE | futex_flags(pshared), limit,
+            INT_MAX, other);
+}
+
 static inline void futex_requeue(atomic int *futex,
                                  int limit,
                                  atomic int *other)
 {
-    syscall(SYS_futex, futex, FUTEX_REQUEUE_PRIVATE, limit, INT_MAX, other);
+    futex_requeue_pshared(futex, limit, other, false);
+}
+
+/* Since Linux 6.16, private futexes of a threaded process hash into a
+ * table of its own, sized for the number of CPUs (16 buckets at least)
+ * rather than the system-wide one. A process keeping thousands of futexes
+ * contended at once gets long bucket chains, which every wait and wake walks
+ * under the bucket lock. futex_hash_init() sizes the table for 'nfutexes'
+ * futexes in use at the same time; call it at startup, before the threads
+ * pile up. Returns the number of buckets in use, or 0 if the process uses
+ * the global hash, e.g. on older kernels.
+ */
+#ifndef PR_FUTEX_HASH
+#define PR_FUTEX_HASH 78
+#define PR_FUTEX_HASH_SET_SLOTS 1
+#define PR_FUTEX_HASH_GET_SLOTS 2
+#endif
+
+#define FUTEX_HASH_MIN_SLOTS 16
+#define FUTEX_HASH_MAX_SLOTS (1 << 16)
+
+static inline int futex_hash_init(unsigned long nfutexes)
+{
+    unsigned long slots = FUTEX_HASH_MIN_SLOTS;
+    while (slots < nfutexes && slots < FUTEX_HASH_MAX_SLOTS)
+        slots <<= 1;
+
+    /* Fails on older kernels, or once the process went back to the global
+     * hash; report what is in use either way
+     */
+    prctl(PR_FUTEX_HASH, PR_FUTEX_HASH_SET_SLOTS, slots, 0, 0);
+    int ret = prctl(PR_FUTEX_HASH, PR_FUTEX_HASH_GET_SLOTS, 0, 0, 0);
+    return ret > 0 ? ret : 0;
+}
+
+/* In one system call: apply 'op' (built with FUTEX_OP()) to '*other', wake
+ * 'limit' waiters on 'futex', and 'limit2' waiters on 'other' if the old
+ * value of '*other' passes the comparison in 'op'.
+ */
+static inline void futex_wake_op_pshared(atomic int *futex,
+                                         int limit,
+                                         atomic int *other,
+                                         int limit2,
+                                         int op,
+                                         bool pshared)
+{
+    syscall(SYS_futex, futex, FUTEX_WAKE_OP | futex_flags(pshared), limit,
+            (unsigned long) limit2, other, op);
 }
 
 #ifndef FUTEX_LOCK_PI2_PRIVATE
@@ -32,15 +129,28 @@ static inline void futex_requeue(atomic int *futex,
 #define FUTEX_LOCK_PI2_PRIVATE	(FUTEX_LOCK_PI2 | FUTEX_PRIVATE_FLAG)
 #endif
 
-static inline void futex_lock_pi(atomic int *futex, struct timespec *timeout)
+static inline void futex_lock_pi_pshared(atomic int *futex,
+                                         struct timespec *timeout,
+                                         bool pshared)
 {
     /* Note: val is ignored for FUTEX_LOCK_PI, just fill a dummy value. */
     int val = 0;
-    syscall(SYS_futex, futex, FUTEX_LOCK_PI2_PRIVATE, val, timeout);
+    syscall(SYS_futex, futex, FUTEX_LOCK_PI2 | futex_flags(pshared), val,
+            timeout);
+}
+
+static inline void futex_lock_pi(atomic int *futex, struct timespec *timeout)
+{
+    futex_lock_pi_pshared(futex, timeout, false);
+}
+
+static inline void futex_unlock_pi_pshared(atomic int *futex, bool pshared)
+{
+    syscall(SYS_futex, futex, FUTEX_UNLOCK_PI | futex_flags(pshared));
 }
 
 static inline void futex_unlock_pi(atomic int *futex)
 {
-    syscall(SYS_futex, futex, FUTEX_UNLOCK_PI_PRIVATE);
+    futex_unlock_pi_pshared(futex, false);
 }
 #endif
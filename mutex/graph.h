@@ -0,0 +1,216 @@
+#pragma once
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "atomic.h"
+#include "futex.h"
+#include "pool.h"
+
+/* Dependency-counted task graph executed on a pool_t.
+ *
+ * Nodes declare their dependencies once with graph_depend(). Every frame,
+ * graph_run() resets each node's atomic in-degree counter to its number of
+ * dependencies and submits the nodes which have none. A node that finishes
+ * decrements the counters of its successors, and whichever decrement brings
+ * a counter to zero makes that successor ready. Nothing is allocated per
+ * frame, so the same graph can be run over and over.
+ */
+
+typedef struct graph graph_t;
+typedef struct graph_node graph_node_t;
+
+struct graph_node {
+    pool_task_t task;
+    void (*func)(void *arg);
+    void *arg;
+    graph_t *graph;
+
+    graph_node_t **succ;
+    int nsucc, succ_cap;
+
+    int ndeps;          /* static in-degree */
+    atomic int pending; /* dependencies left in the current frame */
+};
+
+struct graph {
+    pool_t *pool;
+    graph_node_t **nodes;
+    int nnodes, nodes_cap;
+
+    bool checked; /* acyclic, verified since the last edge was added */
+
+    /* Nodes left in the current frame, graph_run() sleeps on it */
+    atomic int remaining;
+    atomic int waiters;
+};
+
+static inline void graph_init(graph_t *graph, pool_t *pool)
+{
+    graph->pool = pool;
+    graph->nodes = NULL;
+    graph->nnodes = graph->nodes_cap = 0;
+    graph->checked = false;
+    atomic_init(&graph->remaining, 0);
+    atomic_init(&graph->waiters, 0);
+}
+
+static inline void graph_destroy(graph_t *graph)
+{
+    for (int i = 0; i < graph->nnodes; ++i) {
+        free(graph->nodes[i]->succ);
+        free(graph->nodes[i]);
+    }
+    free(graph->nodes);
+    graph->nodes = NULL;
+    graph->nnodes = graph->nodes_cap = 0;
+}
+
+static inline bool graph_grow(void **array, int *cap, size_t elem_size)
+{
+    int new_cap = *cap ? *cap * 2 : 8;
+    void *new = realloc(*array, new_cap * elem_size);
+    if (!new)
+        return false;
+    *array = new;
+    *cap = new_cap;
+    return true;
+}
+
+/* Returns NULL if out of memory */
+static inline graph_node_t *graph_add_node(graph_t *graph,
+                                           void (*func)(void *),
+                                           void *arg)
+{
+    if (graph->nnodes == graph->nodes_cap &&
+        !graph_grow((void **) &graph->nodes, &graph->nodes_cap,
+                    sizeof(graph->nodes[0])))
+        return NULL;
+
+    graph_node_t *node = malloc(sizeof(*node));
+    if (!node)
+        return NULL;
+    node->func = func;
+    node->arg = arg;
+    node->graph = graph;
+    node->succ = NULL;
+    node->nsucc = node->succ_cap = 0;
+    node->ndeps = 0;
+    atomic_init(&node->pending, 0);
+
+    graph->nodes[graph->nnodes++] = node;
+    return node;
+}
+
+/* Make 'node' run after 'dep' has finished, in every frame */
+static inline bool graph_depend(graph_node_t *node, graph_node_t *dep)
+{
+    if (dep->nsucc == dep->succ_cap &&
+        !graph_grow((void **) &dep->succ, &dep->succ_cap, sizeof(dep->succ[0])))
+        return false;
+
+    dep->succ[dep->nsucc++] = node;
+    node->ndeps++;
+    node->graph->checked = false;
+    return true;
+}
+
+/* Kahn's algorithm, run once after the shape of the graph changed */
+static inline bool graph_check(graph_t *graph)
+{
+    if (graph->checked)
+        return true;
+
+    graph_node_t **queue = malloc(graph->nnodes * sizeof(*queue));
+    if (!queue)
+        return false;
+
+    int head = 0, tail = 0;
+    for (int i = 0; i < graph->nnodes; ++i) {
+        graph_node_t *node = graph->nodes[i];
+        store(&node->pending, node->ndeps, relaxed);
+        if (!node->ndeps)
+            queue[tail++] = node;
+    }
+    while (head < tail) {
+        graph_node_t *node = queue[head++];
+        for (int i = 0; i < node->nsucc; ++i) {
+            graph_node_t *succ = node->succ[i];
+            int left = load(&succ->pending, relaxed) - 1;
+            store(&succ->pending, left, relaxed);
+            if (!left)
+                queue[tail++] = succ;
+        }
+    }
+    free(queue);
+
+    graph->checked = tail == graph->nnodes;
+    return graph->checked;
+}
+
+static inline void graph_node_done(graph_t *graph)
+{
+    if (fetch_sub(&graph->remaining, 1, acq_rel) == 1 &&
+        load(&graph->waiters, seq_cst))
+        futex_wake(&graph->remaining, INT_MAX);
+}
+
+static void graph_node_exec(void *arg)
+{
+    graph_node_t *node = arg;
+    graph_t *graph = node->graph;
+
+    while (node) {
+        node->func(node->arg);
+
+        /* Keep the first successor which becomes ready for ourselves rather
+         * than bouncing it through the deque; it is the most likely one to
+         * find the data 'node' just produced still in cache.
+         */
+        graph_node_t *next = NULL;
+        for (int i = 0; i < node->nsucc; ++i) {
+            graph_node_t *succ = node->succ[i];
+            if (fetch_sub(&succ->pending, 1, acq_rel) != 1)
+                continue;
+            if (!next)
+                next = succ;
+            else
+                pool_submit(graph->pool, &succ->task);
+        }
+
+        graph_node_done(graph);
+        node = next;
+    }
+}
+
+/* Execute one frame and wait for it to finish. Returns false if the graph
+ * has a cycle (or graph_check() ran out of memory), in which case nothing
+ * was run. Must not be called from a task running on graph->pool.
+ */
+static inline bool graph_run(graph_t *graph)
+{
+    if (!graph->nnodes)
+        return true;
+    if (!graph_check(graph))
+        return false;
+
+    for (int i = 0; i < graph->nnodes; ++i) {
+        graph_node_t *node = graph->nodes[i];
+        store(&node->pending, node->ndeps, relaxed);
+        pool_task_init(&node->task, graph_node_exec, node);
+    }
+    store(&graph->remaining, graph->nnodes, release);
+
+    for (int i = 0; i < graph->nnodes; ++i) {
+        if (!graph->nodes[i]->ndeps)
+            pool_submit(graph->pool, &graph->nodes[i]->task);
+    }
+
+    fetch_add(&graph->waiters, 1, seq_cst);
+    int remaining;
+    while ((remaining = load(&graph->remaining, seq_cst)))
+        futex_wait(&graph->remaining, remaining);
+    fetch_sub(&graph->waiters, 1, relaxed);
+    return true;
+}
@@ -0,0 +1,338 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "atomic.h"
+#include "mutex.h"
+#include "seqlock.h"
+
+/* Concurrent hash map with lock striping.
+ *
+ * The map is split into a power-of-two number of stripes, picked by the low
+ * bits of the hash. Every stripe owns a mutex_t and its own bucket table, so
+ * writers to different stripes never contend, and a stripe grows on its own:
+ * once it gets too full it allocates a table twice as large and moves a few
+ * buckets over on every following update, instead of rehashing everything
+ * under the lock in one go.
+ *
+ * By default lookups take the stripe lock too. Built with HMAP_SEQLOCK,
+ * they walk the chains without it and retry if a writer touched the stripe
+ * meanwhile (see seqlock.h), falling back to the lock after a few failed
+ * attempts.
+ *
+ * Nodes are intrusive, in the style of list.h: embed a struct hmap_node and
+ * use hmap_entry() to get back to the container. A node which has been
+ * removed or replaced may still be visited by concurrent lookups, so it must
+ * not be freed right away; defer it with call_rcu() (rcu.h) or recycle it
+ * through a type-stable freelist.
+ */
+
+struct hmap_node {
+    atomic(struct hmap_node *) next;
+    unsigned long hash;
+};
+
+#define hmap_entry(ptr, type, member) \
+    ((type *) ((char *) (ptr) -offsetof(type, member)))
+
+typedef bool hmap_eq_func_t(const struct hmap_node *node, const void *key);
+
+struct hmap_table {
+    size_t mask;
+    struct hmap_table *retired;
+    atomic(struct hmap_node *) buckets[];
+};
+
+struct hmap_stripe {
+    mutex_t lock;
+    seqcount_t seq;
+
+    /* tab[1] is the table being migrated to, NULL if not resizing */
+    atomic(struct hmap_table *) tab[2];
+    size_t rehash_idx;
+    size_t count;
+} __attribute__((aligned(64)));
+
+typedef struct {
+    struct hmap_stripe *stripes;
+    unsigned int stripe_mask, stripe_bits;
+    hmap_eq_func_t *eq;
+} hmap_t;
+
+#define HMAP_INIT_BUCKETS 16
+
+/* Grow a stripe once it holds this many nodes per bucket on average */
+#define HMAP_MAX_LOAD 2
+
+/* Buckets migrated per update while a stripe is resizing */
+#define HMAP_REHASH_STEP 4
+
+/* Optimistic lookups: chain length bound and attempts before locking */
+#define HMAP_MAX_WALK 1024
+#define HMAP_SEQ_TRIES 4
+
+static inline struct hmap_table *hmap_table_new(size_t nbuckets)
+{
+    struct hmap_table *t =
+        calloc(1, sizeof(*t) + nbuckets * sizeof(t->buckets[0]));
+    if (t)
+        t->mask = nbuckets - 1;
+    return t;
+}
+
+/* 'nstripes' is rounded up to a power of two */
+static inline bool hmap_init(hmap_t *map, unsigned int nstripes, hmap_eq_func_t *eq)
+{
+    unsigned int bits = 0;
+    while ((1U << bits) < nstripes)
+        bits++;
+
+    map->stripes = aligned_alloc(64, (1U << bits) * sizeof(struct hmap_stripe));
+    if (!map->stripes)
+        return false;
+    map->stripe_bits = bits;
+    map->stripe_mask = (1U << bits) - 1;
+    map->eq = eq;
+
+    for (unsigned int i = 0; i <= map->stripe_mask; ++i) {
+        struct hmap_stripe *s = &map->stripes[i];
+        struct hmap_table *t = hmap_table_new(HMAP_INIT_BUCKETS);
+        if (!t)
+            abort();
+        mutex_init(&s->lock, NULL);
+        seqcount_init(&s->seq);
+        atomic_init(&s->tab[0], t);
+        atomic_init(&s->tab[1], NULL);
+        s->rehash_idx = 0;
+        s->count = 0;
+    }
+    return true;
+}
+
+static inline struct hmap_stripe *hmap_stripe(hmap_t *map, unsigned long hash)
+{
+    return &map->stripes[hash & map->stripe_mask];
+}
+
+static inline atomic(struct hmap_node *) *
+    hmap_bucket(hmap_t *map, struct hmap_table *t, unsigned long hash)
+{
+    return &t->buckets[(hash >> map->stripe_bits) & t->mask];
+}
+
+/* Search one chain. With 'bounded', give up after HMAP_MAX_WALK nodes, as
+ * an optimistic reader may have followed a stale pointer into a cycle.
+ */
+static inline struct hmap_node *hmap_chain_find(hmap_t *map,
+                                                atomic(struct hmap_node *) *
+                                                    bucket,
+                                                unsigned long hash,
+                                                const void *key,
+                                                bool bounded,
+                                                bool *overrun)
+{
+    int steps = 0;
+    for (struct hmap_node *n = load(bucket, acquire); n;
+         n = load(&n->next, acquire)) {
+        if (bounded && ++steps > HMAP_MAX_WALK) {
+            *overrun = true;
+            return NULL;
+        }
+        if (n->hash == hash && map->eq(n, key))
+            return n;
+    }
+    return NULL;
+}
+
+static inline struct hmap_node *hmap_stripe_find(hmap_t *map,
+                                                 struct hmap_stripe *s,
+                                                 unsigned long hash,
+                                                 const void *key,
+                                                 bool bounded,
+                                                 bool *overrun)
+{
+    for (int i = 0; i < 2; ++i) {
+        struct hmap_table *t = load(&s->tab[i], acquire);
+        if (!t)
+            break;
+        struct hmap_node *n = hmap_chain_find(
+            map, hmap_bucket(map, t, hash), hash, key, bounded, overrun);
+        if (n || *overrun)
+            return n;
+    }
+    return NULL;
+}
+
+static inline struct hmap_node *hmap_get(hmap_t *map,
+                                         unsigned long hash,
+                                         const void *key)
+{
+    struct hmap_stripe *s = hmap_stripe(map, hash);
+    bool overrun = false;
+    struct hmap_node *n;
+
+#if HMAP_SEQLOCK
+    for (int tries = 0; tries < HMAP_SEQ_TRIES; ++tries) {
+        unsigned int seq = read_seqcount_begin(&s->seq);
+        overrun = false;
+        n = hmap_stripe_find(map, s, hash, key, true, &overrun);
+        if (!read_seqcount_retry(&s->seq, seq) && !overrun)
+            return n;
+    }
+    overrun = false;
+#endif
+
+    mutex_lock(&s->lock);
+    n = hmap_stripe_find(map, s, hash, key, false, &overrun);
+    mutex_unlock(&s->lock);
+    return n;
+}
+
+/* Move up to 'nbuckets' buckets to the new table, finishing the resize once
+ * the old table is empty. Called with the stripe lock and seqcount held.
+ */
+static inline void hmap_rehash(hmap_t *map, struct hmap_stripe *s, int nbuckets)
+{
+    struct hmap_table *old = load(&s->tab[0], relaxed);
+    struct hmap_table *new = load(&s->tab[1], relaxed);
+
+    while (nbuckets-- && s->rehash_idx <= old->mask) {
+        atomic(struct hmap_node *) *bucket = &old->buckets[s->rehash_idx++];
+        struct hmap_node *n = load(bucket, relaxed);
+        while (n) {
+            struct hmap_node *next = load(&n->next, relaxed);
+            atomic(struct hmap_node *) *dst = hmap_bucket(map, new, n->hash);
+            store(&n->next, load(dst, relaxed), relaxed);
+            store(dst, n, release);
+            n = next;
+        }
+        store(bucket, NULL, release);
+    }
+
+    if (s->rehash_idx > old->mask) {
+        store(&s->tab[0], new, release);
+        store(&s->tab[1], NULL, release);
+        /* Optimistic readers may still be walking the old table, keep it
+         * around until the map is destroyed. Tables only ever double, so
+         * this costs at most as much as the live table.
+         */
+        new->retired = old;
+    }
+}
+
+static inline void hmap_update_begin(hmap_t *map, struct hmap_stripe *s)
+{
+    mutex_lock(&s->lock);
+    write_seqcount_begin(&s->seq);
+    if (load(&s->tab[1], relaxed))
+        hmap_rehash(map, s, HMAP_REHASH_STEP);
+}
+
+static inline void hmap_update_end(struct hmap_stripe *s)
+{
+    write_seqcount_end(&s->seq);
+    mutex_unlock(&s->lock);
+}
+
+/* Unlink the node matching 'key' from whichever table holds it */
+static inline struct hmap_node *hmap_unlink(hmap_t *map,
+                                            struct hmap_stripe *s,
+                                            unsigned long hash,
+                                            const void *key)
+{
+    for (int i = 0; i < 2; ++i) {
+        struct hmap_table *t = load(&s->tab[i], relaxed);
+        if (!t)
+            break;
+        atomic(struct hmap_node *) *link = hmap_bucket(map, t, hash);
+        struct hmap_node *n;
+        while ((n = load(link, relaxed))) {
+            if (n->hash == hash && map->eq(n, key)) {
+                store(link, load(&n->next, relaxed), release);
+                return n;
+            }
+            link = &n->next;
+        }
+    }
+    return NULL;
+}
+
+/* Insert 'node', replacing the node with the same key if any. Returns the
+ * replaced node, or NULL.
+ */
+static inline struct hmap_node *hmap_put(hmap_t *map,
+                                         struct hmap_node *node,
+                                         unsigned long hash,
+                                         const void *key)
+{
+    struct hmap_stripe *s = hmap_stripe(map, hash);
+    hmap_update_begin(map, s);
+
+    struct hmap_node *old = hmap_unlink(map, s, hash, key);
+    if (!old)
+        s->count++;
+
+    /* New nodes go to the table being migrated to, if any */
+    struct hmap_table *t = load(&s->tab[1], relaxed);
+    if (!t)
+        t = load(&s->tab[0], relaxed);
+    atomic(struct hmap_node *) *bucket = hmap_bucket(map, t, hash);
+    node->hash = hash;
+    store(&node->next, load(bucket, relaxed), relaxed);
+    store(bucket, node, release);
+
+    if (!load(&s->tab[1], relaxed) &&
+        s->count > HMAP_MAX_LOAD * (t->mask + 1)) {
+        struct hmap_table *new = hmap_table_new(2 * (t->mask + 1));
+        if (new) {
+            s->rehash_idx = 0;
+            store(&s->tab[1], new, release);
+        }
+    }
+
+    hmap_update_end(s);
+    return old;
+}
+
+static inline struct hmap_node *hmap_del(hmap_t *map,
+                                         unsigned long hash,
+                                         const void *key)
+{
+    struct hmap_stripe *s = hmap_stripe(map, hash);
+    hmap_update_begin(map, s);
+    struct hmap_node *old = hmap_unlink(map, s, hash, key);
+    if (old)
+        s->count--;
+    hmap_update_end(s);
+    return old;
+}
+
+/* Not thread-safe. Calls 'free_node' (if not NULL) on every node left. */
+static inline void hmap_destroy(hmap_t *map, void (*free_node)(struct hmap_node *))
+{
+    for (unsigned int i = 0; i <= map->stripe_mask; ++i) {
+        struct hmap_stripe *s = &map->stripes[i];
+        for (int j = 0; j < 2; ++j) {
+            struct hmap_table *t = load(&s->tab[j], relaxed);
+            if (!t)
+                continue;
+            for (size_t b = 0; free_node && b <= t->mask; ++b) {
+                struct hmap_node *n = load(&t->buckets[b], relaxed);
+                while (n) {
+                    struct hmap_node *next = load(&n->next, relaxed);
+                    free_node(n);
+                    n = next;
+                }
+            }
+            while (t) {
+                struct hmap_table *retired = t->retired;
+                free(t);
+                t = retired;
+            }
+        }
+        mutex_destroy(&s->lock);
+    }
+    free(map->stripes);
+}
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "atomic.h"
+
+/* Hazard pointers (Michael, 2004) for safe memory reclamation in lock-free
+ * containers built on atomic.h.
+ *
+ * A thread announces the nodes it is about to dereference in the slots of
+ * its hp_record_t. Unlinked nodes are not freed right away but retired to a
+ * thread-local list; once that list grows past a threshold proportional to
+ * the total number of hazard slots, hp_scan() snapshots every slot and frees
+ * the retired nodes nobody protects. That keeps the cost per retired node
+ * constant (amortized), and bounds the unreclaimed memory.
+ *
+ * Nodes are intrusive in the style of list.h: embed a struct hp_node in the
+ * container's node and retire it with the address the container links to.
+ */
+
+#ifndef container_of
+#define container_of(ptr, type, member) \
+    ((type *) ((char *) (ptr) -offsetof(type, member)))
+#endif
+
+#define HP_SLOTS 2
+
+/* Scan once the retire list holds this many times the number of slots */
+#define HP_SCAN_FACTOR 2
+#define HP_SCAN_MIN 64
+
+struct hp_node {
+    struct hp_node *next;
+    void *ptr; /* address compared against the hazard slots */
+    void (*free)(struct hp_node *node);
+};
+
+typedef struct hp_record {
+    atomic(void *) slot[HP_SLOTS];
+    atomic bool active;
+    struct hp_record *next;
+
+    /* Owned by the thread holding the record */
+    struct hp_node *retired;
+    long nretired;
+} __attribute__((aligned(64))) hp_record_t;
+
+typedef struct {
+    atomic(hp_record_t *) records;
+    atomic int nrecords;
+} hp_domain_t;
+
+static inline void hp_domain_init(hp_domain_t *domain)
+{
+    atomic_init(&domain->records, NULL);
+    atomic_init(&domain->nrecords, 0);
+}
+
+/* Get a record for the calling thread, recycling one released earlier */
+static inline hp_record_t *hp_acquire(hp_domain_t *domain)
+{
+    hp_record_t *rec;
+    for (rec = load(&domain->records, acquire); rec; rec = rec->next) {
+        bool inactive = false;
+        if (!load(&rec->active, relaxed) &&
+            compare_exchange_strong(&rec->active, &inactive, true, acquire,
+                                    relaxed))
+            return rec;
+    }
+
+    rec = aligned_alloc(64, sizeof(*rec));
+    if (!rec)
+        abort();
+    for (int i = 0; i < HP_SLOTS; ++i)
+        atomic_init(&rec->slot[i], NULL);
+    atomic_init(&rec->active, true);
+    rec->retired = NULL;
+    rec->nretired = 0;
+
+    fetch_add(&domain->nrecords, 1, relaxed);
+    rec->next = load(&domain->records, relaxed);
+    while (!compare_exchange_weak(&domain->records, &rec->next, rec, release,
+                                  relaxed))
+        ;
+    return rec;
+}
+
+/* The retired nodes stay with the record and are reclaimed by its next
+ * owner or by hp_domain_destroy().
+ */
+static inline void hp_release(hp_record_t *rec)
+{
+    for (int i = 0; i < HP_SLOTS; ++i)
+        store(&rec->slot[i], NULL, release);
+    store(&rec->active, false, release);
+}
+
+/* Load '*src' and protect it in 'slot'. The value is re-read after the
+ * hazard is published, so once this returns the node can not be reclaimed
+ * until the slot is cleared or reused.
+ */
+static inline void *hp_protect(hp_record_t *rec, int slot, atomic(void *) *src)
+{
+    void *ptr = load(src, relaxed);
+    for (;;) {
+        store(&rec->slot[slot], ptr, relaxed);
+        thread_fence(&rec->slot[slot], seq_cst);
+        void *again = load(src, acquire);
+        if (again == ptr)
+            return ptr;
+        ptr = again;
+    }
+}
+
+static inline void hp_clear(hp_record_t *rec, int slot)
+{
+    store(&rec->slot[slot], NULL, release);
+}
+
+static int hp_cmp(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t) *(void *const *) a;
+    uintptr_t y = (uintptr_t) *(void *const *) b;
+    return (x > y) - (x < y);
+}
+
+static inline bool hp_find(void **sorted, long n, void *ptr)
+{
+    long lo = 0, hi = n;
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        if ((uintptr_t) sorted[mid] < (uintptr_t) ptr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < n && sorted[lo] == ptr;
+}
+
+/* Free every node on the retire list of 'rec' which no slot protects */
+static inline void hp_scan(hp_domain_t *domain, hp_record_t *rec)
+{
+    /* Only a hint: records added meanwhile grow the array below */
+    long max = load(&domain->nrecords, acquire) * HP_SLOTS;
+    if (max < HP_SLOTS)
+        max = HP_SLOTS;
+    void **hazards = malloc(max * sizeof(*hazards));
+    if (!hazards)
+        return; /* try again on the next retire */
+
+    /* Pairs with the fence in hp_protect(): the nodes on our retire list
+     * are unlinked already, so any thread which protects one of them after
+     * this point will fail its re-check.
+     */
+    thread_fence(&domain->records, seq_cst);
+
+    /* Every slot must be seen: a hazard left out gets its node freed */
+    long n = 0;
+    for (hp_record_t *r = load(&domain->records, acquire); r; r = r->next) {
+        for (int i = 0; i < HP_SLOTS; ++i) {
+            void *ptr = load(&r->slot[i], acquire);
+            if (!ptr)
+                continue;
+            if (n == max) {
+                void **grown = realloc(hazards, 2 * max * sizeof(*hazards));
+                if (!grown) {
+                    free(hazards);
+                    return;
+                }
+                hazards = grown;
+                max *= 2;
+            }
+            hazards[n++] = ptr;
+        }
+    }
+    qsort(hazards, n, sizeof(*hazards), hp_cmp);
+
+    struct hp_node *node = rec->retired, *keep = NULL;
+    long nkeep = 0;
+    while (node) {
+        struct hp_node *next = node->next;
+        if (hp_find(hazards, n, node->ptr)) {
+            node->next = keep;
+            keep = node;
+            nkeep++;
+        } else {
+            node->free(node);
+        }
+        node = next;
+    }
+    rec->retired = keep;
+    rec->nretired = nkeep;
+    free(hazards);
+}
+
+/* 'ptr' has been unlinked; free 'node' once no hazard protects 'ptr' */
+static inline void hp_retire(hp_domain_t *domain,
+                             hp_record_t *rec,
+                             void *ptr,
+                             struct hp_node *node,
+                             void (*free_node)(struct hp_node *))
+{
+    node->ptr = ptr;
+    node->free = free_node;
+    node->next = rec->retired;
+    rec->retired = node;
+
+    long threshold = HP_SCAN_FACTOR * HP_SLOTS * load(&domain->nrecords, relaxed);
+    if (threshold < HP_SCAN_MIN)
+        threshold = HP_SCAN_MIN;
+    if (++rec->nretired >= threshold)
+        hp_scan(domain, rec);
+}
+
+/* No thread may use the domain any more */
+static inline void hp_domain_destroy(hp_domain_t *domain)
+{
+    hp_record_t *rec = load(&domain->records, acquire);
+    while (rec) {
+        hp_record_t *next = rec->next;
+        struct hp_node *node = rec->retired;
+        while (node) {
+            struct hp_node *n = node->next;
+            node->free(node);
+            node = n;
+        }
+        free(rec);
+        rec = next;
+    }
+    atomic_init(&domain->records, NULL);
+}
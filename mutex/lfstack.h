@@ -0,0 +1,142 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "atomic.h"
+
+/* Lock-free Treiber stack, protected against ABA by a version counter that
+ * is swapped together with the top pointer (compare_exchange_dword()).
+ *
+ * A pop dereferences the top node before its CAS, so a node that has been
+ * popped may still be read by a racing thread: nodes must stay mapped while
+ * the stack is in use. That holds for a freelist, where popped nodes are
+ * recycled and never handed back to the system, which is what freelist_t
+ * below is built for. Anything else needs hazard.h.
+ */
+
+struct lfs_node {
+    atomic(struct lfs_node *) next;
+};
+
+typedef struct {
+    dword_t top; /* lo: struct lfs_node *, hi: version */
+} lfstack_t;
+
+static inline void lfstack_init(lfstack_t *s)
+{
+    s->top.lo = 0;
+    s->top.hi = 0;
+}
+
+static inline void lfstack_push(lfstack_t *s, struct lfs_node *node)
+{
+    dword_t old = load_dword(&s->top), new;
+    do {
+        store(&node->next, (struct lfs_node *) old.lo, relaxed);
+        new.lo = (uintptr_t) node;
+        new.hi = old.hi + 1;
+    } while (!compare_exchange_dword(&s->top, &old, new));
+}
+
+static inline struct lfs_node *lfstack_pop(lfstack_t *s)
+{
+    dword_t old = load_dword(&s->top), new;
+    do {
+        struct lfs_node *top = (struct lfs_node *) old.lo;
+        if (!top)
+            return NULL;
+        new.lo = (uintptr_t) load(&top->next, relaxed);
+        new.hi = old.hi + 1;
+    } while (!compare_exchange_dword(&s->top, &old, new));
+    return (struct lfs_node *) old.lo;
+}
+
+/* Single-word variant with a 16-bit tag in the pointer's upper bits. Same
+ * rules for node lifetime apply; the tag only wraps after 65536 pushes and
+ * pops have happened between a pop's load and its CAS.
+ */
+typedef struct {
+    atomic tagptr_t top;
+} lfstack_tp_t;
+
+static inline void lfstack_tp_init(lfstack_tp_t *s)
+{
+    atomic_init(&s->top, tagptr_make(NULL, 0));
+}
+
+static inline void lfstack_tp_push(lfstack_tp_t *s, struct lfs_node *node)
+{
+    tagptr_t old = load(&s->top, relaxed), new;
+    do {
+        store(&node->next, tagptr_ptr(old), relaxed);
+        new = tagptr_make(node, tagptr_tag(old) + 1);
+    } while (!compare_exchange_weak(&s->top, &old, new, release, relaxed));
+}
+
+static inline struct lfs_node *lfstack_tp_pop(lfstack_tp_t *s)
+{
+    tagptr_t old = load(&s->top, acquire), new;
+    struct lfs_node *top;
+    do {
+        top = tagptr_ptr(old);
+        if (!top)
+            return NULL;
+        new = tagptr_make(load(&top->next, relaxed), tagptr_tag(old) + 1);
+    } while (!compare_exchange_weak(&s->top, &old, new, acquire, acquire));
+    return top;
+}
+
+/* Lock-free freelist of fixed-size objects, refilled a chunk at a time.
+ * Memory is only returned to the system by freelist_destroy().
+ */
+#define FREELIST_CHUNK 64
+
+typedef struct {
+    lfstack_t free;
+    lfstack_t chunks;
+    size_t obj_size;
+} freelist_t;
+
+static inline void freelist_init(freelist_t *fl, size_t obj_size)
+{
+    lfstack_init(&fl->free);
+    lfstack_init(&fl->chunks);
+    if (obj_size < sizeof(struct lfs_node))
+        obj_size = sizeof(struct lfs_node);
+    /* Keep every object aligned like the chunk header */
+    fl->obj_size = (obj_size + 15) & ~(size_t) 15;
+}
+
+static inline void *freelist_alloc(freelist_t *fl)
+{
+    struct lfs_node *node = lfstack_pop(&fl->free);
+    if (node)
+        return node;
+
+    /* First 16 bytes of a chunk link it into fl->chunks */
+    char *chunk = aligned_alloc(16, 16 + FREELIST_CHUNK * fl->obj_size);
+    if (!chunk)
+        return NULL;
+    lfstack_push(&fl->chunks, (struct lfs_node *) chunk);
+
+    char *obj = chunk + 16;
+    for (int i = 1; i < FREELIST_CHUNK; ++i)
+        lfstack_push(&fl->free, (struct lfs_node *) (obj + i * fl->obj_size));
+    return obj;
+}
+
+static inline void freelist_free(freelist_t *fl, void *obj)
+{
+    lfstack_push(&fl->free, obj);
+}
+
+/* No thread may use the freelist any more */
+static inline void freelist_destroy(freelist_t *fl)
+{
+    struct lfs_node *chunk;
+    while ((chunk = lfstack_pop(&fl->chunks)))
+        free(chunk);
+    lfstack_init(&fl->free);
+}
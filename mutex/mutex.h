@@ -12,12 +12,17 @@
 #define mutex_trylock(m) (!pthread_mutex_trylock(m))
 #define mutex_lock pthread_mutex_lock
 #define mutex_unlock pthread_mutex_unlock
+#define mutexattr_init pthread_mutexattr_init
 #define mutexattr_setprotocol pthread_mutexattr_setprotocol
+#define mutexattr_setpshared pthread_mutexattr_setpshared
 #define PRIO_NONE PTHREAD_PRIO_NONE
 #define PRIO_INHERIT PTHREAD_PRIO_INHERIT
+#define PROCESS_PRIVATE PTHREAD_PROCESS_PRIVATE
+#define PROCESS_SHARED PTHREAD_PROCESS_SHARED
 
 #else
 
+#include <pthread.h>
 #include <stdbool.h>
 #include "atomic.h"
 #include "futex.h"
@@ -25,18 +30,54 @@
 
 #define gettid() syscall(SYS_gettid)
 
+/* The PI protocol stores the owner's TID in the futex word. Cache it, as
+ * trylock runs in a spin loop; a forked child drops the parent's value.
+ */
+static _Thread_local pid_t mutex_tid;
+static pthread_once_t mutex_atfork_once = PTHREAD_ONCE_INIT;
+
+static void mutex_atfork_child(void)
+{
+    mutex_tid = 0;
+}
+
+static void mutex_atfork_init(void)
+{
+    pthread_atfork(NULL, NULL, mutex_atfork_child);
+}
+
+static inline pid_t mutex_gettid(void)
+{
+    if (!mutex_tid) {
+        pthread_once(&mutex_atfork_once, mutex_atfork_init);
+        mutex_tid = gettid();
+    }
+    return mutex_tid;
+}
+
 typedef struct Mutex mutex_t;
 struct Mutex {
     atomic int state;
+    int protocol;
+    bool pshared;
     bool (*trylock)(mutex_t *);
     void (*lock)(mutex_t *);
     void (*unlock)(mutex_t *);
 };
 
+/* Set up with mutexattr_init(). Callers which predate it, and only call
+ * mutexattr_setprotocol() on an attribute of their own, still get a
+ * process-private mutex: 'pshared' is only read once mutexattr_init() or
+ * mutexattr_setpshared() stored MUTEXATTR_MAGIC in 'magic'.
+ */
 typedef struct {
     int protocol;
+    int pshared;
+    unsigned int magic;
 } mutexattr_t;
 
+#define MUTEXATTR_MAGIC 0x6d747861U
+
 enum {
     MUTEX_LOCKED = 1 << 0,
     MUTEX_SLEEPING = 1 << 1,
@@ -47,6 +88,14 @@ enum {
     PRIO_INHERIT,
 };
 
+/* A process-shared mutex may live in a MAP_SHARED mapping or a memfd and be
+ * used by every process mapping it, at any address.
+ */
+enum {
+    PROCESS_PRIVATE = 0,
+    PROCESS_SHARED,
+};
+
 #define MUTEX_INITIALIZER         \
     {                             \
         .state = 0, .protocal = 0 \
@@ -71,7 +120,7 @@ static bool mutex_trylock_default(mutex_t *mutex)
 static inline void mutex_lock_default(mutex_t *mutex)
 {
     for (int i = 0; i < MUTEX_SPINS; ++i) {
-        if (mutex->trylock(mutex))
+        if (mutex_trylock_default(mutex))
             return;
         spin_hint();
     }
@@ -79,7 +128,8 @@ static inline void mutex_lock_default(mutex_t *mutex)
     int state = exchange(&mutex->state, MUTEX_LOCKED | MUTEX_SLEEPING, relaxed);
 
     while (state & MUTEX_LOCKED) {
-        futex_wait(&mutex->state, MUTEX_LOCKED | MUTEX_SLEEPING);
+        futex_wait_pshared(&mutex->state, MUTEX_LOCKED | MUTEX_SLEEPING,
+                           mutex->pshared);
         state = exchange(&mutex->state, MUTEX_LOCKED | MUTEX_SLEEPING, relaxed);
     }
 
@@ -90,7 +140,7 @@ static inline void mutex_unlock_default(mutex_t *mutex)
 {
     int state = exchange(&mutex->state, 0, release);
     if (state & MUTEX_SLEEPING)
-        futex_wake(&mutex->state, 1);  // FFFF
+        futex_wake_pshared(&mutex->state, 1, mutex->pshared);  // FFFF
 }
 
 /* FIXME: The memory model should be considered carefully. */
@@ -103,7 +153,7 @@ static bool mutex_trylock_pi(mutex_t *mutex)
      * trylock in kernel, but it should be fine to just try at
      * userspace now. */
     pid_t zero = 0;
-    pid_t tid = gettid();
+    pid_t tid = mutex_gettid();
 
     /* Try to obtain the lock if it is not contended */
     if (cmpxchg(&mutex->state, &zero, tid))
@@ -116,30 +166,33 @@ static bool mutex_trylock_pi(mutex_t *mutex)
 static inline void mutex_lock_pi(mutex_t *mutex)
 {
     for (int i = 0; i < MUTEX_SPINS; ++i) {
-        if (mutex->trylock(mutex))
+        if (mutex_trylock_pi(mutex))
             return;
         spin_hint();
     }
 
     /* Since timeout is set as NULL, so we block until the lock is obtain. */
-    futex_lock_pi(&mutex->state, NULL);
+    futex_lock_pi_pshared(&mutex->state, NULL, mutex->pshared);
 
     thread_fence(&mutex->state, acquire);
 }
 
 static inline void mutex_unlock_pi(mutex_t *mutex)
 {
-    pid_t tid = gettid();
+    pid_t tid = mutex_gettid();
 
     if (cmpxchg(&mutex->state, &tid, 0))
         return;
 
-    futex_unlock_pi(&mutex->state);
+    futex_unlock_pi_pshared(&mutex->state, mutex->pshared);
 }
 
 static inline void mutex_init(mutex_t *mutex, mutexattr_t *mattr)
 {
     atomic_init(&mutex->state, 0);
+    mutex->protocol = mattr ? mattr->protocol : PRIO_NONE;
+    mutex->pshared = mattr && mattr->magic == MUTEXATTR_MAGIC &&
+                     mattr->pshared == PROCESS_SHARED;
 
     // default method
     mutex->trylock = mutex_trylock_default;
@@ -159,19 +212,43 @@ static inline void mutex_init(mutex_t *mutex, mutexattr_t *mattr)
     }
 }
 
+/* The function pointers are only valid in the process which initialized
+ * the mutex, so a process-shared one is dispatched on its protocol instead.
+ */
 static inline bool mutex_trylock(mutex_t *mutex)
 {
-    return mutex->trylock(mutex);
+    if (!mutex->pshared)
+        return mutex->trylock(mutex);
+    if (mutex->protocol == PRIO_INHERIT)
+        return mutex_trylock_pi(mutex);
+    return mutex_trylock_default(mutex);
 }
 
 static inline void mutex_lock(mutex_t *mutex)
 {
-    mutex->lock(mutex);
+    if (!mutex->pshared)
+        mutex->lock(mutex);
+    else if (mutex->protocol == PRIO_INHERIT)
+        mutex_lock_pi(mutex);
+    else
+        mutex_lock_default(mutex);
 }
 
 static inline void mutex_unlock(mutex_t *mutex)
 {
-    mutex->unlock(mutex);
+    if (!mutex->pshared)
+        mutex->unlock(mutex);
+    else if (mutex->protocol == PRIO_INHERIT)
+        mutex_unlock_pi(mutex);
+    else
+        mutex_unlock_default(mutex);
+}
+
+static inline void mutexattr_init(mutexattr_t *mattr)
+{
+    mattr->protocol = PRIO_NONE;
+    mattr->pshared = PROCESS_PRIVATE;
+    mattr->magic = MUTEXATTR_MAGIC;
 }
 
 static inline void mutexattr_setprotocol(mutexattr_t *mattr, int protocol)
@@ -179,6 +256,12 @@ static inline void mutexattr_setprotocol(mutexattr_t *mattr, int protocol)
     mattr->protocol = protocol;
 }
 
+static inline void mutexattr_setpshared(mutexattr_t *mattr, int pshared)
+{
+    mattr->pshared = pshared;
+    mattr->magic = MUTEXATTR_MAGIC;
+}
+
 static inline void mutex_destroy(mutex_t *mutex)
 {
     /* Do nothing now, just for API convention. */
@@ -0,0 +1,352 @@
+#pragma once
+
+#if !USE_LINUX
+#error "pool.h parks idle workers on futexes, build with -DUSE_LINUX"
+#endif
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "atomic.h"
+#include "deque.h"
+#include "futex.h"
+#include "mutex.h"
+#include "spinlock.h"
+
+/* Work-stealing thread pool.
+ *
+ * Each worker owns a Chase-Lev deque. Tasks submitted from a worker (i.e.
+ * from inside a running task) go to the bottom of its own deque; tasks
+ * submitted from any other thread go to a shared injection queue. An idle
+ * worker first drains its own deque, then the injection queue, then tries to
+ * steal from randomly chosen victims, and finally parks on a futex.
+ *
+ * Tasks are intrusive: the caller owns the pool_task_t storage, which must
+ * stay valid until the task has run.
+ */
+
+typedef struct pool_task {
+    void (*func)(void *arg);
+    void *arg;
+    struct pool_task *next; /* link in the injection queue */
+} pool_task_t;
+
+typedef struct pool pool_t;
+
+typedef struct {
+    atomic long executed;
+    atomic long steals;
+    atomic long steal_attempts;
+    atomic long parks;
+} pool_stats_t;
+
+typedef struct {
+    deque_t deque;
+    pool_t *pool;
+    pthread_t thread;
+    unsigned int seed;
+    pool_stats_t stats;
+} __attribute__((aligned(64))) pool_worker_t;
+
+struct pool {
+    pool_worker_t *workers;
+    int nworkers;
+
+    mutex_t inject_lock;
+    pool_task_t *inject_head, **inject_tail;
+    atomic int inject_count;
+
+    /* Number of submitted tasks which have not finished yet */
+    atomic int pending;
+    atomic int waiters;
+
+    /* Event count idle workers sleep on, bumped whenever work shows up */
+    atomic int idle_seq;
+    atomic int sleepers;
+
+    atomic bool stop;
+};
+
+#define POOL_SPINS 64
+
+static _Thread_local pool_worker_t *pool_self;
+
+static inline void pool_task_init(pool_task_t *task,
+                                  void (*func)(void *),
+                                  void *arg)
+{
+    task->func = func;
+    task->arg = arg;
+    task->next = NULL;
+}
+
+static inline pool_task_t *pool_inject_pop(pool_t *pool)
+{
+    if (!load(&pool->inject_count, relaxed))
+        return NULL;
+
+    mutex_lock(&pool->inject_lock);
+    pool_task_t *task = pool->inject_head;
+    if (task) {
+        pool->inject_head = task->next;
+        if (!pool->inject_head)
+            pool->inject_tail = &pool->inject_head;
+        fetch_sub(&pool->inject_count, 1, relaxed);
+    }
+    mutex_unlock(&pool->inject_lock);
+    return task;
+}
+
+static inline unsigned int pool_rand(unsigned int *seed)
+{
+    /* xorshift32 */
+    unsigned int x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *seed = x;
+}
+
+static inline pool_task_t *pool_steal(pool_worker_t *self)
+{
+    pool_t *pool = self->pool;
+    if (pool->nworkers < 2)
+        return NULL;
+
+    /* Start at a random victim and sweep once around the ring */
+    int start = pool_rand(&self->seed) % pool->nworkers;
+    for (int i = 0; i < pool->nworkers; ++i) {
+        pool_worker_t *victim = &pool->workers[(start + i) % pool->nworkers];
+        if (victim == self)
+            continue;
+
+        void *task;
+        do {
+            fetch_add(&self->stats.steal_attempts, 1, relaxed);
+            task = deque_steal(&victim->deque);
+        } while (task == DEQUE_ABORT);
+
+        if (task) {
+            fetch_add(&self->stats.steals, 1, relaxed);
+            return task;
+        }
+    }
+    return NULL;
+}
+
+static inline pool_task_t *pool_find_task(pool_worker_t *self)
+{
+    pool_task_t *task = deque_take(&self->deque);
+    if (!task)
+        task = pool_inject_pop(self->pool);
+    if (!task)
+        task = pool_steal(self);
+    return task;
+}
+
+static inline void pool_run_task(pool_worker_t *self, pool_task_t *task)
+{
+    pool_t *pool = self->pool;
+
+    task->func(task->arg);
+    fetch_add(&self->stats.executed, 1, relaxed);
+
+    if (fetch_sub(&pool->pending, 1, acq_rel) == 1 &&
+        load(&pool->waiters, seq_cst))
+        futex_wake(&pool->pending, INT_MAX);
+}
+
+/* Wake one parked worker, if any. The seq_cst fence pairs with the one in
+ * pool_park(): either the parking worker sees the new task on its final
+ * re-check, or we see it in 'sleepers' and bump the event count.
+ */
+static inline void pool_notify(pool_t *pool)
+{
+    thread_fence(&pool->sleepers, seq_cst);
+    if (load(&pool->sleepers, relaxed)) {
+        fetch_add(&pool->idle_seq, 1, release);
+        futex_wake(&pool->idle_seq, 1);
+    }
+}
+
+static inline bool pool_has_work(pool_t *pool)
+{
+    if (load(&pool->inject_count, relaxed))
+        return true;
+    for (int i = 0; i < pool->nworkers; ++i) {
+        if (deque_size(&pool->workers[i].deque))
+            return true;
+    }
+    return false;
+}
+
+static inline void pool_park(pool_worker_t *self)
+{
+    pool_t *pool = self->pool;
+
+    int seq = load(&pool->idle_seq, acquire);
+    fetch_add(&pool->sleepers, 1, relaxed);
+    thread_fence(&pool->sleepers, seq_cst);
+
+    if (!pool_has_work(pool) && !load(&pool->stop, relaxed)) {
+        fetch_add(&self->stats.parks, 1, relaxed);
+        futex_wait(&pool->idle_seq, seq);
+    }
+
+    fetch_sub(&pool->sleepers, 1, relaxed);
+}
+
+static void *pool_worker_main(void *arg)
+{
+    pool_worker_t *self = arg;
+    pool_t *pool = self->pool;
+    pool_self = self;
+
+    while (!load(&pool->stop, acquire)) {
+        pool_task_t *task = NULL;
+        for (int i = 0; i < POOL_SPINS && !task; ++i) {
+            task = pool_find_task(self);
+            if (!task)
+                spin_hint();
+        }
+
+        if (task)
+            pool_run_task(self, task);
+        else
+            pool_park(self);
+    }
+    return NULL;
+}
+
+/* Stop and join the first 'nthreads' workers, then free the deques of the
+ * first 'ndeques' and the pool itself
+ */
+static inline void pool_teardown(pool_t *pool, int nthreads, int ndeques)
+{
+    store(&pool->stop, true, release);
+    fetch_add(&pool->idle_seq, 1, release);
+    futex_wake(&pool->idle_seq, INT_MAX);
+
+    for (int i = 0; i < nthreads; ++i)
+        pthread_join(pool->workers[i].thread, NULL);
+    for (int i = 0; i < ndeques; ++i)
+        deque_destroy(&pool->workers[i].deque);
+
+    mutex_destroy(&pool->inject_lock);
+    free(pool->workers);
+}
+
+/* Start 'nworkers' threads, or one per online CPU if it is not positive.
+ * Returns false if memory or a thread can not be had, with whatever was
+ * set up until then torn down again.
+ */
+static inline bool pool_init(pool_t *pool, int nworkers)
+{
+    if (nworkers <= 0)
+        nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+
+    pool->workers = aligned_alloc(64, nworkers * sizeof(pool_worker_t));
+    if (!pool->workers)
+        return false;
+    pool->nworkers = nworkers;
+
+    mutex_init(&pool->inject_lock, NULL);
+    pool->inject_head = NULL;
+    pool->inject_tail = &pool->inject_head;
+    atomic_init(&pool->inject_count, 0);
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->waiters, 0);
+    atomic_init(&pool->idle_seq, 0);
+    atomic_init(&pool->sleepers, 0);
+    atomic_init(&pool->stop, false);
+
+    for (int i = 0; i < nworkers; ++i) {
+        pool_worker_t *w = &pool->workers[i];
+        if (!deque_init(&w->deque)) {
+            pool_teardown(pool, 0, i);
+            return false;
+        }
+        w->pool = pool;
+        w->seed = 2654435761u * (i + 1);
+        atomic_init(&w->stats.executed, 0);
+        atomic_init(&w->stats.steals, 0);
+        atomic_init(&w->stats.steal_attempts, 0);
+        atomic_init(&w->stats.parks, 0);
+    }
+
+    for (int i = 0; i < nworkers; ++i) {
+        if (pthread_create(&pool->workers[i].thread, NULL, pool_worker_main,
+                           &pool->workers[i]) != 0) {
+            pool_teardown(pool, i, nworkers);
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline void pool_submit(pool_t *pool, pool_task_t *task)
+{
+    fetch_add(&pool->pending, 1, relaxed);
+
+    pool_worker_t *self = pool_self;
+    if (self && self->pool == pool) {
+        deque_push(&self->deque, task);
+    } else {
+        task->next = NULL;
+        mutex_lock(&pool->inject_lock);
+        *pool->inject_tail = task;
+        pool->inject_tail = &task->next;
+        fetch_add(&pool->inject_count, 1, relaxed);
+        mutex_unlock(&pool->inject_lock);
+    }
+
+    pool_notify(pool);
+}
+
+/* Wait until every submitted task has finished. Called from a worker, it
+ * keeps executing tasks instead of blocking.
+ */
+static inline void pool_wait(pool_t *pool)
+{
+    pool_worker_t *self = pool_self;
+    if (self && self->pool == pool) {
+        while (load(&pool->pending, acquire)) {
+            pool_task_t *task = pool_find_task(self);
+            if (task)
+                pool_run_task(self, task);
+            else
+                spin_hint();
+        }
+        return;
+    }
+
+    fetch_add(&pool->waiters, 1, seq_cst);
+    int pending;
+    while ((pending = load(&pool->pending, seq_cst)))
+        futex_wait(&pool->pending, pending);
+    fetch_sub(&pool->waiters, 1, relaxed);
+}
+
+static inline void pool_get_stats(pool_t *pool, pool_stats_t *stats)
+{
+    long executed = 0, steals = 0, attempts = 0, parks = 0;
+    for (int i = 0; i < pool->nworkers; ++i) {
+        pool_stats_t *s = &pool->workers[i].stats;
+        executed += load(&s->executed, relaxed);
+        steals += load(&s->steals, relaxed);
+        attempts += load(&s->steal_attempts, relaxed);
+        parks += load(&s->parks, relaxed);
+    }
+    atomic_init(&stats->executed, executed);
+    atomic_init(&stats->steals, steals);
+    atomic_init(&stats->steal_attempts, attempts);
+    atomic_init(&stats->parks, parks);
+}
+
+static inline void pool_destroy(pool_t *pool)
+{
+    pool_teardown(pool, pool->nworkers, pool->nworkers);
+}
@@ -0,0 +1,136 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Plain pthread program for A/B runs with and without the shim: producers
+ * and consumers on a bounded queue protected by a statically initialized
+ * mutex and two condition variables, then threads bumping counters under a
+ * PTHREAD_PRIO_INHERIT mutex and a recursive one (the latter stays on
+ * glibc).
+ */
+
+#define ITEMS 1000000
+#define QUEUE_SIZE 64
+#define PAIRS 2
+#define COUNT_OPS 1000000
+#define COUNT_THREADS 4
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t not_full = PTHREAD_COND_INITIALIZER;
+static long queue[QUEUE_SIZE];
+static int head, count;
+static long consumed_sum;
+
+static pthread_mutex_t count_lock;
+static long counter;
+
+static void *producer(void *arg)
+{
+    for (long i = 1; i <= ITEMS; ++i) {
+        pthread_mutex_lock(&lock);
+        while (count == QUEUE_SIZE)
+            pthread_cond_wait(&not_full, &lock);
+        queue[(head + count++) % QUEUE_SIZE] = i;
+        pthread_cond_signal(&not_empty);
+        pthread_mutex_unlock(&lock);
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    long sum = 0;
+    for (long i = 0; i < ITEMS; ++i) {
+        pthread_mutex_lock(&lock);
+        while (count == 0)
+            pthread_cond_wait(&not_empty, &lock);
+        sum += queue[head];
+        head = (head + 1) % QUEUE_SIZE;
+        count--;
+        pthread_cond_signal(&not_full);
+        pthread_mutex_unlock(&lock);
+    }
+    pthread_mutex_lock(&lock);
+    consumed_sum += sum;
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+static void *counting(void *arg)
+{
+    for (long i = 0; i < COUNT_OPS; ++i) {
+        pthread_mutex_lock(&count_lock);
+        counter++;
+        pthread_mutex_unlock(&count_lock);
+    }
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double run_queue(void)
+{
+    pthread_t threads[2 * PAIRS];
+
+    double start = now();
+    for (int i = 0; i < PAIRS; ++i) {
+        pthread_create(&threads[2 * i], NULL, producer, NULL);
+        pthread_create(&threads[2 * i + 1], NULL, consumer, NULL);
+    }
+    for (int i = 0; i < 2 * PAIRS; ++i)
+        pthread_join(threads[i], NULL);
+    double elapsed = now() - start;
+
+    if (consumed_sum != PAIRS * (long) ITEMS * (ITEMS + 1) / 2) {
+        fprintf(stderr, "queue: sum %ld\n", consumed_sum);
+        exit(EXIT_FAILURE);
+    }
+    return elapsed;
+}
+
+static double run_counter(int type, int protocol)
+{
+    pthread_t threads[COUNT_THREADS];
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, type);
+    pthread_mutexattr_setprotocol(&attr, protocol);
+    pthread_mutex_init(&count_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    counter = 0;
+
+    double start = now();
+    for (int i = 0; i < COUNT_THREADS; ++i)
+        pthread_create(&threads[i], NULL, counting, NULL);
+    for (int i = 0; i < COUNT_THREADS; ++i)
+        pthread_join(threads[i], NULL);
+    double elapsed = now() - start;
+
+    pthread_mutex_destroy(&count_lock);
+    if (counter != (long) COUNT_THREADS * COUNT_OPS) {
+        fprintf(stderr, "counter: %ld\n", counter);
+        exit(EXIT_FAILURE);
+    }
+    return elapsed;
+}
+
+int main(void)
+{
+    printf("queue           %8.3f s\n", run_queue());
+    printf("counter, normal %8.3f s\n",
+           run_counter(PTHREAD_MUTEX_NORMAL, PTHREAD_PRIO_NONE));
+    printf("counter, PI     %8.3f s\n",
+           run_counter(PTHREAD_MUTEX_NORMAL, PTHREAD_PRIO_INHERIT));
+    printf("counter, recursive %5.3f s\n",
+           run_counter(PTHREAD_MUTEX_RECURSIVE, PTHREAD_PRIO_NONE));
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,335 @@
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "cond.h"
+#include "futex.h"
+#include "mutex.h"
+
+/* LD_PRELOAD shim routing the pthread mutex and condition variable API of
+ * an unmodified program to mutex_t and cond_t:
+ *
+ *   LD_PRELOAD=./libmutex_preload.so ./program
+ *
+ * A mutex_t is built in place in the pthread_mutex_t. The zero-filled
+ * PTHREAD_MUTEX_INITIALIZER is a valid unlocked default mutex, except for
+ * the function pointers, which are filled in on first use. Mutexes
+ * initialized with PTHREAD_PRIO_INHERIT get the PI protocol.
+ *
+ * Anything mutex_t does not implement is left to glibc: recursive, error
+ * checking and adaptive mutexes, priority ceilings, and process-shared
+ * mutexes (whose function pointers would be wrong in the other process).
+ * Those are told apart by the word at the place of mutex_t.trylock, which
+ * glibc uses for the mutex kind, and which only ever holds one of our own
+ * trylock functions otherwise.
+ *
+ * Condition variables are always handled here, whichever mutex they are
+ * used with.
+ */
+
+_Static_assert(sizeof(mutex_t) <= sizeof(pthread_mutex_t),
+               "mutex_t does not fit in pthread_mutex_t");
+
+struct shim_cond {
+    cond_t cond;
+    clockid_t clock;
+    bool pshared;
+
+    /* Last mutex waited with, if it is a mutex_t: cond_broadcast() requeues
+     * the waiters onto it
+     */
+    atomic(mutex_t *) mutex;
+};
+
+_Static_assert(sizeof(struct shim_cond) <= sizeof(pthread_cond_t),
+               "struct shim_cond does not fit in pthread_cond_t");
+
+static int (*real_mutex_init)(pthread_mutex_t *, const pthread_mutexattr_t *);
+static int (*real_mutex_destroy)(pthread_mutex_t *);
+static int (*real_mutex_lock)(pthread_mutex_t *);
+static int (*real_mutex_trylock)(pthread_mutex_t *);
+static int (*real_mutex_timedlock)(pthread_mutex_t *, const struct timespec *);
+static int (*real_mutex_clocklock)(pthread_mutex_t *,
+                                   clockid_t,
+                                   const struct timespec *);
+static int (*real_mutex_unlock)(pthread_mutex_t *);
+
+static void *shim_lookup(const char *name)
+{
+    void *sym = dlsym(RTLD_NEXT, name);
+    if (!sym) {
+        fprintf(stderr, "mutex preload: %s not found\n", name);
+        abort();
+    }
+    return sym;
+}
+
+__attribute__((constructor)) static void shim_init(void)
+{
+    real_mutex_init = shim_lookup("pthread_mutex_init");
+    real_mutex_destroy = shim_lookup("pthread_mutex_destroy");
+    real_mutex_lock = shim_lookup("pthread_mutex_lock");
+    real_mutex_trylock = shim_lookup("pthread_mutex_trylock");
+    real_mutex_timedlock = shim_lookup("pthread_mutex_timedlock");
+    real_mutex_clocklock = shim_lookup("pthread_mutex_clocklock");
+    real_mutex_unlock = shim_lookup("pthread_mutex_unlock");
+}
+
+/* The mutex_t in 'm', or NULL if glibc owns it */
+static inline mutex_t *shim_mutex(pthread_mutex_t *m)
+{
+    mutex_t *mutex = (mutex_t *) m;
+    bool (*trylock)(mutex_t *) =
+        __atomic_load_n(&mutex->trylock, __ATOMIC_ACQUIRE);
+
+    if (trylock == mutex_trylock_default || trylock == mutex_trylock_pi)
+        return mutex;
+    if (trylock)
+        return NULL;
+
+    /* Statically initialized. Every thread racing here stores the same
+     * values, and 'trylock' goes last as it marks the mutex as set up.
+     */
+    __atomic_store_n(&mutex->lock, mutex_lock_default, __ATOMIC_RELAXED);
+    __atomic_store_n(&mutex->unlock, mutex_unlock_default, __ATOMIC_RELAXED);
+    __atomic_store_n(&mutex->trylock, mutex_trylock_default, __ATOMIC_RELEASE);
+    return mutex;
+}
+
+int pthread_mutex_init(pthread_mutex_t *m, const pthread_mutexattr_t *attr)
+{
+    int type = PTHREAD_MUTEX_DEFAULT;
+    int protocol = PTHREAD_PRIO_NONE;
+    int pshared = PTHREAD_PROCESS_PRIVATE;
+
+    if (attr) {
+        pthread_mutexattr_gettype(attr, &type);
+        pthread_mutexattr_getprotocol(attr, &protocol);
+        pthread_mutexattr_getpshared(attr, &pshared);
+    }
+    if ((type != PTHREAD_MUTEX_NORMAL && type != PTHREAD_MUTEX_DEFAULT) ||
+        protocol == PTHREAD_PRIO_PROTECT || pshared != PTHREAD_PROCESS_PRIVATE)
+        return real_mutex_init(m, attr);
+
+    mutexattr_t mattr;
+    mutexattr_init(&mattr);
+    if (protocol == PTHREAD_PRIO_INHERIT)
+        mutexattr_setprotocol(&mattr, PRIO_INHERIT);
+    mutex_init((mutex_t *) m, &mattr);
+    return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t *m)
+{
+    mutex_t *mutex = shim_mutex(m);
+    if (!mutex)
+        return real_mutex_destroy(m);
+    mutex_destroy(mutex);
+    return 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t *m)
+{
+    mutex_t *mutex = shim_mutex(m);
+    if (!mutex)
+        return real_mutex_lock(m);
+    mutex_lock(mutex);
+    return 0;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *m)
+{
+    mutex_t *mutex = shim_mutex(m);
+    if (!mutex)
+        return real_mutex_trylock(m);
+    return mutex_trylock(mutex) ? 0 : EBUSY;
+}
+
+/* The clocks glibc accepts for a timeout, as EINVAL otherwise */
+static inline bool shim_clock_valid(clockid_t clock)
+{
+    return clock == CLOCK_REALTIME || clock == CLOCK_MONOTONIC;
+}
+
+/* mutex_lock() giving up at 'abstime' on 'clock' */
+static int shim_mutex_clocklock(mutex_t *mutex,
+                                clockid_t clock,
+                                const struct timespec *abstime)
+{
+    if (mutex_trylock(mutex))
+        return 0;
+
+    if (mutex->protocol == PRIO_INHERIT) {
+        /* FUTEX_LOCK_PI measures CLOCK_REALTIME, FUTEX_LOCK_PI2 (since Linux
+         * 5.14) CLOCK_MONOTONIC
+         */
+        int op = clock == CLOCK_MONOTONIC ? FUTEX_LOCK_PI2_PRIVATE
+                                          : FUTEX_LOCK_PI_PRIVATE;
+        if (syscall(SYS_futex, &mutex->state, op, 0, abstime))
+            return errno == ETIMEDOUT ? ETIMEDOUT : EINVAL;
+        thread_fence(&mutex->state, acquire);
+        return 0;
+    }
+
+    for (;;) {
+        int state =
+            exchange(&mutex->state, MUTEX_LOCKED | MUTEX_SLEEPING, relaxed);
+        if (!(state & MUTEX_LOCKED)) {
+            thread_fence(&mutex->state, acquire);
+            return 0;
+        }
+        if (!futex_wait_until_pshared(&mutex->state,
+                                      MUTEX_LOCKED | MUTEX_SLEEPING, clock,
+                                      abstime, false))
+            return ETIMEDOUT;
+    }
+}
+
+int pthread_mutex_timedlock(pthread_mutex_t *restrict m,
+                            const struct timespec *restrict abstime)
+{
+    mutex_t *mutex = shim_mutex(m);
+    if (!mutex)
+        return real_mutex_timedlock(m, abstime);
+    return shim_mutex_clocklock(mutex, CLOCK_REALTIME, abstime);
+}
+
+/* Used by libstdc++ for timed mutexes on std::chrono::steady_clock */
+int pthread_mutex_clocklock(pthread_mutex_t *restrict m,
+                            clockid_t clock,
+                            const struct timespec *restrict abstime)
+{
+    mutex_t *mutex = shim_mutex(m);
+    if (!mutex)
+        return real_mutex_clocklock(m, clock, abstime);
+    if (!shim_clock_valid(clock))
+        return EINVAL;
+    return shim_mutex_clocklock(mutex, clock, abstime);
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *m)
+{
+    mutex_t *mutex = shim_mutex(m);
+    if (!mutex)
+        return real_mutex_unlock(m);
+    mutex_unlock(mutex);
+    return 0;
+}
+
+int pthread_cond_init(pthread_cond_t *restrict c,
+                      const pthread_condattr_t *restrict attr)
+{
+    struct shim_cond *cond = (struct shim_cond *) c;
+    int pshared = PTHREAD_PROCESS_PRIVATE;
+
+    cond_init(&cond->cond);
+    cond->clock = CLOCK_REALTIME;
+    if (attr) {
+        pthread_condattr_getclock(attr, &cond->clock);
+        pthread_condattr_getpshared(attr, &pshared);
+    }
+    cond->pshared = pshared == PTHREAD_PROCESS_SHARED;
+    atomic_init(&cond->mutex, NULL);
+    return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t *c)
+{
+    return 0;
+}
+
+/* The cond.h algorithm, around a mutex owned by glibc */
+static int shim_cond_wait_real(struct shim_cond *cond,
+                               pthread_mutex_t *m,
+                               clockid_t clock,
+                               const struct timespec *abstime)
+{
+    int seq = load(&cond->cond.seq, relaxed);
+    bool woken = true;
+
+    store(&cond->mutex, NULL, relaxed);
+    real_mutex_unlock(m);
+    if (abstime)
+        woken = futex_wait_until_pshared(&cond->cond.seq, seq, clock, abstime,
+                                         cond->pshared);
+    else
+        futex_wait_pshared(&cond->cond.seq, seq, cond->pshared);
+    real_mutex_lock(m);
+    return woken ? 0 : ETIMEDOUT;
+}
+
+int pthread_cond_wait(pthread_cond_t *restrict c, pthread_mutex_t *restrict m)
+{
+    struct shim_cond *cond = (struct shim_cond *) c;
+    mutex_t *mutex = shim_mutex(m);
+    if (!mutex)
+        return shim_cond_wait_real(cond, m, cond->clock, NULL);
+
+    store(&cond->mutex, mutex, relaxed);
+    cond_wait(&cond->cond, mutex);
+    return 0;
+}
+
+/* pthread_cond_timedwait() on 'clock' rather than that of the cond */
+static int shim_cond_clockwait(struct shim_cond *cond,
+                               pthread_mutex_t *m,
+                               clockid_t clock,
+                               const struct timespec *abstime)
+{
+    mutex_t *mutex = shim_mutex(m);
+    if (!mutex)
+        return shim_cond_wait_real(cond, m, clock, abstime);
+
+    store(&cond->mutex, mutex, relaxed);
+    return cond_timedwait(&cond->cond, mutex, clock, abstime) ? 0 : ETIMEDOUT;
+}
+
+int pthread_cond_timedwait(pthread_cond_t *restrict c,
+                           pthread_mutex_t *restrict m,
+                           const struct timespec *restrict abstime)
+{
+    struct shim_cond *cond = (struct shim_cond *) c;
+    return shim_cond_clockwait(cond, m, cond->clock, abstime);
+}
+
+/* Used by libstdc++ for std::condition_variable::wait_for() and
+ * wait_until() on std::chrono::steady_clock
+ */
+int pthread_cond_clockwait(pthread_cond_t *restrict c,
+                           pthread_mutex_t *restrict m,
+                           clockid_t clock,
+                           const struct timespec *restrict abstime)
+{
+    if (!shim_clock_valid(clock))
+        return EINVAL;
+    return shim_cond_clockwait((struct shim_cond *) c, m, clock, abstime);
+}
+
+int pthread_cond_signal(pthread_cond_t *c)
+{
+    struct shim_cond *cond = (struct shim_cond *) c;
+    mutex_t *mutex = load(&cond->mutex, relaxed);
+    if (mutex) {
+        cond_signal(&cond->cond, mutex);
+        return 0;
+    }
+    fetch_add(&cond->cond.seq, 1, relaxed);
+    futex_wake_pshared(&cond->cond.seq, 1, cond->pshared);
+    return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t *c)
+{
+    struct shim_cond *cond = (struct shim_cond *) c;
+    mutex_t *mutex = load(&cond->mutex, relaxed);
+    if (mutex) {
+        cond_broadcast(&cond->cond, mutex);
+        return 0;
+    }
+    fetch_add(&cond->cond.seq, 1, relaxed);
+    futex_wake_pshared(&cond->cond.seq, INT_MAX, cond->pshared);
+    return 0;
+}
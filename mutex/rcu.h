@@ -0,0 +1,340 @@
+#pragma once
+
+#if !USE_LINUX
+#error "rcu.h sleeps on futexes, build with -DUSE_LINUX"
+#endif
+
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "atomic.h"
+#include "futex.h"
+#include "mutex.h"
+#include "spinlock.h"
+
+/* Userspace RCU for read-mostly data.
+ *
+ * Two flavors, selected at build time:
+ *
+ *  - RCU_QSBR: quiescent-state based. rcu_read_lock()/rcu_read_unlock()
+ *    compile to nothing; instead every registered thread must periodically
+ *    announce a quiescent state with rcu_quiescent_state() (and go offline
+ *    around blocking calls). Fastest readers, most intrusive API.
+ *
+ *  - default (epoch): each reader publishes the global epoch it started in
+ *    while inside a read-side critical section. synchronize_rcu() bumps the
+ *    epoch and waits for readers still running in an older one.
+ *    With RCU_MEMBARRIER, readers replace their full fence by a compiler
+ *    barrier and the writer pays for it with membarrier(2). It falls back to
+ *    fences if the kernel lacks MEMBARRIER_CMD_PRIVATE_EXPEDITED.
+ *
+ * Every thread calling rcu_read_lock() must first call
+ * rcu_register_thread(), and rcu_unregister_thread() before it exits.
+ */
+
+#if RCU_MEMBARRIER
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#endif
+
+struct rcu_head {
+    struct rcu_head *next;
+    void (*func)(struct rcu_head *head);
+};
+
+struct rcu_reader {
+    /* Epoch the reader is running in, 0 when outside of a critical section
+     * (epoch flavor) or offline (QSBR).
+     */
+    atomic unsigned long ctr;
+    int nesting;
+    struct rcu_reader *next, **pprev;
+} __attribute__((aligned(64)));
+
+static struct {
+    atomic unsigned long epoch;
+
+    /* Registered readers, also serializes grace periods */
+    mutex_t lock;
+    struct rcu_reader *readers;
+
+    /* Deferred callbacks, run in batches by a helper thread */
+    atomic(struct rcu_head *) callbacks;
+    atomic int ncallbacks;
+    pthread_once_t worker_once;
+    bool membarrier;
+} rcu_state = {
+    .epoch = 1,
+    .worker_once = PTHREAD_ONCE_INIT,
+};
+
+static pthread_once_t rcu_init_once = PTHREAD_ONCE_INIT;
+static _Thread_local struct rcu_reader rcu_self;
+
+#define RCU_SPINS 1000
+
+/* Try to flush this many callbacks per grace period */
+#define RCU_BATCH 128
+
+/* Upper bound on how long a callback waits for its batch to fill up */
+#define RCU_BATCH_DELAY_US 1000
+
+#define rcu_dereference(p) load(&(p), consume)
+#define rcu_assign_pointer(p, v) store(&(p), v, release)
+
+#define rcu_barrier_compiler() __asm__ __volatile__("" ::: "memory")
+
+static void rcu_init(void)
+{
+    mutex_init(&rcu_state.lock, NULL);
+#if RCU_MEMBARRIER
+    int cmds = syscall(__NR_membarrier, MEMBARRIER_CMD_QUERY, 0);
+    if (cmds > 0 && (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED) &&
+        !syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0))
+        rcu_state.membarrier = true;
+#endif
+}
+
+static inline void rcu_register_thread(void)
+{
+    pthread_once(&rcu_init_once, rcu_init);
+
+    struct rcu_reader *r = &rcu_self;
+    r->nesting = 0;
+    mutex_lock(&rcu_state.lock);
+#if RCU_QSBR
+    /* Online right away, as if the thread had just passed a quiescent state */
+    store(&r->ctr, load(&rcu_state.epoch, relaxed), relaxed);
+#else
+    store(&r->ctr, 0, relaxed);
+#endif
+    r->next = rcu_state.readers;
+    if (r->next)
+        r->next->pprev = &r->next;
+    r->pprev = &rcu_state.readers;
+    rcu_state.readers = r;
+    mutex_unlock(&rcu_state.lock);
+}
+
+static inline void rcu_unregister_thread(void)
+{
+    struct rcu_reader *r = &rcu_self;
+    mutex_lock(&rcu_state.lock);
+    *r->pprev = r->next;
+    if (r->next)
+        r->next->pprev = r->pprev;
+    mutex_unlock(&rcu_state.lock);
+}
+
+/* Reader side fence, paired with rcu_writer_fence() */
+static inline void rcu_reader_fence(void)
+{
+#if RCU_MEMBARRIER
+    if (rcu_state.membarrier) {
+        rcu_barrier_compiler();
+        return;
+    }
+#endif
+    thread_fence(&rcu_self.ctr, seq_cst);
+}
+
+static inline void rcu_writer_fence(void)
+{
+#if RCU_MEMBARRIER
+    if (rcu_state.membarrier) {
+        syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+        return;
+    }
+#endif
+    thread_fence(&rcu_state.epoch, seq_cst);
+}
+
+#if RCU_QSBR
+
+static inline void rcu_read_lock(void) {}
+static inline void rcu_read_unlock(void) {}
+
+static inline void rcu_quiescent_state(void)
+{
+    /* Everything read so far is done with before the new epoch shows */
+    thread_fence(&rcu_self.ctr, seq_cst);
+    store(&rcu_self.ctr, load(&rcu_state.epoch, relaxed), release);
+    thread_fence(&rcu_self.ctr, seq_cst);
+}
+
+/* Extended quiescent state, e.g. around a blocking call */
+static inline void rcu_thread_offline(void)
+{
+    thread_fence(&rcu_self.ctr, seq_cst);
+    store(&rcu_self.ctr, 0, release);
+}
+
+static inline void rcu_thread_online(void)
+{
+    store(&rcu_self.ctr, load(&rcu_state.epoch, relaxed), relaxed);
+    thread_fence(&rcu_self.ctr, seq_cst);
+}
+
+/* A reader is done with the old epoch once it went through a quiescent
+ * state after it started, or is offline.
+ */
+static inline bool rcu_reader_done(struct rcu_reader *r, unsigned long epoch)
+{
+    unsigned long ctr = load(&r->ctr, acquire);
+    return !ctr || ctr >= epoch || r == &rcu_self;
+}
+
+#else /* epoch */
+
+static inline void rcu_read_lock(void)
+{
+    struct rcu_reader *r = &rcu_self;
+    if (r->nesting++)
+        return;
+    store(&r->ctr, load(&rcu_state.epoch, relaxed), relaxed);
+    /* Publish ctr before any load of protected data */
+    rcu_reader_fence();
+}
+
+static inline void rcu_read_unlock(void)
+{
+    struct rcu_reader *r = &rcu_self;
+    if (--r->nesting)
+        return;
+    store(&r->ctr, 0, release);
+}
+
+static inline void rcu_quiescent_state(void) {}
+static inline void rcu_thread_offline(void) {}
+static inline void rcu_thread_online(void) {}
+
+/* Readers which entered after the epoch was bumped can only see the new
+ * version of the data, so there is no need to wait for them.
+ */
+static inline bool rcu_reader_done(struct rcu_reader *r, unsigned long epoch)
+{
+    unsigned long ctr = load(&r->ctr, acquire);
+    return !ctr || ctr >= epoch;
+}
+
+#endif
+
+/* Wait until every read-side critical section which was running when this
+ * function got called has completed.
+ */
+static inline void synchronize_rcu(void)
+{
+    pthread_once(&rcu_init_once, rcu_init);
+
+    /* Order the caller's updates before the scan of the readers */
+    rcu_writer_fence();
+
+    mutex_lock(&rcu_state.lock);
+    unsigned long epoch = fetch_add(&rcu_state.epoch, 1, seq_cst) + 1;
+    for (struct rcu_reader *r = rcu_state.readers; r; r = r->next) {
+        for (int i = 0; !rcu_reader_done(r, epoch); ++i) {
+            if (i < RCU_SPINS)
+                spin_hint();
+            else
+                sched_yield();
+        }
+    }
+    mutex_unlock(&rcu_state.lock);
+
+    /* Order the scan before the caller frees anything */
+    thread_fence(&rcu_state.epoch, seq_cst);
+}
+
+static void *rcu_worker(void *arg)
+{
+    for (;;) {
+        int n = load(&rcu_state.ncallbacks, acquire);
+        if (!n) {
+            futex_wait(&rcu_state.ncallbacks, 0);
+            continue;
+        }
+        /* Give the batch a chance to fill up before paying for a grace
+         * period.
+         */
+        if (n < RCU_BATCH)
+            usleep(RCU_BATCH_DELAY_US);
+
+        struct rcu_head *list = exchange(&rcu_state.callbacks, NULL, acquire);
+        int taken = 0;
+        struct rcu_head *fifo = NULL;
+        while (list) {
+            struct rcu_head *next = list->next;
+            list->next = fifo;
+            fifo = list;
+            list = next;
+            taken++;
+        }
+        fetch_sub(&rcu_state.ncallbacks, taken, relaxed);
+
+        synchronize_rcu();
+        while (fifo) {
+            struct rcu_head *next = fifo->next;
+            fifo->func(fifo);
+            fifo = next;
+        }
+    }
+    return NULL;
+}
+
+static void rcu_start_worker(void)
+{
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, rcu_worker, NULL) != 0)
+        abort();
+    pthread_attr_destroy(&attr);
+}
+
+/* Run 'func(head)' after a grace period, without blocking the caller.
+ * Callbacks are batched so that one grace period covers many of them.
+ */
+static inline void call_rcu(struct rcu_head *head,
+                            void (*func)(struct rcu_head *))
+{
+    pthread_once(&rcu_state.worker_once, rcu_start_worker);
+
+    head->func = func;
+    head->next = load(&rcu_state.callbacks, relaxed);
+    while (!compare_exchange_weak(&rcu_state.callbacks, &head->next, head,
+                                  release, relaxed))
+        ;
+    if (fetch_add(&rcu_state.ncallbacks, 1, release) == 0)
+        futex_wake(&rcu_state.ncallbacks, 1);
+}
+
+struct rcu_barrier_head {
+    struct rcu_head head;
+    atomic int done;
+};
+
+static void rcu_barrier_func(struct rcu_head *head)
+{
+    struct rcu_barrier_head *b = (struct rcu_barrier_head *) head;
+    store(&b->done, 1, release);
+    futex_wake(&b->done, 1);
+}
+
+/* Wait until every callback queued before the call has been invoked */
+static inline void rcu_barrier(void)
+{
+    struct rcu_barrier_head b;
+    atomic_init(&b.done, 0);
+    call_rcu(&b.head, rcu_barrier_func);
+
+    rcu_thread_offline();
+    while (!load(&b.done, acquire))
+        futex_wait(&b.done, 0);
+    rcu_thread_online();
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "atomic.h"
+#include "spinlock.h"
+
+/* Sequence counter, as in the Linux kernel: readers run optimistically and
+ * retry if a writer was active in the meantime. Writers must be serialized
+ * by a lock of their own.
+ */
+
+typedef struct {
+    atomic unsigned int seq;
+} seqcount_t;
+
+static inline void seqcount_init(seqcount_t *s)
+{
+    atomic_init(&s->seq, 0);
+}
+
+static inline unsigned int read_seqcount_begin(seqcount_t *s)
+{
+    unsigned int seq;
+    while ((seq = load(&s->seq, acquire)) & 1)
+        spin_hint();
+    return seq;
+}
+
+/* True if the data read since read_seqcount_begin() may be inconsistent */
+static inline bool read_seqcount_retry(seqcount_t *s, unsigned int seq)
+{
+    thread_fence(&s->seq, acquire);
+    return load(&s->seq, relaxed) != seq;
+}
+
+static inline void write_seqcount_begin(seqcount_t *s)
+{
+    store(&s->seq, load(&s->seq, relaxed) + 1, relaxed);
+    thread_fence(&s->seq, release);
+}
+
+static inline void write_seqcount_end(seqcount_t *s)
+{
+    store(&s->seq, load(&s->seq, relaxed) + 1, release);
+}
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "atomic.h"
+#include "list.h"
+#include "spinlock.h"
+
+/* Concurrent ordered set: the lazy skip list of Herlihy, Lev, Luchangco and
+ * Shavit ("A Simple Optimistic Skiplist Algorithm", 2007).
+ *
+ * Insertions and removals lock only the predecessors of the node they link
+ * or unlink, one spinlock_t per node, after an optimistic lock-free search.
+ * Lookups and range scans take no lock at all. A node is logically in the
+ * set once 'fully_linked' is set and until 'marked' is.
+ *
+ * Nodes are intrusive and embed a struct list_head, which the skip list
+ * itself never touches: it is the owner's, e.g. to keep the node on a free
+ * list before it is inserted or after it is removed. skiplist_range()
+ * collects a key range into an array the caller owns instead, so that any
+ * number of scans, overlapping or not, can run at once.
+ *
+ * Removed nodes may still be traversed by concurrent searches, so they must
+ * not be freed until those are over (see rcu.h or hazard.h).
+ *
+ * Requires list.h (from linux-list) on the include path.
+ */
+
+#define SKIPLIST_MAX_LEVEL 24
+
+struct sl_node {
+    unsigned long key;
+    struct list_head list;
+
+    spinlock_t lock;
+    atomic bool marked;
+    atomic bool fully_linked;
+    int top_level;
+    atomic(struct sl_node *) next[SKIPLIST_MAX_LEVEL];
+};
+
+typedef struct {
+    struct sl_node head, tail; /* -infinity and +infinity sentinels */
+} skiplist_t;
+
+#define sl_entry(ptr, type, member) container_of(ptr, type, member)
+
+static _Thread_local uint32_t skiplist_seed;
+
+/* Geometric level distribution with p = 1/2 */
+static inline int skiplist_random_level(void)
+{
+    if (!skiplist_seed)
+        skiplist_seed = (uint32_t) (uintptr_t) &skiplist_seed | 1;
+    uint32_t x = skiplist_seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    skiplist_seed = x;
+
+    int level = 1 + __builtin_ctz(x | (1U << (SKIPLIST_MAX_LEVEL - 1)));
+    return level;
+}
+
+static inline void sl_node_init(struct sl_node *node, unsigned long key)
+{
+    node->key = key;
+    INIT_LIST_HEAD(&node->list);
+    spin_init(&node->lock);
+    atomic_init(&node->marked, false);
+    atomic_init(&node->fully_linked, false);
+    node->top_level = 0;
+    for (int i = 0; i < SKIPLIST_MAX_LEVEL; ++i)
+        atomic_init(&node->next[i], NULL);
+}
+
+static inline void skiplist_init(skiplist_t *sl)
+{
+    sl_node_init(&sl->head, 0);
+    sl_node_init(&sl->tail, ULONG_MAX);
+    sl->head.top_level = sl->tail.top_level = SKIPLIST_MAX_LEVEL;
+    for (int i = 0; i < SKIPLIST_MAX_LEVEL; ++i)
+        atomic_init(&sl->head.next[i], &sl->tail);
+    atomic_init(&sl->head.fully_linked, true);
+    atomic_init(&sl->tail.fully_linked, true);
+}
+
+/* 'node' sorts before 'key'; the sentinels are compared by identity so that
+ * every key, 0 and ULONG_MAX included, can be stored.
+ */
+static inline bool sl_before(skiplist_t *sl, struct sl_node *node, unsigned long key)
+{
+    return node == &sl->head || (node != &sl->tail && node->key < key);
+}
+
+static inline bool sl_match(skiplist_t *sl, struct sl_node *node, unsigned long key)
+{
+    return node != &sl->head && node != &sl->tail && node->key == key;
+}
+
+/* Fill in the predecessors and successors of 'key' on every level, return
+ * the highest level at which a node with that key was found, or -1.
+ */
+static inline int skiplist_find(skiplist_t *sl,
+                                unsigned long key,
+                                struct sl_node **preds,
+                                struct sl_node **succs)
+{
+    int found = -1;
+    struct sl_node *pred = &sl->head;
+    for (int level = SKIPLIST_MAX_LEVEL - 1; level >= 0; --level) {
+        struct sl_node *curr = load(&pred->next[level], acquire);
+        while (sl_before(sl, curr, key)) {
+            pred = curr;
+            curr = load(&pred->next[level], acquire);
+        }
+        if (found == -1 && sl_match(sl, curr, key))
+            found = level;
+        preds[level] = pred;
+        succs[level] = curr;
+    }
+    return found;
+}
+
+static inline void sl_unlock_preds(struct sl_node **preds, int highest)
+{
+    struct sl_node *prev = NULL;
+    for (int level = 0; level <= highest; ++level) {
+        if (preds[level] != prev)
+            spin_unlock(&preds[level]->lock);
+        prev = preds[level];
+    }
+}
+
+/* Returns false if a node with the same key is already in the set */
+static inline bool skiplist_insert(skiplist_t *sl, struct sl_node *node)
+{
+    struct sl_node *preds[SKIPLIST_MAX_LEVEL], *succs[SKIPLIST_MAX_LEVEL];
+    int top_level = skiplist_random_level();
+
+    for (;;) {
+        int found = skiplist_find(sl, node->key, preds, succs);
+        if (found != -1) {
+            struct sl_node *existing = succs[found];
+            if (!load(&existing->marked, acquire)) {
+                while (!load(&existing->fully_linked, acquire))
+                    spin_hint();
+                return false;
+            }
+            continue; /* being removed, retry */
+        }
+
+        int highest = -1;
+        bool valid = true;
+        struct sl_node *prev = NULL;
+        for (int level = 0; valid && level < top_level; ++level) {
+            struct sl_node *pred = preds[level], *succ = succs[level];
+            if (pred != prev) {
+                spin_lock(&pred->lock);
+                prev = pred;
+            }
+            highest = level;
+            valid = !load(&pred->marked, acquire) &&
+                    !load(&succ->marked, acquire) &&
+                    load(&pred->next[level], acquire) == succ;
+        }
+        if (!valid) {
+            sl_unlock_preds(preds, highest);
+            continue;
+        }
+
+        node->top_level = top_level;
+        for (int level = 0; level < top_level; ++level)
+            store(&node->next[level], succs[level], relaxed);
+        for (int level = 0; level < top_level; ++level)
+            store(&preds[level]->next[level], node, release);
+        store(&node->fully_linked, true, release);
+
+        sl_unlock_preds(preds, highest);
+        return true;
+    }
+}
+
+/* Returns the unlinked node, or NULL if 'key' is not in the set */
+static inline struct sl_node *skiplist_remove(skiplist_t *sl, unsigned long key)
+{
+    struct sl_node *preds[SKIPLIST_MAX_LEVEL], *succs[SKIPLIST_MAX_LEVEL];
+    struct sl_node *victim = NULL;
+    bool marked = false;
+    int top_level = -1;
+
+    for (;;) {
+        int found = skiplist_find(sl, key, preds, succs);
+        if (!marked) {
+            if (found == -1)
+                return NULL;
+            victim = succs[found];
+            /* Only remove a node found at its top level, i.e. fully linked */
+            if (!load(&victim->fully_linked, acquire) ||
+                victim->top_level - 1 != found ||
+                load(&victim->marked, acquire))
+                return NULL;
+
+            top_level = victim->top_level;
+            spin_lock(&victim->lock);
+            if (load(&victim->marked, relaxed)) {
+                spin_unlock(&victim->lock);
+                return NULL;
+            }
+            store(&victim->marked, true, release);
+            marked = true;
+        }
+
+        int highest = -1;
+        bool valid = true;
+        struct sl_node *prev = NULL;
+        for (int level = 0; valid && level < top_level; ++level) {
+            struct sl_node *pred = preds[level];
+            if (pred != prev) {
+                spin_lock(&pred->lock);
+                prev = pred;
+            }
+            highest = level;
+            valid = !load(&pred->marked, acquire) &&
+                    load(&pred->next[level], acquire) == victim;
+        }
+        if (!valid) {
+            sl_unlock_preds(preds, highest);
+            continue;
+        }
+
+        for (int level = top_level - 1; level >= 0; --level)
+            store(&preds[level]->next[level],
+                  load(&victim->next[level], relaxed), release);
+
+        spin_unlock(&victim->lock);
+        sl_unlock_preds(preds, highest);
+        return victim;
+    }
+}
+
+/* Wait-free membership test */
+static inline struct sl_node *skiplist_lookup(skiplist_t *sl, unsigned long key)
+{
+    struct sl_node *pred = &sl->head, *curr = NULL;
+    for (int level = SKIPLIST_MAX_LEVEL - 1; level >= 0; --level) {
+        curr = load(&pred->next[level], acquire);
+        while (sl_before(sl, curr, key)) {
+            pred = curr;
+            curr = load(&pred->next[level], acquire);
+        }
+        if (sl_match(sl, curr, key))
+            break;
+    }
+    if (sl_match(sl, curr, key) && load(&curr->fully_linked, acquire) &&
+        !load(&curr->marked, acquire))
+        return curr;
+    return NULL;
+}
+
+/* Store the nodes with lo <= key <= hi into 'nodes', in order, at most
+ * 'max' of them. Returns how many there are, which may be more than 'max':
+ * the caller can then retry with a larger array. Not an atomic snapshot:
+ * nodes inserted or removed during the scan may or may not show up, but
+ * every node present for the whole scan does.
+ */
+static inline size_t skiplist_range(skiplist_t *sl,
+                                    unsigned long lo,
+                                    unsigned long hi,
+                                    struct sl_node **nodes,
+                                    size_t max)
+{
+    struct sl_node *preds[SKIPLIST_MAX_LEVEL], *succs[SKIPLIST_MAX_LEVEL];
+    size_t n = 0;
+
+    skiplist_find(sl, lo, preds, succs);
+    for (struct sl_node *curr = succs[0];
+         curr != &sl->tail && curr->key <= hi;
+         curr = load(&curr->next[0], acquire)) {
+        if (load(&curr->fully_linked, acquire) && !load(&curr->marked, acquire)) {
+            if (n < max)
+                nodes[n] = curr;
+            n++;
+        }
+    }
+    return n;
+}
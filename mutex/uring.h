@@ -0,0 +1,384 @@
+#pragma once
+
+#if !USE_LINUX
+#error "uring.h drives the futex words of mutex_t/cond_t, build with -DUSE_LINUX"
+#endif
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "atomic.h"
+#include "cond.h"
+#include "futex.h"
+#include "mutex.h"
+
+/* io_uring backend for the futex words of mutex_t and cond_t (Linux 6.7+).
+ *
+ * An event-loop thread can start "acquire this mutex" or "wait on this
+ * condition" as asynchronous operations and reap their completions from the
+ * same ring as its I/O. Wakes issued through uring_mutex_unlock() and
+ * uring_cond_signal() are only queued; uring_submit() hands all of them to
+ * the kernel with a single io_uring_enter().
+ *
+ * Only process-private mutexes using the default protocol are supported: PI
+ * futexes are owned by the kernel and can not be waited on through io_uring.
+ *
+ * uring_init() returns false on kernels without io_uring futex support, in
+ * which case callers keep using mutex_lock()/cond_wait() and futex.h.
+ */
+
+#ifndef IORING_OP_FUTEX_WAIT
+#define IORING_OP_FUTEX_WAIT 51
+#define IORING_OP_FUTEX_WAKE 52
+#define IORING_OP_FUTEX_WAITV 53
+#endif
+
+#ifndef FUTEX2_SIZE_U32
+#define FUTEX2_SIZE_U32 0x02
+#define FUTEX2_PRIVATE FUTEX_PRIVATE_FLAG
+#endif
+
+#define FUTEX_MATCH_ANY 0xffffffffu
+
+typedef struct {
+    int fd;
+    unsigned int entries;
+
+    /* submission queue */
+    atomic unsigned int *sq_head, *sq_tail;
+    unsigned int *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned int sqe_tail, sqe_submitted;
+
+    /* completion queue */
+    atomic unsigned int *cq_head, *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+} uring_t;
+
+/* Completion of an asynchronous mutex/cond operation */
+typedef struct uring_op uring_op_t;
+struct uring_op {
+    mutex_t *mutex;
+    cond_t *cond;
+    void (*done)(uring_op_t *op);
+    enum {
+        URING_OP_MUTEX,
+        URING_OP_COND,
+    } stage;
+};
+
+/* user_data of our own requests has the low bit set, so the event loop can
+ * tell them apart from its I/O (which must keep the low bit clear).
+ */
+#define URING_OP_TAG 1UL
+
+static inline bool uring_probe_futex(int fd)
+{
+    size_t size = sizeof(struct io_uring_probe) +
+                  256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if (!probe)
+        return false;
+
+    bool ok = false;
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe,
+                256) == 0) {
+        ok = probe->last_op >= IORING_OP_FUTEX_WAKE &&
+             (probe->ops[IORING_OP_FUTEX_WAIT].flags & IO_URING_OP_SUPPORTED) &&
+             (probe->ops[IORING_OP_FUTEX_WAKE].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+static inline void uring_exit(uring_t *ring)
+{
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    ring->fd = -1;
+}
+
+static inline bool uring_init(uring_t *ring, unsigned int entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(ring, 0, sizeof(*ring));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0)
+        return false;
+    if (!uring_probe_futex(ring->fd))
+        goto fail;
+
+    ring->entries = p.sq_entries;
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size =
+        p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && ring->cq_ring_size > ring->sq_ring_size)
+        ring->sq_ring_size = ring->cq_ring_size;
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        goto fail;
+    }
+    if (single) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->fd,
+                             IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            goto fail;
+        }
+    }
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto fail;
+    }
+
+    char *sq = ring->sq_ring, *cq = ring->cq_ring;
+    ring->sq_head = (atomic unsigned int *) (sq + p.sq_off.head);
+    ring->sq_tail = (atomic unsigned int *) (sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned int *) (sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *) (sq + p.sq_off.array);
+    ring->cq_head = (atomic unsigned int *) (cq + p.cq_off.head);
+    ring->cq_tail = (atomic unsigned int *) (cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned int *) (cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    ring->sqe_tail = ring->sqe_submitted = load(ring->sq_tail, relaxed);
+    return true;
+
+fail:
+    uring_exit(ring);
+    return false;
+}
+
+static inline int uring_enter(uring_t *ring,
+                              unsigned int to_submit,
+                              unsigned int min_complete,
+                              unsigned int flags)
+{
+    int ret;
+    do {
+        ret = syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete,
+                      flags, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+/* Submit everything queued so far and, if 'wait_nr' is not zero, wait for
+ * that many completions, all in a single io_uring_enter().
+ */
+static inline int uring_submit_and_wait(uring_t *ring, unsigned int wait_nr)
+{
+    unsigned int to_submit = ring->sqe_tail - ring->sqe_submitted;
+    if (!to_submit && !wait_nr)
+        return 0;
+
+    store(ring->sq_tail, ring->sqe_tail, release);
+    ring->sqe_submitted = ring->sqe_tail;
+    return uring_enter(ring, to_submit, wait_nr,
+                       wait_nr ? IORING_ENTER_GETEVENTS : 0);
+}
+
+static inline int uring_submit(uring_t *ring)
+{
+    return uring_submit_and_wait(ring, 0);
+}
+
+/* Never returns NULL: a full submission queue is flushed first */
+static inline struct io_uring_sqe *uring_get_sqe(uring_t *ring)
+{
+    if (ring->sqe_tail - load(ring->sq_head, acquire) >= ring->entries)
+        uring_submit(ring);
+
+    unsigned int idx = ring->sqe_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[idx] = idx;
+    ring->sqe_tail++;
+    return sqe;
+}
+
+static inline struct io_uring_cqe *uring_peek_cqe(uring_t *ring)
+{
+    unsigned int head = load(ring->cq_head, relaxed);
+    if (head == load(ring->cq_tail, acquire))
+        return NULL;
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+static inline struct io_uring_cqe *uring_wait_cqe(uring_t *ring)
+{
+    struct io_uring_cqe *cqe;
+    while (!(cqe = uring_peek_cqe(ring)))
+        uring_submit_and_wait(ring, 1);
+    return cqe;
+}
+
+static inline void uring_cqe_seen(uring_t *ring)
+{
+    store(ring->cq_head, load(ring->cq_head, relaxed) + 1, release);
+}
+
+static inline void uring_prep_futex_wait(uring_t *ring,
+                                         atomic int *futex,
+                                         int value,
+                                         uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_FUTEX_WAIT;
+    sqe->fd = FUTEX2_SIZE_U32 | FUTEX2_PRIVATE;
+    sqe->addr = (uintptr_t) futex;
+    sqe->off = (unsigned int) value;
+    sqe->addr3 = FUTEX_MATCH_ANY;
+    sqe->user_data = user_data;
+}
+
+/* Queue a wake of up to 'limit' waiters, sent with the next uring_submit().
+ * A successful wake produces no completion.
+ */
+static inline void uring_futex_wake(uring_t *ring, atomic int *futex, int limit)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_FUTEX_WAKE;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->fd = FUTEX2_SIZE_U32 | FUTEX2_PRIVATE;
+    sqe->addr = (uintptr_t) futex;
+    sqe->off = limit;
+    sqe->addr3 = FUTEX_MATCH_ANY;
+    sqe->user_data = URING_OP_TAG;
+}
+
+static inline void uring_mutex_unlock(uring_t *ring, mutex_t *mutex)
+{
+    int state = exchange(&mutex->state, 0, release);
+    if (state & MUTEX_SLEEPING)
+        uring_futex_wake(ring, &mutex->state, 1);
+}
+
+static inline void uring_cond_signal(uring_t *ring, cond_t *cond)
+{
+    fetch_add(&cond->seq, 1, relaxed);
+    uring_futex_wake(ring, &cond->seq, 1);
+}
+
+static inline void uring_cond_broadcast(uring_t *ring, cond_t *cond)
+{
+    fetch_add(&cond->seq, 1, relaxed);
+    uring_futex_wake(ring, &cond->seq, INT_MAX);
+}
+
+/* One step of mutex_lock_default(), with the futex_wait() turned into a
+ * FUTEX_WAIT request. Returns true once the mutex is held.
+ */
+static inline bool uring_mutex_try_acquire(uring_t *ring, uring_op_t *op)
+{
+    mutex_t *mutex = op->mutex;
+    int state = exchange(&mutex->state, MUTEX_LOCKED | MUTEX_SLEEPING, relaxed);
+    if (!(state & MUTEX_LOCKED)) {
+        thread_fence(&mutex->state, acquire);
+        return true;
+    }
+
+    uring_prep_futex_wait(ring, &mutex->state, MUTEX_LOCKED | MUTEX_SLEEPING,
+                          (uintptr_t) op | URING_OP_TAG);
+    return false;
+}
+
+/* Acquire 'mutex' asynchronously. op->done() is called from
+ * uring_handle_cqe() once the mutex is held, or right away if it is free.
+ */
+static inline void uring_mutex_lock_async(uring_t *ring,
+                                          uring_op_t *op,
+                                          mutex_t *mutex,
+                                          void (*done)(uring_op_t *))
+{
+    if (mutex->pshared || mutex->lock != mutex_lock_default)
+        abort();
+
+    op->mutex = mutex;
+    op->cond = NULL;
+    op->done = done;
+    op->stage = URING_OP_MUTEX;
+
+    if (mutex_trylock(mutex) || uring_mutex_try_acquire(ring, op))
+        done(op);
+}
+
+/* Asynchronous cond_wait(): 'mutex' must be held, it is released at once and
+ * re-acquired before op->done() is called.
+ */
+static inline void uring_cond_wait_async(uring_t *ring,
+                                         uring_op_t *op,
+                                         cond_t *cond,
+                                         mutex_t *mutex,
+                                         void (*done)(uring_op_t *))
+{
+    if (mutex->pshared || mutex->lock != mutex_lock_default)
+        abort();
+
+    op->mutex = mutex;
+    op->cond = cond;
+    op->done = done;
+    op->stage = URING_OP_COND;
+
+    int seq = load(&cond->seq, relaxed);
+    uring_mutex_unlock(ring, mutex);
+    uring_prep_futex_wait(ring, &cond->seq, seq, (uintptr_t) op | URING_OP_TAG);
+}
+
+/* Feed a completion to the backend. Returns false if it belongs to the
+ * caller's own I/O, in which case the caller handles and consumes it.
+ */
+static inline bool uring_handle_cqe(uring_t *ring, struct io_uring_cqe *cqe)
+{
+    if (!(cqe->user_data & URING_OP_TAG))
+        return false;
+
+    uring_op_t *op = (uring_op_t *) (uintptr_t) (cqe->user_data & ~URING_OP_TAG);
+    int res = cqe->res;
+    uring_cqe_seen(ring);
+
+    /* A failed wake, there is nobody to notify */
+    if (!op) {
+        if (res < 0 && res != -EAGAIN)
+            abort();
+        return true;
+    }
+    if (res < 0 && res != -EAGAIN && res != -EINTR)
+        abort();
+
+    /* Woken on the condition, or requeued onto the mutex by cond_broadcast().
+     * Either way go for the mutex; uring_mutex_try_acquire() always marks it
+     * contended, which is what cond_wait() needs for requeued waiters.
+     */
+    op->stage = URING_OP_MUTEX;
+    if (uring_mutex_try_acquire(ring, op))
+        op->done(op);
+    return true;
+}
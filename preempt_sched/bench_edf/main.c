@@ -0,0 +1,237 @@
+/* bench_edf: deadline misses of periodic tasks under batch load.
+ *
+ * NR_CTRL control loops run a job of about WORK microseconds every PERIOD,
+ * each due DEADLINE after the start of its period, next to NR_BATCH tasks
+ * which sort arrays over and over. The control loops run first in the round
+ * robin class, waiting for their next period by yielding, then in the EDF
+ * class, with a budget of RUNTIME per period.
+ *
+ * Before the EDF run, a task asking for more bandwidth than a worker has is
+ * refused by admission control.
+ *
+ * Last, an EDF task with the same budget runs bursts of NAP_BURST jobs,
+ * over its runtime, for NAP_RUN nanoseconds next to the batch tasks: once
+ * back to back, throttled at the first tick past its budget, once sleeping
+ * NAP nanoseconds after every burst, which must not spare the budget.
+ *
+ * Usage: ./bench_edf [quantum_us] [workers]
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "list.h"
+#include "task_sched.h"
+
+#define NR_BATCH 3
+#define ARR_SIZE (1 << 14)
+#define NR_CTRL 4
+#define NR_JOBS 400
+#define WORK 200 /* us */
+#define RUNTIME 300000ULL /* ns */
+#define DEADLINE 2000000ULL
+#define PERIOD 5000000ULL
+#define NAP_BURST 4 /* jobs */
+#define NAP 1000000ULL /* ns */
+#define NAP_RUN 2000000000ULL
+
+struct ctrl_stats {
+    unsigned long jobs, missed;
+};
+
+static struct ctrl_stats stats[NR_CTRL];
+static unsigned long batch_done;
+static volatile int ctrl_left;
+static long units_per_job;
+static bool napping;
+static unsigned long nap_jobs;
+
+static inline uint32_t random_shuffle(uint32_t x)
+{
+    /* by Chris Wellons, see: <https://nullprogram.com/blog/2018/07/31/> */
+    x ^= x >> 16;
+    x *= 0x7feb352dUL;
+    x ^= x >> 15;
+    x *= 0x846ca68bUL;
+    x ^= x >> 16;
+    return x;
+}
+
+static void shell_sort(uint32_t *arr, int n)
+{
+    for (int gap = n / 2; gap; gap /= 2) {
+        for (int i = gap; i < n; i++) {
+            uint32_t x = arr[i];
+            int j = i;
+            for (; j >= gap && arr[j - gap] > x; j -= gap)
+                arr[j] = arr[j - gap];
+            arr[j] = x;
+        }
+    }
+}
+
+static void batch(void *arg)
+{
+    uint32_t *arr = task_malloc(ARR_SIZE * sizeof(uint32_t));
+
+    uint32_t r = (uintptr_t) arg;
+    while (ctrl_left) {
+        for (int i = 0; i < ARR_SIZE; i++)
+            arr[i] = (r = random_shuffle(r));
+        shell_sort(arr, ARR_SIZE);
+        __atomic_add_fetch(&batch_done, 1, __ATOMIC_RELAXED);
+    }
+
+    task_free(arr);
+}
+
+static volatile uint32_t sink;
+
+static void job(uint32_t x)
+{
+    for (long i = 0; i < units_per_job; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+    }
+    sink = x;
+}
+
+static void calibrate(void)
+{
+    long n = 10000000;
+    units_per_job = n;
+    uint64_t start = sched_clock();
+    job(1);
+    units_per_job = n * (WORK * 1000.0) / (sched_clock() - start);
+}
+
+/* Round robin: wait for the period by yielding, check the deadline here */
+static void ctrl_rr(void *arg)
+{
+    struct ctrl_stats *s = arg;
+    uint64_t release = sched_clock();
+
+    for (int i = 0; i < NR_JOBS; ++i) {
+        while (sched_clock() < release)
+            schedule();
+        job(i);
+        uint64_t now = sched_clock();
+        s->jobs++;
+        if (now > release + DEADLINE)
+            s->missed++;
+        release += PERIOD;
+        if (release < now) /* as the EDF class does */
+            release = now;
+    }
+    __atomic_sub_fetch(&ctrl_left, 1, __ATOMIC_RELAXED);
+}
+
+static void ctrl_edf(void *arg)
+{
+    struct ctrl_stats *s = arg;
+
+    for (int i = 0; i < NR_JOBS; ++i) {
+        job(i);
+        task_edf_yield();
+    }
+    s->jobs = task_current()->edf.nr_jobs;
+    s->missed = task_current()->edf.nr_missed;
+    __atomic_sub_fetch(&ctrl_left, 1, __ATOMIC_RELAXED);
+}
+
+static void overrun(void *arg)
+{
+    uint64_t end = sched_clock() + NAP_RUN;
+
+    while (sched_clock() < end) {
+        for (int i = 0; i < NAP_BURST; ++i)
+            job(i);
+        nap_jobs += NAP_BURST;
+        if (napping)
+            task_sleep(NAP);
+    }
+    __atomic_sub_fetch(&ctrl_left, 1, __ATOMIC_RELAXED);
+}
+
+static void idle(void *arg) {}
+
+static void run(bool edf, int nworkers, unsigned long quantum)
+{
+    sched_init(nworkers);
+    ctrl_left = NR_CTRL;
+    batch_done = 0;
+    for (int i = 0; i < NR_CTRL; ++i) {
+        stats[i].jobs = stats[i].missed = 0;
+        struct task_struct *task =
+            task_alloc(edf ? ctrl_edf : ctrl_rr, &stats[i]);
+        if (edf && !task_set_edf(task, RUNTIME, DEADLINE, PERIOD))
+            abort();
+        task_start(task);
+    }
+    if (edf) {
+        struct task_struct *task = task_alloc(idle, NULL);
+        if (task_set_edf(task, PERIOD, PERIOD, PERIOD))
+            abort();
+        printf("admission: a task of 100%% bandwidth refused\n");
+        task_start(task); /* as a round robin task */
+    }
+    for (uintptr_t i = 0; i < NR_BATCH; ++i)
+        task_add(batch, (void *) (i + 1));
+    sched_run(quantum);
+
+    unsigned long jobs = 0, missed = 0;
+    for (int i = 0; i < NR_CTRL; ++i) {
+        jobs += stats[i].jobs;
+        missed += stats[i].missed;
+    }
+    printf("%8s %8lu %8lu %9.1f%% %8lu\n", edf ? "edf" : "rr", jobs, missed,
+           100.0 * missed / jobs, batch_done);
+}
+
+static void run_overrun(bool nap, int nworkers, unsigned long quantum)
+{
+    sched_init(nworkers);
+    ctrl_left = 1;
+    batch_done = 0;
+    napping = nap;
+    nap_jobs = 0;
+    struct task_struct *task = task_alloc(overrun, NULL);
+    if (!task_set_edf(task, RUNTIME, DEADLINE, PERIOD))
+        abort();
+    task_start(task);
+    for (uintptr_t i = 0; i < NR_BATCH; ++i)
+        task_add(batch, (void *) (i + 1));
+
+    uint64_t start = sched_clock();
+    sched_run(quantum);
+    double elapsed = sched_clock() - start;
+
+    printf("%8s %9.1f%% %9.1f%%\n", nap ? "sleeps" : "runs",
+           100.0 * RUNTIME / PERIOD, 100.0 * nap_jobs * WORK * 1000 / elapsed);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long quantum = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000;
+    int nworkers = sched_workers(argc, argv);
+
+    calibrate();
+    printf("%d control loops (%d us of work every %llu ms, due in %llu ms), "
+           "%d batch sort tasks\n",
+           NR_CTRL, WORK, PERIOD / 1000000, DEADLINE / 1000000, NR_BATCH);
+    printf("quantum %lu us, %d worker(s)\n", quantum, nworkers);
+    printf("%8s %8s %8s %10s %8s\n", "class", "jobs", "missed", "miss rate",
+           "sorts");
+    run(false, nworkers, quantum);
+    run(true, nworkers, quantum);
+
+    printf("\nan EDF task running bursts of %d us\n", NAP_BURST * WORK);
+    printf("%8s %10s %10s\n", "between", "reserved", "CPU share");
+    run_overrun(false, nworkers, quantum);
+    run_overrun(true, nworkers, quantum);
+    return 0;
+}
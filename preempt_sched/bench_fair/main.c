@@ -0,0 +1,160 @@
+/* bench_fair: CPU share accuracy of the fair class.
+ *
+ * CPU-bound tasks of different nice levels run next to interactive ones,
+ * which yield after every short burst of work, and a sleepy one, which
+ * sleeps for NAP microseconds after every longer burst, for DURATION
+ * seconds on one worker. Every task counts the units of work it gets done;
+ * its share is its count over the total. In the round robin class nice
+ * levels mean nothing, so the expected shares are equal, but the
+ * interactive and sleepy tasks lose theirs at every yield or sleep. In the
+ * fair class a task should get its weight over the total weight, yielding
+ * or not; the sleepy task is runnable again by the next tick, and should
+ * get it as well, as long as the time it ran before sleeping is charged.
+ *
+ * Usage: ./bench_fair [quantum_us]
+ */
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "list.h"
+#include "task_sched.h"
+
+#define DURATION 2
+#define BURST 100 /* microseconds of work between yields */
+#define SLEEPY_BURST 700 /* and between sleeps */
+#define NAP 20
+
+enum kind { CPU_BOUND, INTERACTIVE, SLEEPY };
+
+static const char *const kind_names[] = {"cpu-bound", "interactive", "sleepy"};
+
+static const struct {
+    int nice;
+    enum kind kind;
+} tasks[] = {
+    {-5, CPU_BOUND},  {0, CPU_BOUND},  {0, CPU_BOUND}, {5, CPU_BOUND},
+    {0, INTERACTIVE}, {5, INTERACTIVE}, {0, SLEEPY},
+};
+
+#define NR_TASKS (sizeof(tasks) / sizeof(tasks[0]))
+
+static unsigned long work_done[NR_TASKS];
+static volatile int stop;
+static long units_per_burst;
+
+static inline uint32_t work_unit(uint32_t x)
+{
+    for (int i = 0; i < 256; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+    }
+    return x;
+}
+
+static volatile uint32_t sink;
+
+static void worker(void *arg)
+{
+    uintptr_t i = (uintptr_t) arg;
+    uint32_t x = i + 1;
+    unsigned long done = 0;
+
+    while (!stop) {
+        x = work_unit(x);
+        ++done;
+        if (tasks[i].kind == INTERACTIVE && done % units_per_burst == 0)
+            task_yield();
+        else if (tasks[i].kind == SLEEPY &&
+                 done % (units_per_burst * SLEEPY_BURST / BURST) == 0)
+            task_sleep(NAP * 1000);
+    }
+    sink = x;
+    work_done[i] = done;
+}
+
+static void *timer_thread(void *arg)
+{
+    sleep(DURATION);
+    stop = 1;
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void calibrate(void)
+{
+    uint32_t x = 1;
+    long n = 100000;
+    double start = now();
+    for (long i = 0; i < n; i++)
+        x = work_unit(x);
+    sink = x;
+    units_per_burst = n * (BURST * 1e-6) / (now() - start);
+    if (units_per_burst < 1)
+        units_per_burst = 1;
+}
+
+static void run(bool fair, unsigned long quantum)
+{
+    pthread_t thread;
+    double expected[NR_TASKS], total_weight = 0;
+
+    for (size_t i = 0; i < NR_TASKS; ++i) {
+        expected[i] = fair ? sched_nice_to_weight[tasks[i].nice + 20] : 1;
+        total_weight += expected[i];
+    }
+
+    stop = 0;
+    sched_init(1);
+    for (uintptr_t i = 0; i < NR_TASKS; ++i) {
+        struct task_struct *task = task_alloc(worker, (void *) i);
+        if (fair)
+            task_set_nice(task, tasks[i].nice);
+        task_start(task);
+    }
+    pthread_create(&thread, NULL, timer_thread, NULL);
+    sched_run(quantum);
+    pthread_join(thread, NULL);
+
+    double total = 0, error = 0;
+    for (size_t i = 0; i < NR_TASKS; ++i)
+        total += work_done[i];
+
+    printf("%s class\n", fair ? "fair" : "rr");
+    printf("%6s %12s %10s %10s\n", "nice", "kind", "expected", "measured");
+    for (size_t i = 0; i < NR_TASKS; ++i) {
+        double e = 100 * expected[i] / total_weight;
+        double m = 100 * work_done[i] / total;
+        printf("%6d %12s %9.1f%% %9.1f%%\n", tasks[i].nice,
+               kind_names[tasks[i].kind], e, m);
+        error += fabs(m - e);
+    }
+    /* Share of the CPU which went to the wrong tasks */
+    printf("error: %.1f%%\n\n", error / 2);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long quantum = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000;
+
+    calibrate();
+    printf("%zu tasks for %d s, quantum %lu us, bursts of %d us, "
+           "or %d us then %d us asleep\n\n",
+           NR_TASKS, DURATION, quantum, BURST, SLEEPY_BURST, NAP);
+    run(false, quantum);
+    run(true, quantum);
+    return 0;
+}
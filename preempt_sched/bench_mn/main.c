@@ -0,0 +1,130 @@
+/* bench_mn: scaling of the M:N runtime.
+ *
+ * NR_TASKS copies of the sort routine of example_qsort_r, on ARR_SIZE
+ * elements each, run to completion on 1, 2, 4, ... worker threads, up to
+ * twice the number of online CPUs. Tasks are spread over the workers round
+ * robin when added; the workers which run dry steal the rest.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "list.h"
+#include "task_sched.h"
+
+#define NR_TASKS 64
+#define ARR_SIZE (1 << 18)
+#define QUANTUM 10000 /* 10 ms */
+
+static int cmp_u32(const void *a, const void *b, void *arg)
+{
+    uint32_t x = *(uint32_t *) a, y = *(uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+static inline uint32_t random_shuffle(uint32_t x)
+{
+    /* by Chris Wellons, see: <https://nullprogram.com/blog/2018/07/31/> */
+    x ^= x >> 16;
+    x *= 0x7feb352dUL;
+    x ^= x >> 15;
+    x *= 0x846ca68bUL;
+    x ^= x >> 16;
+    return x;
+}
+
+/* qsort_r() of glibc mallocs its merge buffer from inside libc, where a
+ * tick could preempt it holding the arena lock: a bottom-up merge sort of
+ * the same interface instead, whose buffer comes from task_malloc().
+ */
+static void merge_sort_r(void *base,
+                         size_t n,
+                         size_t size,
+                         int (*cmp)(const void *, const void *, void *),
+                         void *arg)
+{
+    char *src = base, *dst = task_malloc(n * size);
+    if (!dst)
+        abort();
+    char *buf = dst;
+
+    for (size_t width = 1; width < n; width *= 2) {
+        for (size_t lo = 0; lo < n; lo += 2 * width) {
+            size_t mid = lo + width < n ? lo + width : n;
+            size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+            size_t i = lo, j = mid, k = lo;
+            while (i < mid && j < hi) {
+                if (cmp(src + j * size, src + i * size, arg) < 0)
+                    memcpy(dst + k++ * size, src + j++ * size, size);
+                else
+                    memcpy(dst + k++ * size, src + i++ * size, size);
+            }
+            memcpy(dst + k * size, src + i * size, (mid - i) * size);
+            k += mid - i;
+            memcpy(dst + k * size, src + j * size, (hi - j) * size);
+        }
+        char *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src != base)
+        memcpy(base, src, n * size);
+    task_free(buf);
+}
+
+static void sort(void *arg)
+{
+    uint32_t *arr = task_malloc(ARR_SIZE * sizeof(uint32_t));
+
+    uint32_t r = (uintptr_t) arg;
+    for (int i = 0; i < ARR_SIZE; i++)
+        arr[i] = (r = random_shuffle(r));
+
+    merge_sort_r(arr, ARR_SIZE, sizeof(uint32_t), cmp_u32, NULL);
+
+    for (int i = 0; i < ARR_SIZE - 1; i++)
+        if (arr[i] > arr[i + 1])
+            abort();
+
+    task_free(arr);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double run(int nworkers)
+{
+    sched_init(nworkers);
+    for (uintptr_t i = 0; i < NR_TASKS; ++i)
+        task_add(sort, (void *) (i + 1));
+
+    double start = now();
+    sched_run(QUANTUM);
+    return now() - start;
+}
+
+int main()
+{
+    int max_workers = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_workers < 4)
+        max_workers = 4;
+
+    printf("%d sort tasks of %d elements\n", NR_TASKS, ARR_SIZE);
+    printf("%8s %10s %10s\n", "workers", "seconds", "speedup");
+    double base = 0;
+    for (int n = 1; n <= max_workers; n <<= 1) {
+        double t = run(n);
+        if (n == 1)
+            base = t;
+        printf("%8d %10.3f %10.2f\n", n, t, base / t);
+    }
+    return 0;
+}
@@ -0,0 +1,150 @@
+/* bench_prio: wakeup latency of a latency-critical task next to batch work.
+ *
+ * NR_BATCH tasks sort arrays over and over, in the round robin class. An
+ * outside thread starts a short task every PERIOD microseconds, and the
+ * task records how long it waited before running: first as yet another
+ * round robin task, queued behind the batch tasks, then in the priority
+ * class, where it preempts the running batch task at the next tick.
+ *
+ * The sort is a plain shell sort rather than qsort(), which mallocs inside
+ * libc (see task_malloc()).
+ *
+ * Usage: ./bench_prio [quantum_us] [workers]
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "list.h"
+#include "task_sched.h"
+
+#define NR_BATCH 3
+#define ARR_SIZE (1 << 14)
+#define NR_SAMPLES 200
+#define PERIOD 5000 /* 5 ms */
+
+struct sample {
+    struct timespec spawned;
+    long latency; /* nanoseconds */
+};
+
+static struct sample samples[NR_SAMPLES];
+static volatile int batch_stop;
+
+static inline uint32_t random_shuffle(uint32_t x)
+{
+    /* by Chris Wellons, see: <https://nullprogram.com/blog/2018/07/31/> */
+    x ^= x >> 16;
+    x *= 0x7feb352dUL;
+    x ^= x >> 15;
+    x *= 0x846ca68bUL;
+    x ^= x >> 16;
+    return x;
+}
+
+static void shell_sort(uint32_t *arr, int n)
+{
+    for (int gap = n / 2; gap; gap /= 2) {
+        for (int i = gap; i < n; i++) {
+            uint32_t x = arr[i];
+            int j = i;
+            for (; j >= gap && arr[j - gap] > x; j -= gap)
+                arr[j] = arr[j - gap];
+            arr[j] = x;
+        }
+    }
+}
+
+static void batch(void *arg)
+{
+    uint32_t *arr = task_malloc(ARR_SIZE * sizeof(uint32_t));
+
+    uint32_t r = (uintptr_t) arg;
+    while (!batch_stop) {
+        for (int i = 0; i < ARR_SIZE; i++)
+            arr[i] = (r = random_shuffle(r));
+        shell_sort(arr, ARR_SIZE);
+        for (int i = 0; i < ARR_SIZE - 1; i++)
+            if (arr[i] > arr[i + 1])
+                abort();
+    }
+
+    task_free(arr);
+}
+
+static void latency(void *arg)
+{
+    struct sample *s = arg;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    s->latency = (ts.tv_sec - s->spawned.tv_sec) * 1000000000L +
+                 (ts.tv_nsec - s->spawned.tv_nsec);
+}
+
+static void *spawner(void *arg)
+{
+    int prio = (intptr_t) arg;
+
+    for (int i = 0; i < NR_SAMPLES; ++i) {
+        usleep(PERIOD);
+        struct task_struct *task = task_alloc(latency, &samples[i]);
+        if (prio >= 0)
+            task_set_prio(task, prio);
+        clock_gettime(CLOCK_MONOTONIC, &samples[i].spawned);
+        task_start(task);
+    }
+    usleep(PERIOD);
+    batch_stop = 1;
+    return NULL;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+    long x = *(long *) a, y = *(long *) b;
+    return (x > y) - (x < y);
+}
+
+/* 'prio' -1 for the round robin class */
+static void run(const char *name, int prio, int nworkers, unsigned long quantum)
+{
+    long lat[NR_SAMPLES];
+    pthread_t thread;
+
+    batch_stop = 0;
+    sched_init(nworkers);
+    for (uintptr_t i = 0; i < NR_BATCH; ++i)
+        task_add(batch, (void *) (i + 1));
+    pthread_create(&thread, NULL, spawner, (void *) (intptr_t) prio);
+    sched_run(quantum);
+    pthread_join(thread, NULL);
+
+    double sum = 0;
+    for (int i = 0; i < NR_SAMPLES; ++i) {
+        lat[i] = samples[i].latency;
+        sum += lat[i];
+    }
+    qsort(lat, NR_SAMPLES, sizeof(long), cmp_long);
+    printf("%8s %10.1f %10.1f %10.1f %10.1f\n", name, sum / NR_SAMPLES / 1e3,
+           lat[NR_SAMPLES / 2] / 1e3, lat[NR_SAMPLES * 99 / 100] / 1e3,
+           lat[NR_SAMPLES - 1] / 1e3);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long quantum = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000;
+    int nworkers = sched_workers(argc, argv);
+
+    printf("%d batch sort tasks, quantum %lu us, %d worker(s)\n", NR_BATCH,
+           quantum, nworkers);
+    printf("%8s %10s %10s %10s %10s   (wakeup latency, us)\n", "class", "mean",
+           "p50", "p99", "max");
+    run("rr", -1, nworkers, quantum);
+    run("prio", 0, nworkers, quantum);
+    return 0;
+}
@@ -0,0 +1,161 @@
+/* bench_sleep: waiting for a point in time, by yielding or by sleeping.
+ *
+ * NR_SLEEPERS tasks each wait NR_NAPS times for a random point in time, up
+ * to MAX_NAP microseconds ahead: either by yielding until the time comes,
+ * the only way before task_sleep(), or with task_sleep_until(). Reported:
+ * how late they wake up, and the CPU time the process uses meanwhile.
+ *
+ * Then a batch task sorts arrays until the sleepers are done: yielding
+ * sleepers take CPU time from it, sleeping ones do not, but the latter only
+ * wake up on the next tick while the batch task runs.
+ *
+ * Usage: ./bench_sleep [quantum_us] [workers], 1 ms by default
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "list.h"
+#include "task_sched.h"
+
+#define NR_SLEEPERS 100
+#define NR_NAPS 50
+#define MAX_NAP 5000 /* us */
+#define ARR_SIZE (1 << 12)
+
+static long late[NR_SLEEPERS * NR_NAPS]; /* nanoseconds */
+static bool use_sleep;
+static volatile int sleepers_left;
+static unsigned long batch_done;
+
+static inline uint32_t random_shuffle(uint32_t x)
+{
+    /* by Chris Wellons, see: <https://nullprogram.com/blog/2018/07/31/> */
+    x ^= x >> 16;
+    x *= 0x7feb352dUL;
+    x ^= x >> 15;
+    x *= 0x846ca68bUL;
+    x ^= x >> 16;
+    return x;
+}
+
+static void shell_sort(uint32_t *arr, int n)
+{
+    for (int gap = n / 2; gap; gap /= 2) {
+        for (int i = gap; i < n; i++) {
+            uint32_t x = arr[i];
+            int j = i;
+            for (; j >= gap && arr[j - gap] > x; j -= gap)
+                arr[j] = arr[j - gap];
+            arr[j] = x;
+        }
+    }
+}
+
+static void batch(void *arg)
+{
+    uint32_t arr[ARR_SIZE];
+    uint32_t r = 1;
+
+    while (sleepers_left) {
+        for (int i = 0; i < ARR_SIZE; i++)
+            arr[i] = (r = random_shuffle(r));
+        shell_sort(arr, ARR_SIZE);
+        batch_done++;
+    }
+}
+
+static void sleeper(void *arg)
+{
+    long *lat = arg;
+    uint32_t r = (uintptr_t) arg;
+
+    for (int i = 0; i < NR_NAPS; ++i) {
+        r = random_shuffle(r);
+        uint64_t when = sched_clock() + r % MAX_NAP * 1000;
+        if (use_sleep) {
+            task_sleep_until(when);
+        } else {
+            while (sched_clock() < when)
+                task_yield();
+        }
+        lat[i] = sched_clock() - when;
+    }
+    __atomic_sub_fetch(&sleepers_left, 1, __ATOMIC_RELAXED);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double cpu_time(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 +
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+    long x = *(long *) a, y = *(long *) b;
+    return (x > y) - (x < y);
+}
+
+static void run(bool sleep, bool with_batch, int nworkers, unsigned long quantum)
+{
+    const int n = NR_SLEEPERS * NR_NAPS;
+
+    use_sleep = sleep;
+    sleepers_left = NR_SLEEPERS;
+    batch_done = 0;
+    sched_init(nworkers);
+    for (int i = 0; i < NR_SLEEPERS; ++i)
+        task_add(sleeper, &late[i * NR_NAPS]);
+    if (with_batch)
+        task_add(batch, NULL);
+
+    double start = now(), cpu = cpu_time();
+    sched_run(quantum);
+    double elapsed = now() - start;
+    cpu = cpu_time() - cpu;
+
+    double sum = 0;
+    for (int i = 0; i < n; ++i)
+        sum += late[i];
+    qsort(late, n, sizeof(long), cmp_long);
+    printf("%8s %6s %10.1f %10.1f %10.1f %10.1f %7.0f%%",
+           sleep ? "sleep" : "yield", with_batch ? "yes" : "no", sum / n / 1e3,
+           late[n / 2] / 1e3, late[n * 99 / 100] / 1e3, late[n - 1] / 1e3,
+           100.0 * cpu / elapsed / nworkers);
+    if (with_batch)
+        printf(" %8.1f", batch_done / elapsed);
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long quantum = argc > 1 ? strtoul(argv[1], NULL, 10) : 0;
+    if (!quantum) /* the batch task would never make room */
+        quantum = 1000;
+    int nworkers = sched_workers(argc, argv);
+
+    printf("%d tasks waiting %d times for up to %d us, quantum %lu us, "
+           "%d worker(s)\n",
+           NR_SLEEPERS, NR_NAPS, MAX_NAP, quantum, nworkers);
+    printf("%8s %6s %10s %10s %10s %10s %8s %8s\n", "wait", "batch", "mean",
+           "p50", "p99", "max", "cpu", "sorts/s");
+    printf("%15s %43s\n", "", "(late, us)");
+    run(false, false, nworkers, quantum);
+    run(true, false, nworkers, quantum);
+    run(false, true, nworkers, quantum);
+    run(true, true, nworkers, quantum);
+    return 0;
+}
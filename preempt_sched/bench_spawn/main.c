@@ -0,0 +1,117 @@
+/* bench_spawn: cost of short-lived tasks.
+ *
+ * A task spawns NR_TASKS short tasks, WAVE at a time, and waits for every
+ * wave to finish before the next one; each short task uses a few KiB of
+ * stack and exits. Reported, for a few stack sizes: tasks spawned, run and
+ * reaped per second, resident memory per live task at the peak of a wave,
+ * and page faults per task.
+ *
+ * bench_spawn_pool uses the stack pool of task_stack.h, bench_spawn_malloc
+ * calloc()s every stack.
+ *
+ * Usage: ./bench_spawn_pool [quantum_us] [workers]
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "list.h"
+#include "task_sched.h"
+
+#define NR_TASKS 100000
+#define WAVE 256
+
+static size_t stack_size;
+static long peak_rss, base_rss; /* pages */
+static int done;
+
+static long rss(void)
+{
+    long size, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+            resident = 0;
+        fclose(f);
+    }
+    return resident;
+}
+
+static void short_task(void *arg)
+{
+    volatile char buf[4096];
+    memset((char *) buf, (uintptr_t) arg, sizeof(buf));
+    __atomic_add_fetch(&done, 1, __ATOMIC_RELAXED);
+}
+
+static void spawner(void *arg)
+{
+    for (int i = 0; i < NR_TASKS; i += WAVE) {
+        for (int j = 0; j < WAVE; ++j)
+            task_start(task_alloc_stack(short_task, (void *) 1, stack_size));
+
+        preempt_disable();
+        long r = rss();
+        preempt_enable();
+        if (r > peak_rss)
+            peak_rss = r;
+
+        while (__atomic_load_n(&done, __ATOMIC_RELAXED) < i + WAVE)
+            schedule();
+    }
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run(size_t size, int nworkers, unsigned long quantum)
+{
+    struct rusage ru0, ru1;
+
+    stack_size = size;
+    done = 0;
+    sched_init(nworkers);
+    task_add(spawner, NULL);
+    base_rss = peak_rss = rss();
+
+    getrusage(RUSAGE_SELF, &ru0);
+    double start = now();
+    sched_run(quantum);
+    double elapsed = now() - start;
+    getrusage(RUSAGE_SELF, &ru1);
+
+    long page = sysconf(_SC_PAGESIZE);
+    printf("%10zu %12.0f %12.1f %12.1f\n", size >> 10, NR_TASKS / elapsed,
+           (double) (peak_rss - base_rss) * page / WAVE / 1024,
+           (double) (ru1.ru_minflt - ru0.ru_minflt) / NR_TASKS);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long quantum = timer_quantum(argc, argv);
+    int nworkers = sched_workers(argc, argv);
+    static const size_t sizes[] = {64 << 10, 256 << 10, TASK_STACK_SIZE};
+
+#if TASK_STACK_MALLOC
+    printf("calloc() stacks");
+#else
+    printf("stack pool");
+#endif
+    printf(", %d tasks in waves of %d, %d worker(s)\n", NR_TASKS, WAVE,
+           nworkers);
+    printf("%10s %12s %12s %12s\n", "stack KiB", "tasks/s", "KiB/task",
+           "faults/task");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+        run(sizes[i], nworkers, quantum);
+    return 0;
+}
@@ -0,0 +1,144 @@
+/* bench_stackless: memory and switch rate of stackless tasks.
+ *
+ * Every task yields ROUNDS times, then exits. Reported: resident memory per
+ * task, measured once every task has run, i.e. touched its stack if it has
+ * one, and task switches per second. Stackful tasks get the smallest stack,
+ * TASK_STACK_MIN; there can only be NR_SMALL of them, since every stack and
+ * its guard page take two of the vm.max_map_count (65530 by default)
+ * mappings. Stackless tasks are also run NR_LARGE at a time, and mixed with
+ * stackful ones on the same run queue. Every run is a process of its own,
+ * which does not reuse the memory freed by the previous ones.
+ *
+ * Usage: ./bench_stackless [quantum_us] [workers]
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "list.h"
+#include "task_sched.h"
+
+#define NR_SMALL 20000
+#define NR_LARGE 1000000
+#define ROUNDS 10
+
+struct frame {
+    struct pt pt;
+    int i;
+    bool last;
+};
+
+static long base_rss, task_rss; /* pages */
+
+static long rss(void)
+{
+    long size, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+            resident = 0;
+        fclose(f);
+    }
+    return resident;
+}
+
+/* From the last task added, on its first run: every task ran once */
+static void sample(void)
+{
+    preempt_disable();
+    task_rss = rss() - base_rss;
+    preempt_enable();
+}
+
+static void stackful(void *arg)
+{
+    if (arg)
+        sample();
+    for (int i = 0; i < ROUNDS; ++i)
+        schedule();
+}
+
+static int stackless(void *arg)
+{
+    struct frame *f = arg;
+
+    PT_BEGIN(&f->pt);
+    if (f->last)
+        sample();
+    for (f->i = 0; f->i < ROUNDS; f->i++)
+        PT_YIELD(&f->pt);
+    PT_END(&f->pt);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run(const char *name,
+                int nr_stackful,
+                int nr_stackless,
+                int nworkers,
+                unsigned long quantum)
+{
+    int n = nr_stackful + nr_stackless;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0)
+        abort();
+    if (pid) {
+        waitpid(pid, NULL, 0);
+        return;
+    }
+
+    base_rss = rss();
+    sched_init(nworkers);
+    struct frame *frames = calloc(nr_stackless, sizeof(struct frame));
+    for (int i = 0; i < n; ++i) {
+        bool last = i == n - 1;
+        /* alternate the two kinds while both are left */
+        if (nr_stackless && (i % 2 || !nr_stackful)) {
+            struct frame *f = &frames[--nr_stackless];
+            PT_INIT(&f->pt);
+            f->last = last;
+            task_start(task_alloc_stackless(stackless, f));
+        } else {
+            nr_stackful--;
+            task_start(task_alloc_stack(stackful, (void *) (uintptr_t) last,
+                                        TASK_STACK_MIN));
+        }
+    }
+
+    double start = now();
+    sched_run(quantum);
+    double elapsed = now() - start;
+    free(frames);
+
+    long page = sysconf(_SC_PAGESIZE);
+    printf("%10s %9d %12.0f %12.2f\n", name, n, (double) task_rss * page / n,
+           (double) n * (ROUNDS + 1) / elapsed / 1e6);
+    exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long quantum = timer_quantum(argc, argv);
+    int nworkers = sched_workers(argc, argv);
+
+    printf("%d yields per task, %d worker(s)\n", ROUNDS, nworkers);
+    printf("%10s %9s %12s %12s\n", "kind", "tasks", "bytes/task",
+           "Mswitch/s");
+    run("stackful", NR_SMALL, 0, nworkers, quantum);
+    run("stackless", 0, NR_SMALL, nworkers, quantum);
+    run("mixed", NR_SMALL / 2, NR_SMALL / 2, nworkers, quantum);
+    run("stackless", 0, NR_LARGE, nworkers, quantum);
+    return 0;
+}
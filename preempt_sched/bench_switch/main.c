@@ -0,0 +1,127 @@
+/* bench_switch: cost of a coroutine switch.
+ *
+ * "raw" bounces between the main context and one coroutine with
+ * task_context_switch() alone. "schedule" runs two tasks which call
+ * schedule() in a loop, i.e. voluntary switches through the scheduler,
+ * interrupt masking included. "timer" runs two tasks which spin reading the
+ * clock while SIGALRM preempts them every TIMER_USECS; the gap between the
+ * last timestamp of one task and the first of the next is the cost of a
+ * timer-driven switch, signal delivery included. Built twice, see the
+ * Makefile: once with the assembly switch and once with the ucontext
+ * fallback.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "list.h"
+#include "task_sched.h"
+
+#define RAW_SWITCHES 5000000
+#define SCHED_SWITCHES 1000000
+#define TIMER_USECS 1000
+#define TIMER_SECS 0.5
+
+static struct task_context main_ctx, co_ctx;
+
+static void co_loop(void *arg)
+{
+    for (;;)
+        task_context_switch(&co_ctx, &main_ctx);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double bench_raw(void)
+{
+    void *stack = malloc(TASK_STACK_SIZE);
+    task_context_init(&co_ctx, stack, TASK_STACK_SIZE, co_loop, NULL);
+
+    double start = now();
+    for (int i = 0; i < RAW_SWITCHES / 2; ++i)
+        task_context_switch(&main_ctx, &co_ctx);
+    double elapsed = now() - start;
+
+    free(stack);
+    return elapsed * 1e9 / RAW_SWITCHES;
+}
+
+static void yield_loop(void *arg)
+{
+    for (int i = 0; i < SCHED_SWITCHES / 2; ++i)
+        schedule();
+}
+
+static double bench_schedule(void)
+{
+    sched_init(1);
+    task_add(yield_loop, NULL), task_add(yield_loop, NULL);
+
+    double start = now();
+    sched_run(0);
+    double elapsed = now() - start;
+
+    return elapsed * 1e9 / SCHED_SWITCHES;
+}
+
+static volatile double timer_last;
+static double timer_gaps, timer_end;
+static long timer_switches;
+static void *volatile timer_owner;
+
+/* No preempt_disable() here, it would drop the ticks. A task preempted
+ * between reading the clock and publishing the timestamp sees a bogus gap
+ * when it resumes, such samples are dropped.
+ */
+static void spin_loop(void *arg)
+{
+    for (;;) {
+        double t = now();
+        if (t > timer_end)
+            break;
+        if (timer_owner != arg) {
+            double gap = t - timer_last;
+            if (timer_owner && gap >= 0 && gap < 100e-6) {
+                timer_gaps += gap;
+                timer_switches++;
+            }
+            timer_owner = arg;
+        }
+        timer_last = t;
+    }
+}
+
+static double bench_timer(void)
+{
+    static char a, b;
+
+    sched_init(1);
+    task_add(spin_loop, &a), task_add(spin_loop, &b);
+
+    timer_end = now() + TIMER_SECS;
+    sched_run(TIMER_USECS);
+
+    return timer_gaps * 1e9 / timer_switches;
+}
+
+int main()
+{
+#if TASK_UCONTEXT
+    printf("ucontext switch\n");
+#else
+    printf("assembly switch\n");
+#endif
+    printf("%10s %12s\n", "", "ns / switch");
+    printf("%10s %12.1f\n", "raw", bench_raw());
+    printf("%10s %12.1f\n", "schedule", bench_schedule());
+    printf("%10s %12.1f\n", "timer", bench_timer());
+    return 0;
+}
@@ -0,0 +1,113 @@
+/* bench_timer: jitter of the preemption tick.
+ *
+ * Two tasks spin while the tick preempts them, for RUN_SECS at each
+ * quantum. A wrapper around the scheduler's SIGALRM handler timestamps every
+ * tick; the deviation of the intervals from the quantum is the jitter. The
+ * per-thread CLOCK_MONOTONIC timer of timer_start() is compared with the
+ * process-wide ualarm() it replaced.
+ *
+ * At 10 ms a run is only 49 intervals, so a single hiccup of the host moves
+ * the stddev and max by orders of magnitude from one run to the next: rerun
+ * a few times before reading anything into them.
+ */
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "list.h"
+#include "task_sched.h"
+
+#define RUN_SECS 0.5
+#define MAX_TICKS 10000
+
+static double ticks[MAX_TICKS];
+static volatile int nticks;
+static volatile sig_atomic_t stop;
+static double end;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void tick_handler(int signo, siginfo_t *info, ucontext_t *ctx)
+{
+    double t = now();
+    if (nticks < MAX_TICKS)
+        ticks[nticks++] = t;
+    if (t > end)
+        stop = 1;
+    timer_handler(signo, info, ctx);
+}
+
+static void spin(void *arg)
+{
+    while (!stop)
+        ;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static void run(unsigned long usecs, bool posix)
+{
+    sched_init(1);
+    struct sigaction sa = {
+        .sa_handler = (void (*)(int)) tick_handler,
+        .sa_flags = SA_SIGINFO | SA_NODEFER,
+    };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGALRM, &sa, NULL);
+
+    task_add(spin, NULL), task_add(spin, NULL);
+    nticks = 0;
+    stop = 0;
+    end = now() + RUN_SECS;
+
+    /* ualarm() signals the process, i.e. the main thread here */
+    if (!posix)
+        ualarm(usecs, usecs);
+    sched_run(posix ? usecs : 0);
+    if (!posix)
+        ualarm(0, 0);
+
+    /* Absolute deviation of every interval from the quantum, in us */
+    int n = nticks - 1;
+    double *dev = malloc(n * sizeof(*dev));
+    double sum = 0, sum2 = 0;
+    for (int i = 0; i < n; ++i) {
+        double interval = (ticks[i + 1] - ticks[i]) * 1e6;
+        sum += interval;
+        sum2 += interval * interval;
+        dev[i] = fabs(interval - usecs);
+    }
+    qsort(dev, n, sizeof(*dev), cmp_double);
+    double mean = sum / n;
+    printf("%8lu %10s %8d %10.1f %10.1f %10.1f %10.1f\n", usecs,
+           posix ? "timer" : "ualarm", n, mean,
+           sqrt(sum2 / n - mean * mean), dev[n / 2], dev[n - 1]);
+    free(dev);
+}
+
+int main()
+{
+    static const unsigned long quanta[] = {100, 1000, 10000};
+
+    printf("%8s %10s %8s %10s %10s %10s %10s\n", "quantum", "", "ticks",
+           "mean", "stddev", "|dev| p50", "|dev| max");
+    for (size_t i = 0; i < sizeof(quanta) / sizeof(quanta[0]); ++i) {
+        run(quanta[i], false);
+        run(quanta[i], true);
+    }
+    printf("(all in us)\n");
+    return 0;
+}
@@ -7,202 +7,21 @@
  * scheduling occurs.
  *
  * The default time slice is 10ms, that means that each 10ms SIGALRM fires and
- * next context is scheduled by round robin algorithm.
+ * next context is scheduled by round robin algorithm.  Another time slice, in
+ * microseconds, can be given as the first argument, and the number of worker
+ * threads to run the routines on as the second one.
  */
 
 #define _GNU_SOURCE
-#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <ucontext.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "list.h"
-
-static int preempt_count = 0;
-static void preempt_disable(void)
-{
-    preempt_count++;
-}
-static void preempt_enable(void)
-{
-    preempt_count--;
-}
-
-static void local_irq_save(sigset_t *sig_set)
-{
-    sigset_t block_set;
-    sigfillset(&block_set);
-    sigdelset(&block_set, SIGINT);
-    sigprocmask(SIG_BLOCK, &block_set, sig_set);
-}
-
-static void local_irq_restore(sigset_t *sig_set)
-{
-    sigprocmask(SIG_SETMASK, sig_set, NULL);
-}
-
-#define task_printf(...)     \
-    ({                       \
-        preempt_disable();   \
-        printf(__VA_ARGS__); \
-        preempt_enable();    \
-    })
-
-typedef void(task_callback_t)(void *arg);
-
-struct task_struct {
-    struct list_head list;
-    ucontext_t context;
-    void *stack;
-    task_callback_t *callback;
-    void *arg;
-    bool reap_self;
-};
-
-static struct task_struct *task_current, task_main;
-static LIST_HEAD(task_reap);
-
-static void task_init(void)
-{
-    INIT_LIST_HEAD(&task_main.list);
-    task_current = &task_main;
-}
-
-static struct task_struct *task_alloc(task_callback_t *func, void *arg)
-{
-    struct task_struct *task = calloc(1, sizeof(*task));
-    task->stack = calloc(1, 1 << 20);
-    task->callback = func;
-    task->arg = arg;
-    return task;
-}
-
-static void task_destroy(struct task_struct *task)
-{
-    list_del(&task->list);
-    free(task->stack);
-    free(task);
-}
-
-static void task_switch_to(struct task_struct *from, struct task_struct *to)
-{
-    task_current = to;
-    swapcontext(&from->context, &to->context);
-}
-
-static void schedule(void)
-{
-    sigset_t set;
-    local_irq_save(&set);
-
-    struct task_struct *next_task =
-        list_first_entry(&task_current->list, struct task_struct, list);
-    if (next_task) {
-        if (task_current->reap_self)
-            list_move(&task_current->list, &task_reap);
-        task_switch_to(task_current, next_task);
-    }
-
-    struct task_struct *task, *tmp;
-    list_for_each_entry_safe (task, tmp, &task_reap, list) /* clean reaps */
-        task_destroy(task);
-
-    local_irq_restore(&set);
-}
-
-union task_ptr {
-    void *p;
-    int i[2];
-};
-
-static void local_irq_restore_trampoline(struct task_struct *task)
-{
-    sigdelset(&task->context.uc_sigmask, SIGALRM);
-    local_irq_restore(&task->context.uc_sigmask);
-}
-
-__attribute__((noreturn)) static void task_trampoline(int i0, int i1)
-{
-    union task_ptr ptr = {.i = {i0, i1}};
-    struct task_struct *task = ptr.p;
-
-    /* We switch to trampoline with blocked timer.  That is safe.
-     * So the first thing that we have to do is to unblock timer signal.
-     * Paired with task_add().
-     */
-    local_irq_restore_trampoline(task);
-    task->callback(task->arg);
-    task->reap_self = true;
-    schedule();
-
-    __builtin_unreachable(); /* shall not reach here */
-}
-
-static void task_add(task_callback_t *func, void *param)
-{
-    struct task_struct *task = task_alloc(func, param);
-    if (getcontext(&task->context) == -1)
-        abort();
-
-    task->context.uc_stack.ss_sp = task->stack;
-    task->context.uc_stack.ss_size = 1 << 20;
-    task->context.uc_stack.ss_flags = 0;
-    task->context.uc_link = NULL;
-
-    union task_ptr ptr = {.p = task};
-    makecontext(&task->context, (void (*)(void)) task_trampoline, 2, ptr.i[0],
-                ptr.i[1]);
-
-    /* When we switch to it for the first time, timer signal must be blocked.
-     * Paired with task_trampoline().
-     */
-    sigaddset(&task->context.uc_sigmask, SIGALRM);
-
-    preempt_disable();
-    list_add_tail(&task->list, &task_main.list);
-    preempt_enable();
-}
-
-static void timer_handler(int signo, siginfo_t *info, ucontext_t *ctx)
-{
-    if (preempt_count) /* once preemption is disabled */
-        return;
-
-    /* We can schedule directly from sighandler because Linux kernel cares only
-     * about proper sigreturn frame in the stack.
-     */
-    schedule();
-}
-
-static void timer_init(void)
-{
-    struct sigaction sa = {
-        .sa_handler = (void (*)(int)) timer_handler,
-        .sa_flags = SA_SIGINFO,
-    };
-    sigfillset(&sa.sa_mask);
-    sigaction(SIGALRM, &sa, NULL);
-}
-
-static void timer_create(unsigned int usecs)
-{
-    ualarm(usecs, usecs);
-}
-static void timer_cancel(void)
-{
-    ualarm(0, 0);
-}
-
-static void timer_wait(void)
-{
-    sigset_t mask;
-    sigprocmask(0, NULL, &mask);
-    sigdelset(&mask, SIGALRM);
-    sigsuspend(&mask);
-}
+#include "task_sched.h"
 
 static int cmp_u32(const void *a, const void *b, void *arg)
 {
@@ -230,14 +49,51 @@ static inline uint32_t random_shuffle(uint32_t x)
     return x;
 }
 
+/* qsort_r() of glibc mallocs its merge buffer from inside libc, where a
+ * tick could preempt it holding the arena lock: a bottom-up merge sort of
+ * the same interface instead, whose buffer comes from task_malloc().
+ */
+static void merge_sort_r(void *base,
+                         size_t n,
+                         size_t size,
+                         int (*cmp)(const void *, const void *, void *),
+                         void *arg)
+{
+    char *src = base, *dst = task_malloc(n * size);
+    if (!dst)
+        abort();
+    char *buf = dst;
+
+    for (size_t width = 1; width < n; width *= 2) {
+        for (size_t lo = 0; lo < n; lo += 2 * width) {
+            size_t mid = lo + width < n ? lo + width : n;
+            size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+            size_t i = lo, j = mid, k = lo;
+            while (i < mid && j < hi) {
+                if (cmp(src + j * size, src + i * size, arg) < 0)
+                    memcpy(dst + k++ * size, src + j++ * size, size);
+                else
+                    memcpy(dst + k++ * size, src + i++ * size, size);
+            }
+            memcpy(dst + k * size, src + i * size, (mid - i) * size);
+            k += mid - i;
+            memcpy(dst + k * size, src + j * size, (hi - j) * size);
+        }
+        char *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src != base)
+        memcpy(base, src, n * size);
+    task_free(buf);
+}
+
 #define ARR_SIZE 1000000
 static void sort(void *arg)
 {
     char *name = arg;
 
-    preempt_disable();
-    uint32_t *arr = malloc(ARR_SIZE * sizeof(uint32_t));
-    preempt_enable();
+    uint32_t *arr = task_malloc(ARR_SIZE * sizeof(uint32_t));
 
     task_printf("[%s] %s: begin\n", name, __func__);
 
@@ -247,7 +103,7 @@ static void sort(void *arg)
 
     task_printf("[%s] %s: start sorting\n", name, __func__);
 
-    qsort_r(arr, ARR_SIZE, sizeof(uint32_t), cmp_u32, name);
+    merge_sort_r(arr, ARR_SIZE, sizeof(uint32_t), cmp_u32, name);
 
     for (int i = 0; i < ARR_SIZE - 1; i++)
         if (arr[i] > arr[i + 1]) {
@@ -258,29 +114,16 @@ static void sort(void *arg)
 
     task_printf("[%s] %s: end\n", name, __func__);
 
-    preempt_disable();
-    free(arr);
-    preempt_enable();
+    task_free(arr);
 }
 
-int main()
+int main(int argc, char *argv[])
 {
-    timer_init();
-    task_init();
+    sched_init(sched_workers(argc, argv));
 
     task_add(sort, "1"), task_add(sort, "2"), task_add(sort, "3");
 
-    preempt_disable();
-    timer_create(10000); /* 10 ms */
-
-    while (!list_empty(&task_main.list) || !list_empty(&task_reap)) {
-        preempt_enable();
-        timer_wait();
-        preempt_disable();
-    }
-
-    preempt_enable();
-    timer_cancel();
+    sched_run(timer_quantum(argc, argv)); /* 10 ms by default */
 
     return 0;
 }
@@ -0,0 +1,74 @@
+#pragma once
+
+/* Protothreads, after those of Adam Dunkels: stackless coroutines written
+ * as a function which is called again and again, and resumes where it left
+ * off through a switch on the line number saved in its 'struct pt'.
+ *
+ * Local variables do not survive a PT_YIELD() or PT_WAIT_UNTIL(): state
+ * which must, goes into the structure the function is passed, next to its
+ * 'struct pt'. For the same reason a protothread cannot yield from a
+ * function it calls, nor use a switch statement around a yield.
+ *
+ *     struct counter {
+ *         struct pt pt;
+ *         int i;
+ *     };
+ *
+ *     static int count(void *arg)
+ *     {
+ *         struct counter *c = arg;
+ *         PT_BEGIN(&c->pt);
+ *         for (c->i = 0; c->i < 10; c->i++)
+ *             PT_YIELD(&c->pt);
+ *         PT_END(&c->pt);
+ *     }
+ */
+
+struct pt {
+    unsigned short lc; /* line to resume at, 0 for the start */
+};
+
+#define PT_WAITING 0
+#define PT_YIELDED 1
+#define PT_EXITED 2
+#define PT_ENDED 3
+
+#define PT_INIT(pt) ((pt)->lc = 0)
+
+#define PT_BEGIN(pt)              \
+    {                             \
+        char pt_yielded = 1;      \
+        (void) pt_yielded;        \
+        switch ((pt)->lc) {       \
+        case 0:
+
+#define PT_END(pt)       \
+    }                    \
+    (pt)->lc = 0;        \
+    return PT_ENDED;     \
+    }
+
+/* Run again later, at the earliest after the other runnable tasks */
+#define PT_YIELD(pt)                \
+    do {                            \
+        pt_yielded = 0;             \
+        (pt)->lc = __LINE__;        \
+    case __LINE__:                  \
+        if (!pt_yielded)            \
+            return PT_YIELDED;      \
+    } while (0)
+
+/* Yield until 'cond' holds; it is checked every time the task runs */
+#define PT_WAIT_UNTIL(pt, cond)   \
+    do {                          \
+        (pt)->lc = __LINE__;      \
+    case __LINE__:                \
+        if (!(cond))              \
+            return PT_WAITING;    \
+    } while (0)
+
+#define PT_EXIT(pt)          \
+    do {                     \
+        (pt)->lc = 0;        \
+        return PT_EXITED;    \
+    } while (0)
@@ -0,0 +1,267 @@
+#pragma once
+
+/* Intrusive red-black tree, after include/linux/rbtree.h: the nodes are
+ * embedded in the caller's structures and the ordering is up to the caller,
+ * through the 'less' function of rb_add(). The leftmost node is cached, so
+ * rb_first() is O(1).
+ *
+ * This is the textbook algorithm (Cormen et al., chapter 13) with parent
+ * pointers and NULL leaves, not the tuned one of Linux.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct rb_node {
+    struct rb_node *parent, *left, *right;
+    bool red;
+};
+
+struct rb_root {
+    struct rb_node *node;
+    struct rb_node *leftmost;
+};
+
+#define RB_ROOT \
+    (struct rb_root) { NULL, NULL }
+
+#define rb_entry(ptr, type, member) \
+    ((type *) ((char *) (ptr) - offsetof(type, member)))
+
+static inline bool rb_empty(const struct rb_root *root)
+{
+    return !root->node;
+}
+
+static inline struct rb_node *rb_first(const struct rb_root *root)
+{
+    return root->leftmost;
+}
+
+static inline struct rb_node *rb_next(const struct rb_node *node)
+{
+    if (node->right) {
+        node = node->right;
+        while (node->left)
+            node = node->left;
+        return (struct rb_node *) node;
+    }
+    while (node->parent && node == node->parent->right)
+        node = node->parent;
+    return node->parent;
+}
+
+static inline void rb_replace_child(struct rb_root *root,
+                                    struct rb_node *parent,
+                                    struct rb_node *old,
+                                    struct rb_node *new)
+{
+    if (!parent)
+        root->node = new;
+    else if (parent->left == old)
+        parent->left = new;
+    else
+        parent->right = new;
+}
+
+static inline void rb_rotate_left(struct rb_root *root, struct rb_node *x)
+{
+    struct rb_node *y = x->right;
+
+    x->right = y->left;
+    if (y->left)
+        y->left->parent = x;
+    y->parent = x->parent;
+    rb_replace_child(root, x->parent, x, y);
+    y->left = x;
+    x->parent = y;
+}
+
+static inline void rb_rotate_right(struct rb_root *root, struct rb_node *x)
+{
+    struct rb_node *y = x->left;
+
+    x->left = y->right;
+    if (y->right)
+        y->right->parent = x;
+    y->parent = x->parent;
+    rb_replace_child(root, x->parent, x, y);
+    y->right = x;
+    x->parent = y;
+}
+
+static inline void rb_insert_color(struct rb_root *root, struct rb_node *z)
+{
+    struct rb_node *p;
+
+    while ((p = z->parent) && p->red) {
+        struct rb_node *g = p->parent; /* red nodes are never the root */
+        if (p == g->left) {
+            struct rb_node *u = g->right;
+            if (u && u->red) {
+                p->red = u->red = false;
+                g->red = true;
+                z = g;
+                continue;
+            }
+            if (z == p->right) {
+                rb_rotate_left(root, p);
+                z = p;
+                p = z->parent;
+            }
+            p->red = false;
+            g->red = true;
+            rb_rotate_right(root, g);
+        } else {
+            struct rb_node *u = g->left;
+            if (u && u->red) {
+                p->red = u->red = false;
+                g->red = true;
+                z = g;
+                continue;
+            }
+            if (z == p->left) {
+                rb_rotate_right(root, p);
+                z = p;
+                p = z->parent;
+            }
+            p->red = false;
+            g->red = true;
+            rb_rotate_left(root, g);
+        }
+    }
+    root->node->red = false;
+}
+
+/* Insert 'node' after the nodes it is not less than */
+static inline void rb_add(struct rb_root *root,
+                          struct rb_node *node,
+                          bool (*less)(const struct rb_node *,
+                                       const struct rb_node *))
+{
+    struct rb_node **link = &root->node, *parent = NULL;
+    bool leftmost = true;
+
+    while (*link) {
+        parent = *link;
+        if (less(node, parent)) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+
+    node->parent = parent;
+    node->left = node->right = NULL;
+    node->red = true;
+    *link = node;
+    if (leftmost)
+        root->leftmost = node;
+    rb_insert_color(root, node);
+}
+
+/* 'x', maybe NULL, child of 'parent', is short of a black node */
+static inline void rb_erase_color(struct rb_root *root,
+                                  struct rb_node *x,
+                                  struct rb_node *parent)
+{
+    while (x != root->node && (!x || !x->red)) {
+        if (x == parent->left) {
+            struct rb_node *w = parent->right;
+            if (w->red) {
+                w->red = false;
+                parent->red = true;
+                rb_rotate_left(root, parent);
+                w = parent->right;
+            }
+            if ((!w->left || !w->left->red) && (!w->right || !w->right->red)) {
+                w->red = true;
+                x = parent;
+                parent = x->parent;
+                continue;
+            }
+            if (!w->right || !w->right->red) {
+                w->left->red = false;
+                w->red = true;
+                rb_rotate_right(root, w);
+                w = parent->right;
+            }
+            w->red = parent->red;
+            parent->red = false;
+            w->right->red = false;
+            rb_rotate_left(root, parent);
+        } else {
+            struct rb_node *w = parent->left;
+            if (w->red) {
+                w->red = false;
+                parent->red = true;
+                rb_rotate_right(root, parent);
+                w = parent->left;
+            }
+            if ((!w->left || !w->left->red) && (!w->right || !w->right->red)) {
+                w->red = true;
+                x = parent;
+                parent = x->parent;
+                continue;
+            }
+            if (!w->left || !w->left->red) {
+                w->right->red = false;
+                w->red = true;
+                rb_rotate_left(root, w);
+                w = parent->left;
+            }
+            w->red = parent->red;
+            parent->red = false;
+            w->left->red = false;
+            rb_rotate_right(root, parent);
+        }
+        x = root->node;
+        break;
+    }
+    if (x)
+        x->red = false;
+}
+
+static inline void rb_erase(struct rb_root *root, struct rb_node *z)
+{
+    struct rb_node *x, *parent;
+    bool black;
+
+    if (root->leftmost == z)
+        root->leftmost = rb_next(z);
+
+    if (!z->left || !z->right) {
+        x = z->left ? z->left : z->right;
+        parent = z->parent;
+        black = !z->red;
+        rb_replace_child(root, parent, z, x);
+        if (x)
+            x->parent = parent;
+    } else {
+        /* Put the successor of 'z' in its place */
+        struct rb_node *y = z->right;
+        while (y->left)
+            y = y->left;
+        black = !y->red;
+        x = y->right;
+        if (y->parent == z) {
+            parent = y;
+        } else {
+            parent = y->parent;
+            parent->left = x;
+            if (x)
+                x->parent = parent;
+            y->right = z->right;
+            y->right->parent = y;
+        }
+        rb_replace_child(root, z->parent, z, y);
+        y->parent = z->parent;
+        y->left = z->left;
+        y->left->parent = y;
+        y->red = z->red;
+    }
+
+    if (black)
+        rb_erase_color(root, x, parent);
+}
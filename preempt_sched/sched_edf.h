@@ -0,0 +1,271 @@
+#pragma once
+
+/* Earliest deadline first class, after SCHED_DEADLINE of Linux.
+ *
+ * A task of this class runs a job every 'period': it is given 'runtime' of
+ * CPU time, to be used before 'deadline', all in nanoseconds. Among the
+ * runnable tasks the one whose job has the earliest absolute deadline runs,
+ * and preempts the others at the next tick. A job ends with
+ * task_edf_yield(); the task then stays off the run queue until its next
+ * period. A job which completes after its deadline counts as a miss.
+ *
+ * A task is admitted only if the sum of runtime / period of the tasks of a
+ * worker stays under SCHED_EDF_BW_LIMIT, which guarantees every deadline
+ * (deadline = period) as long as the tasks keep to their runtime. A job
+ * which does not is throttled, i.e. taken off the run queue until its next
+ * period, like the constant bandwidth server of Linux, so that it cannot
+ * make the other tasks miss theirs. Admitted tasks stay on their worker,
+ * they are never stolen.
+ *
+ * The class ranks above all others. Periods start at the first tick past
+ * their time, so jobs are released up to a quantum late.
+ *
+ * Included at the end of task_sched.h.
+ */
+
+#define SCHED_EDF_BW_SHIFT 20
+#define SCHED_EDF_BW_LIMIT ((95 << SCHED_EDF_BW_SHIFT) / 100) /* of a worker */
+
+static inline bool edf_before(uint64_t a, uint64_t b)
+{
+    return (int64_t) (a - b) < 0;
+}
+
+static bool edf_less(const struct rb_node *a, const struct rb_node *b)
+{
+    return edf_before(
+        rb_entry(a, struct sched_edf_entity, node)->abs_deadline,
+        rb_entry(b, struct sched_edf_entity, node)->abs_deadline);
+}
+
+static inline struct task_struct *edf_task_of(struct rb_node *node)
+{
+    return rb_entry(node, struct task_struct, edf.node);
+}
+
+/* New budget and deadline, for a period starting at 'release' */
+static inline void edf_replenish(struct sched_edf_entity *se, uint64_t release)
+{
+    se->abs_deadline = release + se->deadline;
+    se->release = release + se->period;
+    se->budget = se->runtime;
+}
+
+static inline void edf_update_curr(struct task_struct *curr)
+{
+    struct sched_edf_entity *se = &curr->edf;
+    uint64_t now = sched_clock();
+
+    se->budget -= now - se->exec_start;
+    se->exec_start = now;
+}
+
+static void edf_enqueue(struct sched_rq *rq, struct task_struct *task)
+{
+    struct sched_edf_entity *se = &task->edf;
+
+    if (task->on_cpu) {
+        edf_update_curr(task);
+    } else {
+        /* New, or waking up: as the constant bandwidth server, a job whose
+         * deadline passed meanwhile starts afresh
+         */
+        uint64_t now = sched_clock();
+        if (!se->abs_deadline || !edf_before(now, se->abs_deadline))
+            edf_replenish(se, now);
+    }
+    rb_add(&rq->edf.tasks, &se->node, edf_less);
+}
+
+static void edf_dequeue(struct sched_rq *rq, struct task_struct *task)
+{
+    rb_erase(&rq->edf.tasks, &task->edf.node);
+}
+
+static struct task_struct *edf_pick_next(struct sched_rq *rq)
+{
+    struct rb_node *left = rb_first(&rq->edf.tasks);
+    if (!left)
+        return NULL;
+
+    struct task_struct *task = edf_task_of(left);
+    task->edf.exec_start = sched_clock();
+    return task;
+}
+
+static struct task_struct *edf_pick_steal(struct sched_rq *rq)
+{
+    (void) rq;
+    return NULL; /* the bandwidth is reserved on this worker */
+}
+
+/* Take the running task off the run queue until its next period. It only
+ * goes on the throttled list in edf_block(), once schedule() switches it
+ * out: until then a nested tick could release it while it still runs.
+ */
+static inline void edf_throttle(struct task_struct *task)
+{
+    task->blocked = true;
+    task->edf.throttled = true;
+}
+
+/* Switched out blocked: charge the time it ran since the last pick or
+ * tick, so that napping does not spare the budget
+ */
+static void edf_block(struct sched_rq *rq, struct task_struct *task)
+{
+    struct sched_edf_entity *se = &task->edf;
+
+    edf_update_curr(task);
+    if (se->throttled) {
+        se->throttled = false;
+        list_add_tail(&task->list, &rq->edf.throttled);
+        return;
+    }
+
+    /* Asleep, see task_sleep_until(). Out of budget, it is throttled too:
+     * it sleeps at least until its next period, and edf_enqueue()
+     * replenishes it on wake-up, its deadline being past by then.
+     */
+    if (se->budget > 0)
+        return;
+    se->overrun = true;
+    if (edf_before(task->timer.expires << TW_TICK_SHIFT, se->release)) {
+        tw_del(&rq->sleepers, &task->timer);
+        tw_add(&rq->sleepers, &task->timer, se->release);
+    }
+}
+
+static bool edf_tick(struct sched_rq *rq, struct task_struct *curr)
+{
+    if (curr->blocked) /* a tick nested in the one which throttled it */
+        return true;
+    edf_update_curr(curr);
+
+    if (curr->edf.budget <= 0) {
+        curr->edf.overrun = true;
+        edf_throttle(curr);
+        return true;
+    }
+
+    struct rb_node *left = rb_first(&rq->edf.tasks);
+    return left && edf_before(edf_task_of(left)->edf.abs_deadline,
+                              curr->edf.abs_deadline);
+}
+
+/* Release the throttled tasks whose period started */
+static void edf_update(struct sched_rq *rq)
+{
+    if (list_empty(&rq->edf.throttled))
+        return;
+
+    uint64_t now = sched_clock();
+    struct task_struct *task, *safe;
+    list_for_each_entry_safe (task, safe, &rq->edf.throttled, list) {
+        struct sched_edf_entity *se = &task->edf;
+        if (edf_before(now, se->release))
+            continue;
+        list_del(&task->list);
+        /* Skip the periods we are too late for */
+        edf_replenish(se, edf_before(se->release + se->deadline, now)
+                              ? now
+                              : se->release);
+        task->blocked = false;
+        enqueue_task(rq, task);
+    }
+}
+
+static struct sched_rq *edf_select_rq(struct task_struct *task)
+{
+    return task->edf.rq;
+}
+
+static void edf_task_dead(struct sched_rq *rq, struct task_struct *task)
+{
+    rq->edf.bw -= task->edf.bw;
+}
+
+static const struct sched_class sched_edf_class = {
+    .name = "edf",
+    .rank = 0,
+    .enqueue = edf_enqueue,
+    .dequeue = edf_dequeue,
+    .pick_next = edf_pick_next,
+    .pick_steal = edf_pick_steal,
+    .tick = edf_tick,
+    .block = edf_block,
+    .update = edf_update,
+    .select_rq = edf_select_rq,
+    .task_dead = edf_task_dead,
+};
+
+/* Admit a task, before task_start(), to the EDF class, on the worker with
+ * the most bandwidth left. Requires 0 < runtime <= deadline <= period.
+ * Returns false, and leaves the task in its class, if no worker has enough.
+ */
+static inline bool task_set_edf(struct task_struct *task,
+                                uint64_t runtime,
+                                uint64_t deadline,
+                                uint64_t period)
+{
+    if (!runtime || runtime > deadline || deadline > period)
+        return false;
+
+    uint64_t bw = (runtime << SCHED_EDF_BW_SHIFT) / period;
+    struct sched_rq *rq = NULL;
+    int flags;
+    local_irq_save(&flags);
+    for (int i = 0; i < sched_nr_workers; ++i) {
+        if (!rq || sched_rqs[i].edf.bw < rq->edf.bw)
+            rq = &sched_rqs[i];
+    }
+    rq_lock(rq);
+    bool admitted = rq->edf.bw + bw <= SCHED_EDF_BW_LIMIT;
+    if (admitted)
+        rq->edf.bw += bw;
+    rq_unlock(rq);
+    local_irq_restore(&flags);
+    if (!admitted)
+        return false;
+
+    struct sched_edf_entity *se = &task->edf;
+    se->runtime = runtime;
+    se->deadline = deadline;
+    se->period = period;
+    se->bw = bw;
+    se->abs_deadline = 0;
+    se->overrun = se->throttled = false;
+    se->rq = rq;
+    se->nr_jobs = se->nr_missed = 0;
+    task->sched_class = &sched_edf_class;
+    return true;
+}
+
+/* End the current job of the running task, and wait for the next period */
+static inline void task_edf_yield(void)
+{
+    int flags;
+    local_irq_save(&flags);
+
+    struct sched_rq *rq = this_rq();
+    struct task_struct *task = rq->current;
+    struct sched_edf_entity *se = &task->edf;
+    uint64_t now = sched_clock();
+
+    se->nr_jobs++;
+    if (se->overrun || edf_before(se->abs_deadline, now))
+        se->nr_missed++;
+    se->overrun = false;
+
+    rq_lock(rq);
+    if (edf_before(now, se->release)) {
+        edf_throttle(task);
+    } else { /* late, the next job starts right away */
+        edf_replenish(se, now);
+        se->exec_start = now;
+    }
+    rq_unlock(rq);
+    schedule();
+
+    local_irq_restore(&flags);
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+/* Fair class, after the Completely Fair Scheduler of Linux.
+ *
+ * Every task accumulates a virtual runtime: the CLOCK_MONOTONIC time it ran,
+ * scaled by NICE_0_WEIGHT / weight, so that a task of twice the weight ages
+ * half as fast. Queued tasks are kept in a red-black tree ordered by
+ * vruntime, and the next task is the leftmost one, the furthest behind. A
+ * tick preempts the running task once it is no longer the furthest behind.
+ *
+ * A task which yields before its quantum is over keeps its lead, and gets
+ * back its share later, unlike in the round robin class.
+ *
+ * Tasks entering the queue, new, stolen or back from a sleep, are placed
+ * relative to the min_vruntime of the worker, a monotonic floor of the
+ * vruntimes there. A sleeper keeps at most SCHED_FAIR_SLEEPER of lead,
+ * enough to preempt the tasks which ran meanwhile, but not to monopolize
+ * the worker for as long as it slept.
+ *
+ * The class ranks below round robin, like SCHED_NORMAL below SCHED_RR.
+ *
+ * Included at the end of task_sched.h.
+ */
+
+#define NICE_0_WEIGHT 1024
+
+#define SCHED_FAIR_SLEEPER 3000000 /* 3 ms */
+
+/* From Linux, kernel/sched/core.c: every nice level is worth about 10% of
+ * CPU time, i.e. the weights grow by 1.25 per level.
+ */
+static const unsigned long sched_nice_to_weight[40] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */ 9548,  7620,  6100,  4904,  3906,
+    /*  -5 */ 3121,  2501,  1991,  1586,  1277,
+    /*   0 */ 1024,  820,   655,   526,   423,
+    /*   5 */ 335,   272,   215,   172,   137,
+    /*  10 */ 110,   87,    70,    56,    45,
+    /*  15 */ 36,    29,    23,    18,    15,
+};
+
+/* vruntimes wrap around, compare their difference */
+static inline bool fair_before(uint64_t a, uint64_t b)
+{
+    return (int64_t) (a - b) < 0;
+}
+
+static bool fair_less(const struct rb_node *a, const struct rb_node *b)
+{
+    return fair_before(rb_entry(a, struct sched_fair_entity, node)->vruntime,
+                       rb_entry(b, struct sched_fair_entity, node)->vruntime);
+}
+
+static inline struct task_struct *fair_task_of(struct rb_node *node)
+{
+    return rb_entry(node, struct task_struct, fair.node);
+}
+
+/* Move min_vruntime up to the lowest of the running and queued vruntimes */
+static inline void fair_update_min_vruntime(struct sched_rq *rq,
+                                            struct sched_fair_entity *curr)
+{
+    struct rb_node *left = rb_first(&rq->fair.tasks);
+    uint64_t vruntime = curr->vruntime;
+
+    if (left && fair_before(fair_task_of(left)->fair.vruntime, vruntime))
+        vruntime = fair_task_of(left)->fair.vruntime;
+    if (fair_before(rq->fair.min_vruntime, vruntime))
+        rq->fair.min_vruntime = vruntime;
+}
+
+/* Charge the running task for the time since it was picked */
+static inline void fair_update_curr(struct sched_rq *rq,
+                                    struct task_struct *curr)
+{
+    struct sched_fair_entity *se = &curr->fair;
+    uint64_t now = sched_clock();
+
+    se->vruntime += (now - se->exec_start) * NICE_0_WEIGHT / se->weight;
+    se->exec_start = now;
+    fair_update_min_vruntime(rq, se);
+}
+
+static void fair_enqueue(struct sched_rq *rq, struct task_struct *task)
+{
+    struct sched_fair_entity *se = &task->fair;
+    uint64_t min_vruntime = rq->fair.min_vruntime;
+
+    if (task->on_cpu) {
+        fair_update_curr(rq, task);
+    } else if (!se->rq) {
+        se->vruntime = min_vruntime;
+    } else {
+        if (se->rq != rq)
+            se->vruntime = se->vruntime - se->min_vruntime + min_vruntime;
+        if (fair_before(se->vruntime, min_vruntime - SCHED_FAIR_SLEEPER))
+            se->vruntime = min_vruntime - SCHED_FAIR_SLEEPER;
+    }
+    se->rq = rq;
+    rb_add(&rq->fair.tasks, &se->node, fair_less);
+}
+
+static void fair_dequeue(struct sched_rq *rq, struct task_struct *task)
+{
+    rb_erase(&rq->fair.tasks, &task->fair.node);
+    task->fair.min_vruntime = rq->fair.min_vruntime;
+}
+
+static struct task_struct *fair_pick_next(struct sched_rq *rq)
+{
+    struct rb_node *left = rb_first(&rq->fair.tasks);
+    if (!left)
+        return NULL;
+
+    struct task_struct *task = fair_task_of(left);
+    task->fair.exec_start = sched_clock();
+    return task;
+}
+
+static struct task_struct *fair_pick_steal(struct sched_rq *rq)
+{
+    for (struct rb_node *node = rb_first(&rq->fair.tasks); node;
+         node = rb_next(node)) {
+        struct task_struct *task = fair_task_of(node);
+        if (!__atomic_load_n(&task->on_cpu, __ATOMIC_ACQUIRE))
+            return task;
+    }
+    return NULL;
+}
+
+static bool fair_tick(struct sched_rq *rq, struct task_struct *curr)
+{
+    fair_update_curr(rq, curr);
+
+    struct rb_node *left = rb_first(&rq->fair.tasks);
+    return left &&
+           fair_before(fair_task_of(left)->fair.vruntime, curr->fair.vruntime);
+}
+
+/* Going to sleep: the time it ran until then counts, as for a yield */
+static void fair_block(struct sched_rq *rq, struct task_struct *task)
+{
+    fair_update_curr(rq, task);
+}
+
+static const struct sched_class sched_fair_class = {
+    .name = "fair",
+    .rank = 3,
+    .enqueue = fair_enqueue,
+    .dequeue = fair_dequeue,
+    .pick_next = fair_pick_next,
+    .pick_steal = fair_pick_steal,
+    .tick = fair_tick,
+    .block = fair_block,
+};
+
+/* Move a task, before task_start(), to the fair class. 'nice' goes from
+ * -20, the largest share, to 19.
+ */
+static inline void task_set_nice(struct task_struct *task, int nice)
+{
+    if (nice < -20)
+        nice = -20;
+    if (nice > 19)
+        nice = 19;
+    task->sched_class = &sched_fair_class;
+    task->fair.rq = NULL; /* new, see fair_enqueue() */
+    task->fair.nice = nice;
+    task->fair.weight = sched_nice_to_weight[nice + 20];
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+/* Priority class, after the O(1) scheduler of Linux 2.6.
+ *
+ * Every worker has two arrays of SCHED_PRIO_LEVELS FIFOs, one per priority,
+ * with a bitmap of the non-empty ones: the next task is the head of the
+ * first set bit of the active array, found with a single ctz instruction,
+ * whatever the number of queued tasks.
+ *
+ * A task runs until a task of a higher priority is queued, or for its time
+ * slice, longer for higher priorities. It then goes to the expired array,
+ * with a new slice; when the active array runs empty the two are swapped.
+ * So a low priority task still runs once every tasks of higher priorities
+ * used their slices, instead of starving.
+ *
+ * The whole class ranks above round robin: any queued task of this class
+ * preempts a round robin task at the next tick.
+ *
+ * Included at the end of task_sched.h.
+ */
+
+#define SCHED_PRIO_DEFAULT (SCHED_PRIO_LEVELS / 2)
+
+/* From 8 ticks at priority 0 down to 1 at the lowest */
+static inline int prio_time_slice(int prio)
+{
+    return 1 + (SCHED_PRIO_LEVELS - 1 - prio) / 8;
+}
+
+static inline void sched_prio_init(struct sched_prio_rq *prio)
+{
+    for (int a = 0; a < 2; ++a) {
+        prio->arrays[a].bitmap = 0;
+        for (int i = 0; i < SCHED_PRIO_LEVELS; ++i)
+            INIT_LIST_HEAD(&prio->arrays[a].queue[i]);
+    }
+    prio->active = &prio->arrays[0];
+    prio->expired = &prio->arrays[1];
+}
+
+static void prio_enqueue(struct sched_rq *rq, struct task_struct *task)
+{
+    struct sched_prio_array *array =
+        task->prio.expired ? rq->prio.expired : rq->prio.active;
+    int prio = task->prio.prio;
+
+    list_add_tail(&task->list, &array->queue[prio]);
+    array->bitmap |= (uint64_t) 1 << prio;
+    task->prio.array = array;
+    task->prio.expired = false;
+}
+
+static void prio_dequeue(struct sched_rq *rq, struct task_struct *task)
+{
+    struct sched_prio_array *array = task->prio.array;
+    int prio = task->prio.prio;
+
+    (void) rq;
+    list_del(&task->list);
+    if (list_empty(&array->queue[prio]))
+        array->bitmap &= ~((uint64_t) 1 << prio);
+}
+
+static struct task_struct *prio_pick_next(struct sched_rq *rq)
+{
+    struct sched_prio_rq *prio = &rq->prio;
+
+    if (!prio->active->bitmap) {
+        if (!prio->expired->bitmap)
+            return NULL;
+        struct sched_prio_array *array = prio->active;
+        prio->active = prio->expired;
+        prio->expired = array;
+    }
+
+    int idx = __builtin_ctzll(prio->active->bitmap);
+    return list_first_entry(&prio->active->queue[idx], struct task_struct,
+                            list);
+}
+
+/* The lowest priority task, expired first */
+static struct task_struct *prio_pick_steal(struct sched_rq *rq)
+{
+    struct sched_prio_array *arrays[] = {rq->prio.expired, rq->prio.active};
+
+    for (int a = 0; a < 2; ++a) {
+        for (uint64_t map = arrays[a]->bitmap; map;
+             map &= ~((uint64_t) 1 << (63 - __builtin_clzll(map)))) {
+            struct list_head *head =
+                &arrays[a]->queue[63 - __builtin_clzll(map)];
+            for (struct list_head *node = head->prev; node != head;
+                 node = node->prev) {
+                struct task_struct *task =
+                    list_entry(node, struct task_struct, list);
+                if (!__atomic_load_n(&task->on_cpu, __ATOMIC_ACQUIRE))
+                    return task;
+            }
+        }
+    }
+    return NULL;
+}
+
+static bool prio_tick(struct sched_rq *rq, struct task_struct *curr)
+{
+    int prio = curr->prio.prio;
+
+    if (--curr->prio.time_slice <= 0) {
+        curr->prio.time_slice = prio_time_slice(prio);
+        curr->prio.expired = true; /* for schedule() to enqueue */
+        return true;
+    }
+    /* Higher priorities only: equal ones wait for the end of the slice */
+    return rq->prio.active->bitmap & (((uint64_t) 1 << prio) - 1);
+}
+
+static const struct sched_class sched_prio_class = {
+    .name = "prio",
+    .rank = 1,
+    .enqueue = prio_enqueue,
+    .dequeue = prio_dequeue,
+    .pick_next = prio_pick_next,
+    .pick_steal = prio_pick_steal,
+    .tick = prio_tick,
+};
+
+/* Move a task, before task_start(), to the priority class. 'prio' goes from
+ * 0, the highest, to SCHED_PRIO_LEVELS - 1.
+ */
+static inline void task_set_prio(struct task_struct *task, int prio)
+{
+    if (prio < 0)
+        prio = 0;
+    if (prio >= SCHED_PRIO_LEVELS)
+        prio = SCHED_PRIO_LEVELS - 1;
+    task->sched_class = &sched_prio_class;
+    task->prio.prio = prio;
+    task->prio.time_slice = prio_time_slice(prio);
+    task->prio.expired = false;
+}
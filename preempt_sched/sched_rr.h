@@ -0,0 +1,53 @@
+#pragma once
+
+/* Round robin class, the default one: a single FIFO per worker, and the
+ * running task makes room for the next one on every tick.
+ *
+ * Included at the end of task_sched.h.
+ */
+
+static void rr_enqueue(struct sched_rq *rq, struct task_struct *task)
+{
+    list_add_tail(&task->list, &rq->rr.tasks);
+}
+
+static void rr_dequeue(struct sched_rq *rq, struct task_struct *task)
+{
+    (void) rq;
+    list_del(&task->list);
+}
+
+static struct task_struct *rr_pick_next(struct sched_rq *rq)
+{
+    if (list_empty(&rq->rr.tasks))
+        return NULL;
+    return list_first_entry(&rq->rr.tasks, struct task_struct, list);
+}
+
+/* From the tail, which would run last here */
+static struct task_struct *rr_pick_steal(struct sched_rq *rq)
+{
+    struct list_head *head = &rq->rr.tasks;
+    for (struct list_head *node = head->prev; node != head; node = node->prev) {
+        struct task_struct *task = list_entry(node, struct task_struct, list);
+        if (!__atomic_load_n(&task->on_cpu, __ATOMIC_ACQUIRE))
+            return task;
+    }
+    return NULL;
+}
+
+static bool rr_tick(struct sched_rq *rq, struct task_struct *curr)
+{
+    (void) curr;
+    return rq->nr_class[sched_rr_class.rank];
+}
+
+static const struct sched_class sched_rr_class = {
+    .name = "rr",
+    .rank = 2,
+    .enqueue = rr_enqueue,
+    .dequeue = rr_dequeue,
+    .pick_next = rr_pick_next,
+    .pick_steal = rr_pick_steal,
+    .tick = rr_tick,
+};
@@ -0,0 +1,951 @@
+#pragma once
+
+/* Preemptive coroutine scheduler shared by the task_sched demos.
+ *
+ * Tasks are switched round robin by schedule(), either voluntarily or from
+ * the SIGALRM handler, which plays the role of the timer interrupt, on one
+ * or more worker threads. The context switch itself lives in task_switch.h.
+ *
+ * Usage: sched_init(nworkers), task_add() a few tasks, sched_run(quantum).
+ *
+ * Requires list.h (from linux-list) on the include path.
+ */
+
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/prctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "list.h"
+#include "protothread.h"
+#include "rbtree.h"
+#include "task_stack.h"
+#include "task_switch.h"
+#include "timer_wheel.h"
+
+/* Interrupts are masked virtually: SIGALRM is never blocked, instead its
+ * handler checks a per-thread flag and, if interrupts or preemption are
+ * disabled, only records that a preemption is pending. The preemption then
+ * runs when the last of them is enabled again. Entering and leaving
+ * schedule() thus costs no system call, where blocking the signal took two
+ * sigprocmask() calls.
+ */
+static __thread volatile sig_atomic_t irq_disabled, irq_pending;
+static __thread volatile int preempt_count = 0;
+
+#define barrier() __asm__ __volatile__("" ::: "memory")
+
+static void schedule(void);
+
+/* Run the preemption deferred by the timer handler, if any */
+static inline void irq_pending_run(void)
+{
+    if (irq_pending && !irq_disabled && !preempt_count) {
+        irq_pending = 0;
+        schedule();
+    }
+}
+
+static inline void preempt_disable(void)
+{
+    preempt_count++;
+    barrier();
+}
+static inline void preempt_enable(void)
+{
+    barrier();
+    preempt_count--;
+    irq_pending_run();
+}
+
+static inline void local_irq_save(int *flags)
+{
+    *flags = irq_disabled;
+    irq_disabled = 1;
+    barrier();
+}
+
+static inline void local_irq_restore(int *flags)
+{
+    barrier();
+    irq_disabled = *flags;
+    irq_pending_run();
+}
+
+static inline void local_irq_enable(void)
+{
+    int flags = 0;
+    local_irq_restore(&flags);
+}
+
+/* A task preempted inside libc while holding one of its locks, e.g. the
+ * malloc arena lock or a stdio stream lock, would deadlock the next task of
+ * its worker which takes the same lock. Tasks call these instead, with
+ * preemption disabled around the libc call, and keep to libc functions
+ * which take no lock otherwise.
+ */
+#define task_printf(...)     \
+    ({                       \
+        preempt_disable();   \
+        printf(__VA_ARGS__); \
+        preempt_enable();    \
+    })
+
+static inline void *task_malloc(size_t size)
+{
+    preempt_disable();
+    void *ptr = malloc(size);
+    preempt_enable();
+    return ptr;
+}
+
+static inline void task_free(void *ptr)
+{
+    preempt_disable();
+    free(ptr);
+    preempt_enable();
+}
+
+typedef void(task_callback_t)(void *arg);
+
+/* Step of a stackless task, see protothread.h: the task is done once it
+ * returns PT_EXITED or PT_ENDED.
+ */
+typedef int(task_step_t)(void *arg);
+
+#define TASK_STACK_SIZE (1 << 20)
+
+/* CLOCK_MONOTONIC, in nanoseconds */
+static inline uint64_t sched_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct task_struct;
+struct sched_rq;
+
+/* Scheduling classes, after those of Linux. Every task belongs to one; the
+ * classes are ranked, and a queued task of a higher class always runs
+ * before any task of a lower one. Within a class, the hooks decide:
+ *
+ * - enqueue() adds a runnable task to the queue of the class on 'rq': a
+ *   new or stolen one, or the running one, still 'on_cpu', being switched
+ *   out,
+ * - dequeue() removes it,
+ * - pick_next() returns the queued task to run next, or NULL; it is then
+ *   dequeued and run right away,
+ * - pick_steal() returns a queued task for another worker to run, or NULL;
+ *   it must skip tasks which are still 'on_cpu',
+ * - tick() is called on every timer tick for the running task, and returns
+ *   true if it should be preempted in favor of another task of its class.
+ *
+ * and, if not NULL:
+ *
+ * - block() is called for the running task when it is switched out
+ *   blocked, i.e. without going back to the queue, e.g. to charge it for
+ *   the time it ran,
+ * - update() is called on every tick and by the idle loop, whatever runs,
+ *   to enqueue the tasks of the class which became runnable again,
+ * - select_rq() returns the run queue of a new task, or NULL to leave it
+ *   to task_start(),
+ * - task_dead() is called when a task of the class exits.
+ *
+ * All of them but select_rq() are called with the run queue locked.
+ */
+struct sched_class {
+    const char *name;
+    int rank; /* 0 is the highest */
+    void (*enqueue)(struct sched_rq *rq, struct task_struct *task);
+    void (*dequeue)(struct sched_rq *rq, struct task_struct *task);
+    struct task_struct *(*pick_next)(struct sched_rq *rq);
+    struct task_struct *(*pick_steal)(struct sched_rq *rq);
+    bool (*tick)(struct sched_rq *rq, struct task_struct *curr);
+    void (*block)(struct sched_rq *rq, struct task_struct *task);
+    void (*update)(struct sched_rq *rq);
+    struct sched_rq *(*select_rq)(struct task_struct *task);
+    void (*task_dead)(struct sched_rq *rq, struct task_struct *task);
+};
+
+#define SCHED_NR_CLASSES 4
+
+/* Per-task state of the O(1) priority class, see sched_prio.h */
+#define SCHED_PRIO_LEVELS 64
+
+struct sched_prio_array;
+
+struct sched_prio_entity {
+    int prio; /* 0 is the highest */
+    int time_slice; /* ticks left */
+    bool expired; /* used its slice, to be queued on the expired array */
+    struct sched_prio_array *array; /* queued on */
+};
+
+/* Per-task state of the fair class, see sched_fair.h */
+struct sched_fair_entity {
+    struct rb_node node;
+    uint64_t vruntime; /* weighted nanoseconds */
+    uint64_t exec_start; /* CLOCK_MONOTONIC, when last picked */
+    unsigned long weight;
+    int nice;
+    struct sched_rq *rq; /* 'vruntime' is relative to its min_vruntime */
+    uint64_t min_vruntime; /* of 'rq', when dequeued */
+};
+
+/* Per-task state of the earliest deadline first class, see sched_edf.h */
+struct sched_edf_entity {
+    struct rb_node node;
+    uint64_t runtime, deadline, period; /* nanoseconds */
+    uint64_t bw; /* runtime / period, fixed point */
+
+    uint64_t abs_deadline; /* of the current job */
+    uint64_t release; /* of the next job */
+    int64_t budget; /* runtime left to the current job */
+    uint64_t exec_start;
+    bool overrun; /* the current job was throttled */
+    bool throttled; /* to go on the throttled list once switched out */
+    struct sched_rq *rq; /* admitted on */
+
+    unsigned long nr_jobs, nr_missed;
+};
+
+/* A task is either stackful, with its own stack and context, or stackless,
+ * a 'step' function run to its next yield on the idle context of a worker
+ * (see sched_run_stackless()) every time the task is scheduled.
+ */
+struct task_struct {
+    struct list_head list;
+    struct task_context context;
+    void *stack;
+    size_t stack_size;
+    task_callback_t *callback;
+    task_step_t *step; /* NULL for a stackful task */
+    void *arg;
+    bool reap_self;
+
+    const struct sched_class *sched_class;
+    bool on_cpu; /* running, or still being switched out */
+    bool blocked; /* off the run queue, until its class enqueues it again */
+    struct tw_timer timer; /* while asleep, see task_sleep_until() */
+    union { /* a task belongs to a single class */
+        struct sched_prio_entity prio;
+        struct sched_fair_entity fair;
+        struct sched_edf_entity edf;
+    };
+};
+
+/* Per-worker queues of the classes */
+struct sched_rr_rq {
+    struct list_head tasks;
+};
+
+struct sched_prio_array {
+    uint64_t bitmap; /* bit i set if queue[i] is not empty */
+    struct list_head queue[SCHED_PRIO_LEVELS];
+};
+
+struct sched_prio_rq {
+    struct sched_prio_array arrays[2], *active, *expired;
+};
+
+struct sched_fair_rq {
+    struct rb_root tasks; /* by vruntime */
+    uint64_t min_vruntime; /* never goes back */
+};
+
+struct sched_edf_rq {
+    struct rb_root tasks; /* by absolute deadline */
+    struct list_head throttled; /* waiting for their next period */
+    uint64_t bw; /* admitted */
+};
+
+/* Tasks run on N worker threads (M:N). Every worker has its own run queue,
+ * its own preemption timer and an idle context, the worker thread's own
+ * stack, which runs when the queue is empty and steals tasks from the other
+ * workers.
+ *
+ * A task which is switched out goes back to the run queue before the next
+ * task is picked, but stays 'on_cpu' until the switch is over and the
+ * context switched to clears it (see sched_finish_switch()). Until then no
+ * other worker steals it, as its registers are still being saved.
+ *
+ * The run queue lock is only taken with interrupts disabled, so that the
+ * timer handler never calls schedule() on a worker which holds it.
+ */
+struct sched_rq {
+    pthread_spinlock_t lock;
+    int nr_queued;
+    int nr_class[SCHED_NR_CLASSES]; /* queued, per class rank */
+    struct sched_rr_rq rr;
+    struct sched_prio_rq prio;
+    struct sched_fair_rq fair;
+    struct sched_edf_rq edf;
+
+    struct task_struct *current;
+    struct task_struct *prev; /* switched out, to release or reap */
+    struct task_struct idle;
+    struct task_struct *stackless; /* picked, for the idle context to run */
+    struct timer_wheel sleepers; /* of the tasks asleep on this worker */
+
+    unsigned long quantum; /* microseconds, 0 for no preemption */
+    pthread_t thread;
+    unsigned int seed; /* picks steal victims */
+} __attribute__((aligned(64)));
+
+/* The classes, highest first; defined in their own headers, included at the
+ * end of this file.
+ */
+static const struct sched_class sched_edf_class, sched_prio_class,
+    sched_rr_class, sched_fair_class;
+
+static const struct sched_class *const sched_classes[SCHED_NR_CLASSES] = {
+    &sched_edf_class,
+    &sched_prio_class,
+    &sched_rr_class,
+    &sched_fair_class,
+};
+
+static inline void sched_prio_init(struct sched_prio_rq *prio);
+
+#define SCHED_MAX_WORKERS 256
+
+static struct sched_rq *sched_rqs;
+static int sched_nr_workers;
+static int sched_next_rq;
+static int sched_nr_tasks; /* added and not yet reaped */
+
+/* A task may resume on another thread than the one it was switched out
+ * on: the pointer is volatile so that it is read again after every switch
+ * instead of being kept in a register.
+ */
+static __thread struct sched_rq *volatile sched_this_rq;
+
+static inline struct sched_rq *this_rq(void)
+{
+    return sched_this_rq;
+}
+
+/* The running task, when called from one */
+static inline struct task_struct *task_current(void)
+{
+    return this_rq()->current;
+}
+
+static inline void rq_lock(struct sched_rq *rq)
+{
+    pthread_spin_lock(&rq->lock);
+}
+
+static inline void rq_unlock(struct sched_rq *rq)
+{
+    pthread_spin_unlock(&rq->lock);
+}
+
+static inline void enqueue_task(struct sched_rq *rq, struct task_struct *task)
+{
+    task->sched_class->enqueue(rq, task);
+    rq->nr_queued++;
+    rq->nr_class[task->sched_class->rank]++;
+}
+
+static inline void dequeue_task(struct sched_rq *rq, struct task_struct *task)
+{
+    task->sched_class->dequeue(rq, task);
+    rq->nr_queued--;
+    rq->nr_class[task->sched_class->rank]--;
+}
+
+/* Dequeue the task to run next, from the highest class with queued tasks */
+static inline struct task_struct *pick_next_task(struct sched_rq *rq)
+{
+    for (int i = 0; i < SCHED_NR_CLASSES; ++i) {
+        if (!rq->nr_class[i])
+            continue;
+        struct task_struct *task = sched_classes[i]->pick_next(rq);
+        if (task) {
+            dequeue_task(rq, task);
+            return task;
+        }
+    }
+    return NULL;
+}
+
+/* Queue the tasks whose sleep is over again */
+static inline void sched_wake_sleepers(struct sched_rq *rq)
+{
+    if (!rq->sleepers.nr)
+        return;
+
+    LIST_HEAD(expired);
+    tw_advance(&rq->sleepers, sched_clock(), &expired);
+    struct task_struct *task, *safe;
+    list_for_each_entry_safe (task, safe, &expired, timer.list) {
+        list_del_init(&task->timer.list);
+        task->blocked = false;
+        enqueue_task(rq, task);
+    }
+}
+
+/* Called on a timer tick, with 'rq' locked: should the running task make
+ * room for another one?
+ */
+static inline void sched_update(struct sched_rq *rq)
+{
+    sched_wake_sleepers(rq);
+    for (int i = 0; i < SCHED_NR_CLASSES; ++i) {
+        if (sched_classes[i]->update)
+            sched_classes[i]->update(rq);
+    }
+}
+
+static inline bool sched_tick(struct sched_rq *rq)
+{
+    sched_update(rq);
+
+    struct task_struct *curr = rq->current;
+    if (curr == &rq->idle)
+        return rq->nr_queued;
+
+    int rank = curr->sched_class->rank;
+    for (int i = 0; i < rank; ++i) {
+        if (rq->nr_class[i])
+            return true;
+    }
+    return curr->sched_class->tick(rq, curr);
+}
+
+static inline void task_destroy(struct task_struct *task)
+{
+    if (task->stack)
+        task_stack_free(task->stack, task->stack_size);
+    free(task);
+    __atomic_sub_fetch(&sched_nr_tasks, 1, __ATOMIC_RELEASE);
+}
+
+/* Called right after every switch, on the context switched to */
+static inline void sched_finish_switch(void)
+{
+    struct sched_rq *rq = this_rq();
+    struct task_struct *prev = rq->prev;
+
+    rq->prev = NULL;
+    if (!prev || prev == &rq->idle)
+        return;
+    if (prev->reap_self) /* clean reaps */
+        task_destroy(prev);
+    else
+        __atomic_store_n(&prev->on_cpu, false, __ATOMIC_RELEASE);
+}
+
+/* Switch from the context 'from', on which 'prev' runs, to 'to' */
+static inline void task_switch_to(struct sched_rq *rq,
+                                  struct task_struct *prev,
+                                  struct task_struct *from,
+                                  struct task_struct *to)
+{
+    rq->current = to;
+    rq->prev = prev;
+    task_context_switch(&from->context, &to->context);
+    sched_finish_switch();
+}
+
+static void schedule(void)
+{
+    int flags;
+    local_irq_save(&flags);
+
+    struct sched_rq *rq = this_rq();
+    struct task_struct *prev = rq->current;
+
+    rq_lock(rq);
+    if (rq->stackless) {
+        /* Picked, but a tick came before the idle loop could run it */
+        rq->stackless->on_cpu = false;
+        enqueue_task(rq, rq->stackless);
+        rq->stackless = NULL;
+    }
+    if (prev != &rq->idle) {
+        if (prev->reap_self) {
+            /* A stackless task may end with a sleep armed */
+            if (tw_armed(&prev->timer))
+                tw_del(&rq->sleepers, &prev->timer);
+            if (prev->sched_class->task_dead)
+                prev->sched_class->task_dead(rq, prev);
+        } else if (!prev->blocked) {
+            enqueue_task(rq, prev);
+        } else if (prev->sched_class->block) {
+            prev->sched_class->block(rq, prev);
+        }
+    }
+    struct task_struct *next = pick_next_task(rq);
+    if (!next)
+        next = &rq->idle;
+    next->on_cpu = true;
+    rq_unlock(rq);
+
+    /* Stackless tasks run on the idle context */
+    struct task_struct *from = prev->step ? &rq->idle : prev;
+    if (next->step) {
+        rq->stackless = next;
+        next = &rq->idle;
+    }
+
+    /* 'next' may be 'prev' again, if nothing else deserves to run */
+    if (next != from) {
+        task_switch_to(rq, prev, from, next);
+    } else if (prev != from) {
+        /* From a stackless task back to the idle loop */
+        rq->current = next;
+        if (prev != rq->stackless) {
+            rq->prev = prev;
+            sched_finish_switch();
+        }
+    }
+
+    local_irq_restore(&flags);
+}
+
+/* Let the other runnable tasks run first, if any; the running task stays
+ * runnable. How far back it goes is up to its class.
+ */
+static inline void task_yield(void)
+{
+    schedule();
+}
+
+/* Sleep off the run queue until sched_clock() reaches 'when'. The task is
+ * queued again by the first tick, or wake-up of the idle loop, from then
+ * on, on the worker it fell asleep on; idle workers wake up right on time.
+ *
+ * A stackless task only has the timer armed here, and must yield right
+ * after, e.g. task_sleep(ns); PT_YIELD(pt); if it ends instead, the timer
+ * is disarmed as the task is reaped.
+ */
+static inline void task_sleep_until(uint64_t when)
+{
+    int flags;
+    local_irq_save(&flags);
+
+    struct sched_rq *rq = this_rq();
+    struct task_struct *task = rq->current;
+    rq_lock(rq);
+    task->blocked = true;
+    tw_add(&rq->sleepers, &task->timer, when);
+    rq_unlock(rq);
+    if (!task->step)
+        schedule();
+
+    local_irq_restore(&flags);
+}
+
+/* Sleep for 'ns' nanoseconds, see task_sleep_until() */
+static inline void task_sleep(uint64_t ns)
+{
+    task_sleep_until(sched_clock() + ns);
+}
+
+/* Run the stackless task schedule() picked, if any, up to its next yield.
+ * Interrupts are disabled meanwhile: with no stack of its own the task
+ * cannot be switched out halfway. They are already while picking it up,
+ * or a tick could requeue it under our feet.
+ */
+static inline void sched_run_stackless(struct sched_rq *rq)
+{
+    int flags;
+    local_irq_save(&flags);
+
+    struct task_struct *task = rq->stackless;
+    if (!task) {
+        local_irq_restore(&flags);
+        return;
+    }
+    rq->stackless = NULL;
+    rq->current = task;
+    int ret = task->step(task->arg);
+    if (ret == PT_EXITED || ret == PT_ENDED)
+        task->reap_self = true;
+    irq_pending = 0; /* a tick meanwhile would only call schedule() too */
+    schedule();
+
+    local_irq_restore(&flags);
+}
+
+__attribute__((noreturn)) static void task_trampoline(void *arg)
+{
+    struct task_struct *task = arg;
+
+    /* We switch to trampoline with interrupts disabled by schedule().
+     * So the first thing that we have to do is to finish the switch and
+     * enable them.
+     */
+    sched_finish_switch();
+    local_irq_enable();
+    task->callback(task->arg);
+    task->reap_self = true;
+    schedule();
+
+    __builtin_unreachable(); /* shall not reach here */
+}
+
+/* A new task, in the round robin class, to be started with task_start()
+ * once its scheduling parameters are set. Its stack is at least
+ * 'stack_size' bytes, see task_stack.h; above TASK_STACK_MAX, it fails as
+ * when out of memory.
+ */
+static inline struct task_struct *task_alloc_stack(task_callback_t *func,
+                                                   void *arg,
+                                                   size_t stack_size)
+{
+    stack_size = task_stack_round(stack_size);
+
+    preempt_disable();
+    struct task_struct *task = calloc(1, sizeof(*task));
+    void *stack = task ? task_stack_alloc(stack_size) : NULL;
+    preempt_enable();
+    if (!stack)
+        abort();
+
+    task->stack = stack;
+    task->stack_size = stack_size;
+    task->callback = func;
+    task->arg = arg;
+    task->sched_class = &sched_rr_class;
+    tw_timer_init(&task->timer);
+    task_context_init(&task->context, task->stack, stack_size,
+                      task_trampoline, task);
+    return task;
+}
+
+static inline struct task_struct *task_alloc(task_callback_t *func, void *arg)
+{
+    return task_alloc_stack(func, arg, TASK_STACK_SIZE);
+}
+
+/* A new stackless task, which runs step(arg) until it is done. It costs a
+ * task_struct, and the state 'arg' points to.
+ */
+static inline struct task_struct *task_alloc_stackless(task_step_t *step,
+                                                       void *arg)
+{
+    preempt_disable();
+    struct task_struct *task = calloc(1, sizeof(*task));
+    preempt_enable();
+    if (!task)
+        abort();
+
+    task->step = step;
+    task->arg = arg;
+    task->sched_class = &sched_rr_class;
+    tw_timer_init(&task->timer);
+    return task;
+}
+
+/* Unless its class picks one, from a task, the new task goes to the run
+ * queue of the current worker. Otherwise, e.g. from main() before
+ * sched_run(), tasks are spread over the workers round robin.
+ */
+static inline void task_start(struct task_struct *task)
+{
+    __atomic_add_fetch(&sched_nr_tasks, 1, __ATOMIC_RELAXED);
+
+    int flags;
+    local_irq_save(&flags);
+    struct sched_rq *rq = NULL;
+    if (task->sched_class->select_rq)
+        rq = task->sched_class->select_rq(task);
+    if (!rq)
+        rq = this_rq();
+    if (!rq) {
+        rq = &sched_rqs[sched_next_rq];
+        sched_next_rq = (sched_next_rq + 1) % sched_nr_workers;
+    }
+    rq_lock(rq);
+    enqueue_task(rq, task);
+    rq_unlock(rq);
+    local_irq_restore(&flags);
+}
+
+static inline void task_add(task_callback_t *func, void *param)
+{
+    task_start(task_alloc(func, param));
+}
+
+/* At most this many tasks are stolen at once, to bound the time the
+ * victim's lock is held
+ */
+#define SCHED_STEAL_MAX 256
+
+/* Move half of the tasks queued on another worker to 'rq', up to
+ * SCHED_STEAL_MAX. Called from the idle context, with interrupts disabled.
+ */
+static inline bool sched_steal(struct sched_rq *rq)
+{
+    struct task_struct *stolen[SCHED_STEAL_MAX];
+    int n = 0;
+
+    int start = rand_r(&rq->seed);
+    for (int i = 0; i < sched_nr_workers && !n; ++i) {
+        struct sched_rq *victim = &sched_rqs[(start + i) % sched_nr_workers];
+        if (victim == rq ||
+            !__atomic_load_n(&victim->nr_queued, __ATOMIC_RELAXED) ||
+            pthread_spin_trylock(&victim->lock))
+            continue;
+        int want = (victim->nr_queued + 1) / 2;
+        if (want > SCHED_STEAL_MAX)
+            want = SCHED_STEAL_MAX;
+        /* Lowest classes first, they wait the longest over there */
+        for (int c = SCHED_NR_CLASSES - 1; c >= 0 && n < want; --c) {
+            struct task_struct *task;
+            while (n < want && victim->nr_class[c] &&
+                   (task = sched_classes[c]->pick_steal(victim))) {
+                dequeue_task(victim, task);
+                stolen[n++] = task;
+            }
+        }
+        rq_unlock(victim);
+    }
+    if (!n)
+        return false;
+
+    rq_lock(rq);
+    for (int i = 0; i < n; ++i)
+        enqueue_task(rq, stolen[i]);
+    rq_unlock(rq);
+    return true;
+}
+
+static void timer_handler(int signo, siginfo_t *info, ucontext_t *ctx)
+{
+    if (!this_rq()) /* not a worker */
+        return;
+    if (irq_disabled || preempt_count) { /* run at re-enable time */
+        irq_pending = 1;
+        return;
+    }
+
+    int flags;
+    local_irq_save(&flags);
+    struct sched_rq *rq = this_rq();
+    rq_lock(rq);
+    bool resched = sched_tick(rq);
+    rq_unlock(rq);
+    local_irq_restore(&flags);
+
+    /* We can schedule directly from sighandler because Linux kernel cares only
+     * about proper sigreturn frame in the stack.
+     */
+    if (resched)
+        schedule();
+}
+
+static inline void timer_init(void)
+{
+    struct sigaction sa = {
+        .sa_handler = (void (*)(int)) timer_handler,
+        /* Not blocked while handled either: schedule() may switch to a
+         * task which does not return through this handler.
+         */
+        .sa_flags = SA_SIGINFO | SA_NODEFER,
+    };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGALRM, &sa, NULL);
+}
+
+/* The preemption tick is a POSIX timer on CLOCK_MONOTONIC which signals
+ * the thread that armed it (SIGEV_THREAD_ID), so that every thread running
+ * tasks can have its own. Unlike ualarm(), which was process-wide and took
+ * at most a second, the quantum can be anything down to about 100 us; below
+ * that most of the CPU goes to delivering the signal.
+ */
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+static __thread timer_t sched_timer;
+
+static inline void timer_start(unsigned long usecs)
+{
+    struct sigevent sev = {
+        .sigev_notify = SIGEV_THREAD_ID,
+        .sigev_signo = SIGALRM,
+    };
+    sev.sigev_notify_thread_id = gettid();
+    if (timer_create(CLOCK_MONOTONIC, &sev, &sched_timer) == -1)
+        abort();
+
+    struct itimerspec its = {
+        .it_value.tv_sec = usecs / 1000000,
+        .it_value.tv_nsec = usecs % 1000000 * 1000,
+    };
+    its.it_interval = its.it_value;
+    if (timer_settime(sched_timer, 0, &its, NULL) == -1)
+        abort();
+}
+static inline void timer_cancel(void)
+{
+    timer_delete(sched_timer);
+}
+
+/* Wait for the next tick, or for the next sleeper of 'rq' to wake up if
+ * that comes first: ppoll() is sigsuspend() with a timeout. SIGALRM is
+ * blocked from when the wake-up time is read until ppoll() unblocks it, or
+ * a tick in between could run a task which falls asleep sooner.
+ */
+static inline void timer_wait(struct sched_rq *rq)
+{
+    sigset_t alrm, saved, mask;
+    sigemptyset(&alrm);
+    sigaddset(&alrm, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &alrm, &saved);
+    mask = saved;
+    sigdelset(&mask, SIGALRM);
+
+    /* Only this worker adds sleepers to its wheel, or wakes them */
+    uint64_t until = tw_next(&rq->sleepers);
+    if (until == UINT64_MAX) {
+        sigsuspend(&mask);
+    } else {
+        uint64_t now = sched_clock();
+        struct timespec timeout = {0};
+        if (until > now) {
+            timeout.tv_sec = (until - now) / 1000000000;
+            timeout.tv_nsec = (until - now) % 1000000000;
+        }
+        ppoll(NULL, 0, &timeout, &mask);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+}
+
+/* Worker threads */
+
+static inline void sched_init(int nworkers)
+{
+    if (nworkers < 1)
+        nworkers = 1;
+    if (nworkers > SCHED_MAX_WORKERS)
+        nworkers = SCHED_MAX_WORKERS;
+
+    task_stack_init();
+    free(sched_rqs); /* of the previous sched_run(), if any, long over */
+    sched_rqs = aligned_alloc(64, nworkers * sizeof(*sched_rqs));
+    if (!sched_rqs)
+        abort();
+    for (int i = 0; i < nworkers; ++i) {
+        struct sched_rq *rq = &sched_rqs[i];
+        pthread_spin_init(&rq->lock, PTHREAD_PROCESS_PRIVATE);
+        rq->nr_queued = 0;
+        for (int c = 0; c < SCHED_NR_CLASSES; ++c)
+            rq->nr_class[c] = 0;
+        INIT_LIST_HEAD(&rq->rr.tasks);
+        sched_prio_init(&rq->prio);
+        rq->fair.tasks = RB_ROOT;
+        rq->fair.min_vruntime = 0;
+        rq->edf.tasks = RB_ROOT;
+        INIT_LIST_HEAD(&rq->edf.throttled);
+        rq->edf.bw = 0;
+        rq->idle.step = NULL; /* the idle context is stackful */
+        tw_init(&rq->sleepers, sched_clock());
+        rq->current = rq->prev = rq->stackless = NULL;
+        rq->quantum = 0;
+        rq->seed = i + 1;
+    }
+    sched_nr_workers = nworkers;
+    sched_next_rq = 0;
+
+    timer_init();
+}
+
+/* The idle context of a worker: runs tasks until there are none left in the
+ * whole runtime, stealing when its own queue runs dry.
+ */
+static inline void sched_idle_loop(struct sched_rq *rq)
+{
+    sched_this_rq = rq;
+    rq->current = &rq->idle;
+    if (rq->quantum)
+        timer_start(rq->quantum);
+    /* Wake sleepers on time, not up to the default 50 us late */
+    int slack = prctl(PR_GET_TIMERSLACK);
+    prctl(PR_SET_TIMERSLACK, 1);
+
+    while (__atomic_load_n(&sched_nr_tasks, __ATOMIC_ACQUIRE)) {
+        if (rq->stackless) {
+            sched_run_stackless(rq);
+            continue;
+        }
+
+        int flags;
+        local_irq_save(&flags);
+        rq_lock(rq);
+        sched_update(rq);
+        rq_unlock(rq);
+        bool runnable =
+            __atomic_load_n(&rq->nr_queued, __ATOMIC_RELAXED) || sched_steal(rq);
+        local_irq_restore(&flags);
+
+        if (runnable)
+            schedule();
+        else if (rq->quantum)
+            timer_wait(rq); /* until the next tick, or sleeper */
+        else
+            sched_yield();
+    }
+
+    if (rq->quantum)
+        timer_cancel();
+    prctl(PR_SET_TIMERSLACK, slack);
+    sched_this_rq = NULL;
+    irq_pending = 0; /* a late tick, nothing left to preempt */
+}
+
+static void *sched_worker(void *arg)
+{
+    sched_idle_loop(arg);
+    return NULL;
+}
+
+/* Run the tasks added so far, and those they add, to completion, on the
+ * calling thread and nworkers - 1 more. 'quantum' is the preemption tick
+ * in microseconds, 0 to only switch voluntarily.
+ */
+static inline void sched_run(unsigned long quantum)
+{
+    for (int i = 0; i < sched_nr_workers; ++i)
+        sched_rqs[i].quantum = quantum;
+    for (int i = 1; i < sched_nr_workers; ++i) {
+        if (pthread_create(&sched_rqs[i].thread, NULL, sched_worker,
+                           &sched_rqs[i]))
+            abort();
+    }
+    sched_idle_loop(&sched_rqs[0]);
+    for (int i = 1; i < sched_nr_workers; ++i)
+        pthread_join(sched_rqs[i].thread, NULL);
+}
+
+/* Options of the demos: the preemption quantum in microseconds, 10 ms by
+ * default, then the number of worker threads, 1 by default.
+ */
+static inline unsigned long timer_quantum(int argc, char *argv[])
+{
+    unsigned long usecs = argc > 1 ? strtoul(argv[1], NULL, 0) : 0;
+    return usecs ? usecs : 10000;
+}
+
+static inline int sched_workers(int argc, char *argv[])
+{
+    return argc > 2 ? atoi(argv[2]) : 1;
+}
+
+#include "sched_edf.h"
+#include "sched_fair.h"
+#include "sched_prio.h"
+#include "sched_rr.h"
@@ -0,0 +1,167 @@
+#pragma once
+
+/* Task stacks.
+ *
+ * Every stack is its own anonymous mapping, with a PROT_NONE guard page
+ * below it, so that an overflow faults instead of overwriting whatever
+ * lies there. The mapping is MAP_NORESERVE and never written to up front:
+ * a stack only costs the pages the task actually touches.
+ *
+ * Freed stacks are cached per size class, powers of two, for the next task
+ * of that size, which saves the mmap()/mprotect()/munmap() system calls.
+ * All but the top TASK_STACK_KEEP bytes of a cached stack are handed back
+ * to the kernel with madvise(MADV_DONTNEED), so that a task which once ran
+ * deep does not leave that memory resident. Past TASK_STACK_CACHE stacks
+ * in a class, freed stacks are unmapped.
+ *
+ * Built with TASK_STACK_MALLOC, stacks come from calloc() instead, as they
+ * used to, for comparison.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define TASK_STACK_MIN (16 << 10)
+#define TASK_STACK_KEEP (16 << 10)
+#define TASK_STACK_CACHE 1024
+#define TASK_STACK_CLASSES 16 /* TASK_STACK_MIN << 15 is 512 MiB */
+#define TASK_STACK_MAX ((size_t) TASK_STACK_MIN << (TASK_STACK_CLASSES - 1))
+
+/* Stack sizes are rounded up to the next size class; 0 if there is none,
+ * above TASK_STACK_MAX, which task_stack_alloc() fails
+ */
+static inline size_t task_stack_round(size_t size)
+{
+    if (size > TASK_STACK_MAX)
+        return 0;
+    size_t rounded = TASK_STACK_MIN;
+    while (rounded < size)
+        rounded <<= 1;
+    return rounded;
+}
+
+#if TASK_STACK_MALLOC
+
+static inline void task_stack_init(void) {}
+
+static inline void *task_stack_alloc(size_t size)
+{
+    return size ? calloc(1, size) : NULL;
+}
+
+static inline void task_stack_free(void *stack, size_t size)
+{
+    free(stack);
+}
+
+#else
+
+/* Link of a cached stack, in its top bytes */
+struct task_stack_free {
+    struct task_stack_free *next;
+};
+
+struct task_stack_class {
+    pthread_spinlock_t lock;
+    int nr_free; /* including those being trimmed, see task_stack_free() */
+    struct task_stack_free *free;
+};
+
+static struct task_stack_class task_stack_classes[TASK_STACK_CLASSES];
+
+static inline struct task_stack_class *task_stack_class_of(size_t size)
+{
+    return &task_stack_classes[__builtin_ctzl(size) -
+                               __builtin_ctzl(TASK_STACK_MIN)];
+}
+
+static inline void task_stack_init(void)
+{
+    for (int i = 0; i < TASK_STACK_CLASSES; ++i)
+        pthread_spin_init(&task_stack_classes[i].lock, PTHREAD_PROCESS_PRIVATE);
+}
+
+/* Held for a few instructions, by tasks with preemption disabled */
+static inline void task_stack_lock(struct task_stack_class *c)
+{
+    pthread_spin_lock(&c->lock);
+}
+
+static inline void task_stack_unlock(struct task_stack_class *c)
+{
+    pthread_spin_unlock(&c->lock);
+}
+
+static inline struct task_stack_free *task_stack_link(void *stack, size_t size)
+{
+    return (struct task_stack_free *) ((char *) stack + size) - 1;
+}
+
+/* Lowest address of a stack of 'size' bytes, as rounded by
+ * task_stack_round(), or NULL
+ */
+static inline void *task_stack_alloc(size_t size)
+{
+    if (!size)
+        return NULL;
+
+    struct task_stack_class *c = task_stack_class_of(size);
+
+    task_stack_lock(c);
+    struct task_stack_free *f = c->free;
+    if (f) {
+        c->free = f->next;
+        c->nr_free--;
+    }
+    task_stack_unlock(c);
+    if (f)
+        return (char *) (f + 1) - size;
+
+    size_t guard = sysconf(_SC_PAGESIZE);
+    char *map = mmap(NULL, guard + size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+                     -1, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    if (mprotect(map, guard, PROT_NONE)) {
+        munmap(map, guard + size);
+        return NULL;
+    }
+    return map + guard;
+}
+
+static inline void task_stack_free(void *stack, size_t size)
+{
+    struct task_stack_class *c = task_stack_class_of(size);
+
+    /* Reserve a place in the cache first: a stack unmapped anyway needs no
+     * trimming. It is only linked in once trimmed, before which nobody
+     * else may take it.
+     */
+    task_stack_lock(c);
+    bool cached = c->nr_free < TASK_STACK_CACHE;
+    if (cached)
+        c->nr_free++;
+    task_stack_unlock(c);
+
+    if (!cached) {
+        size_t guard = sysconf(_SC_PAGESIZE);
+        munmap((char *) stack - guard, guard + size);
+        return;
+    }
+
+    if (size > TASK_STACK_KEEP)
+        madvise(stack, size - TASK_STACK_KEEP, MADV_DONTNEED);
+
+    struct task_stack_free *f = task_stack_link(stack, size);
+    task_stack_lock(c);
+    f->next = c->free;
+    c->free = f;
+    task_stack_unlock(c);
+}
+
+#endif /* TASK_STACK_MALLOC */
@@ -0,0 +1,268 @@
+#pragma once
+
+/* Context switch between coroutines.
+ *
+ * swapcontext() saves and restores a whole ucontext_t, the signal mask
+ * included, which costs an rt_sigprocmask system call on every switch. The
+ * scheduler never changes the signal mask (see task_sched.h), so
+ * on x86-64 and aarch64 a switch only saves the callee-saved registers and
+ * the floating-point control words on the stack of the outgoing task, and
+ * swaps stack pointers. Everything else is caller-saved, i.e. already
+ * spilled by the compiler around the call.
+ *
+ * On other architectures, or when built with TASK_UCONTEXT, this falls back
+ * to getcontext()/makecontext()/swapcontext().
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if !defined(TASK_UCONTEXT) && !defined(__x86_64__) && !defined(__aarch64__)
+#define TASK_UCONTEXT 1
+#endif
+
+#if TASK_UCONTEXT
+#include <ucontext.h>
+#endif
+
+typedef void(task_entry_t)(void *arg);
+
+struct task_context {
+#if TASK_UCONTEXT
+    ucontext_t uc;
+#else
+    void *sp;
+#endif
+    task_entry_t *entry;
+    void *arg;
+};
+
+/* First function run on a new context, never returns */
+__attribute__((noreturn)) static void task_context_start(
+    struct task_context *ctx)
+{
+    ctx->entry(ctx->arg);
+    abort(); /* 'entry' shall not return */
+}
+
+#if TASK_UCONTEXT
+
+union task_context_ptr {
+    void *p;
+    int i[2];
+};
+
+static void task_context_start_uc(int i0, int i1)
+{
+    union task_context_ptr ptr = {.i = {i0, i1}};
+    task_context_start(ptr.p);
+}
+
+static inline void task_context_init(struct task_context *ctx,
+                                     void *stack,
+                                     size_t size,
+                                     task_entry_t *entry,
+                                     void *arg)
+{
+    ctx->entry = entry;
+    ctx->arg = arg;
+    if (getcontext(&ctx->uc) == -1)
+        abort();
+
+    ctx->uc.uc_stack.ss_sp = stack;
+    ctx->uc.uc_stack.ss_size = size;
+    ctx->uc.uc_stack.ss_flags = 0;
+    ctx->uc.uc_link = NULL;
+
+    union task_context_ptr ptr = {.p = ctx};
+    makecontext(&ctx->uc, (void (*)(void)) task_context_start_uc, 2, ptr.i[0],
+                ptr.i[1]);
+}
+
+static inline void task_context_switch(struct task_context *from,
+                                       struct task_context *to)
+{
+    swapcontext(&from->uc, &to->uc);
+}
+
+#else
+
+/* Both functions below are defined by top-level assembly in every
+ * translation unit which includes this header, as weak hidden symbols: the
+ * linker keeps one of the identical copies instead of failing on duplicate
+ * definitions. With -flto, the assembly of every unit ends up in one file,
+ * where .ifndef skips all but the first copy.
+ */
+
+/* Save the callee-saved state of the caller on its stack, store the stack
+ * pointer to '*from_sp' and resume the context whose stack is 'to_sp'.
+ */
+void task_context_swap(void **from_sp, void *to_sp);
+
+/* A new context "returns" from task_context_swap() into
+ * task_context_entry, with the context in a callee-saved register and
+ * task_context_start() in another one.
+ */
+void task_context_entry(void);
+
+#if defined(__x86_64__)
+
+/* Frame: mxcsr and x87 control word, r15, r14, r13, r12, rbx, rbp, return
+ * address.
+ */
+#define TASK_CONTEXT_FRAME 8
+
+__asm__(
+    ".text\n"
+    ".ifndef task_context_swap\n"
+    ".weak task_context_swap\n"
+    ".hidden task_context_swap\n"
+    ".type task_context_swap, @function\n"
+    "task_context_swap:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size task_context_swap, .-task_context_swap\n"
+    ".endif\n"
+    "\n"
+    ".ifndef task_context_entry\n"
+    ".weak task_context_entry\n"
+    ".hidden task_context_entry\n"
+    ".type task_context_entry, @function\n"
+    "task_context_entry:\n"
+    "    movq %r12, %rdi\n"
+    "    callq *%r13\n"
+    "    ud2\n"
+    ".size task_context_entry, .-task_context_entry\n"
+    ".endif\n");
+
+static inline void task_context_init(struct task_context *ctx,
+                                     void *stack,
+                                     size_t size,
+                                     task_entry_t *entry,
+                                     void *arg)
+{
+    ctx->entry = entry;
+    ctx->arg = arg;
+
+    /* The stack is 16-byte aligned once the frame is popped, as the ABI
+     * wants it at a call instruction.
+     */
+    uintptr_t top = ((uintptr_t) stack + size) & ~(uintptr_t) 15;
+    uint64_t *frame = (uint64_t *) top - TASK_CONTEXT_FRAME;
+    frame[0] = 0x1f80 | (uint64_t) 0x037f << 32; /* default MXCSR, FPU CW */
+    frame[1] = 0;                                 /* r15 */
+    frame[2] = 0;                                 /* r14 */
+    frame[3] = (uintptr_t) task_context_start;    /* r13 */
+    frame[4] = (uintptr_t) ctx;                   /* r12 */
+    frame[5] = 0;                                 /* rbx */
+    frame[6] = 0;                                 /* rbp */
+    frame[7] = (uintptr_t) task_context_entry;
+    ctx->sp = frame;
+}
+
+#elif defined(__aarch64__)
+
+/* Frame: x19-x28, x29 (frame pointer), x30 (link register), d8-d15, FPCR,
+ * padded to 16 bytes.
+ */
+#define TASK_CONTEXT_FRAME 22
+
+__asm__(
+    ".text\n"
+    ".ifndef task_context_swap\n"
+    ".weak task_context_swap\n"
+    ".hidden task_context_swap\n"
+    ".type task_context_swap, %function\n"
+    "task_context_swap:\n"
+    "    sub sp, sp, #176\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mrs x9, fpcr\n"
+    "    str x9, [sp, #160]\n"
+    "    mov x9, sp\n"
+    "    str x9, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    ldr x9, [sp, #160]\n"
+    "    msr fpcr, x9\n"
+    "    add sp, sp, #176\n"
+    "    ret\n"
+    ".size task_context_swap, .-task_context_swap\n"
+    ".endif\n"
+    "\n"
+    ".ifndef task_context_entry\n"
+    ".weak task_context_entry\n"
+    ".hidden task_context_entry\n"
+    ".type task_context_entry, %function\n"
+    "task_context_entry:\n"
+    "    mov x0, x19\n"
+    "    blr x20\n"
+    "    brk #0\n"
+    ".size task_context_entry, .-task_context_entry\n"
+    ".endif\n");
+
+static inline void task_context_init(struct task_context *ctx,
+                                     void *stack,
+                                     size_t size,
+                                     task_entry_t *entry,
+                                     void *arg)
+{
+    ctx->entry = entry;
+    ctx->arg = arg;
+
+    uintptr_t top = ((uintptr_t) stack + size) & ~(uintptr_t) 15;
+    uint64_t *frame = (uint64_t *) top - TASK_CONTEXT_FRAME;
+    for (int i = 0; i < TASK_CONTEXT_FRAME; ++i)
+        frame[i] = 0; /* FPCR 0 is the default rounding and exception mode */
+    frame[0] = (uintptr_t) ctx;                 /* x19 */
+    frame[1] = (uintptr_t) task_context_start;  /* x20 */
+    frame[11] = (uintptr_t) task_context_entry; /* x30 */
+    ctx->sp = frame;
+}
+
+#endif
+
+static inline void task_context_switch(struct task_context *from,
+                                       struct task_context *to)
+{
+    task_context_swap(&from->sp, to->sp);
+}
+
+#endif /* TASK_UCONTEXT */
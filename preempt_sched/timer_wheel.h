@@ -0,0 +1,191 @@
+#pragma once
+
+/* Hierarchical timing wheel, after Varghese and Lauck, and the cascading
+ * timer wheel of Linux before 4.8.
+ *
+ * Time is counted in ticks of 2^TW_TICK_SHIFT nanoseconds. There are
+ * TW_LEVELS wheels of TW_SLOTS slots; a slot of level l spans TW_SLOTS^l
+ * ticks. A timer goes to the lowest level which reaches its expiry, in the
+ * slot of its expiry. Whenever a level wraps around, the next slot of the
+ * level above is cascaded: its timers are added again, which now puts them
+ * one level lower. Adding a timer is O(1), and so is expiring it, amortized,
+ * as a timer cascades at most TW_LEVELS - 1 times.
+ *
+ * Timers expire on the tick boundary at or after their expiry, never early.
+ * A bitmap of the non-empty slots of every level lets tw_advance() skip
+ * over the empty ones, e.g. after a long idle period, and tw_next() tell
+ * when the wheel needs advancing next.
+ *
+ * Requires list.h (from linux-list) on the include path.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "list.h"
+
+#define TW_TICK_SHIFT 10 /* ticks of 1.024 us */
+#define TW_BITS 6
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_LEVELS 6 /* 2^36 ticks ahead, about 19.5 hours; later timers
+                     * go around the last level again
+                     */
+
+struct tw_timer {
+    struct list_head list;
+    uint64_t expires; /* tick */
+};
+
+static inline void tw_timer_init(struct tw_timer *timer)
+{
+    INIT_LIST_HEAD(&timer->list);
+}
+
+/* Added, and neither expired nor deleted since. Expired timers count as
+ * armed until taken off the 'expired' list of tw_advance() with
+ * list_del_init().
+ */
+static inline bool tw_armed(const struct tw_timer *timer)
+{
+    return !list_empty(&timer->list);
+}
+
+struct timer_wheel {
+    uint64_t now; /* next tick to expire */
+    int nr; /* timers */
+    uint64_t pending[TW_LEVELS]; /* bitmaps of the non-empty slots */
+    struct list_head slots[TW_LEVELS][TW_SLOTS];
+};
+
+static inline void tw_init(struct timer_wheel *tw, uint64_t now)
+{
+    tw->now = now >> TW_TICK_SHIFT;
+    tw->nr = 0;
+    for (int l = 0; l < TW_LEVELS; ++l) {
+        tw->pending[l] = 0;
+        for (int s = 0; s < TW_SLOTS; ++s)
+            INIT_LIST_HEAD(&tw->slots[l][s]);
+    }
+}
+
+static inline void tw_enqueue(struct timer_wheel *tw, struct tw_timer *timer)
+{
+    uint64_t expires = timer->expires;
+    if (expires < tw->now) /* late, expires on the next tick */
+        expires = tw->now;
+
+    uint64_t delta = expires - tw->now;
+    if (delta >> (TW_BITS * TW_LEVELS))
+        expires = tw->now + (1ULL << (TW_BITS * TW_LEVELS)) - 1;
+    int level = 0;
+    while (level < TW_LEVELS - 1 && delta >> (TW_BITS * (level + 1)))
+        level++;
+
+    int slot = (expires >> (TW_BITS * level)) & (TW_SLOTS - 1);
+    list_add_tail(&timer->list, &tw->slots[level][slot]);
+    tw->pending[level] |= 1ULL << slot;
+}
+
+/* Arm 'timer' to expire at 'expires', in nanoseconds */
+static inline void tw_add(struct timer_wheel *tw,
+                          struct tw_timer *timer,
+                          uint64_t expires)
+{
+    timer->expires =
+        (expires + (1ULL << TW_TICK_SHIFT) - 1) >> TW_TICK_SHIFT;
+    tw_enqueue(tw, timer);
+    tw->nr++;
+}
+
+/* Disarm 'timer', armed on 'tw' and not expired yet */
+static inline void tw_del(struct timer_wheel *tw, struct tw_timer *timer)
+{
+    /* Alone in its slot, which is then empty: find which from the head */
+    if (timer->list.next == timer->list.prev) {
+        ptrdiff_t idx = timer->list.next - &tw->slots[0][0];
+        tw->pending[idx / TW_SLOTS] &= ~(1ULL << (idx % TW_SLOTS));
+    }
+    list_del_init(&timer->list);
+    tw->nr--;
+}
+
+/* First tick with something to do: a slot of level 0 to expire, or a slot
+ * of a higher level to cascade. The current slot of a higher level was
+ * cascaded already, unless its span starts right now.
+ */
+static inline uint64_t tw_next_tick(const struct timer_wheel *tw)
+{
+    uint64_t next = UINT64_MAX;
+
+    for (int l = 0; l < TW_LEVELS; ++l) {
+        uint64_t pending = tw->pending[l];
+        if (!pending)
+            continue;
+        int shift = TW_BITS * l;
+        uint64_t span = tw->now >> shift;
+        if (tw->now & ((1ULL << shift) - 1))
+            span++;
+        int idx = span & (TW_SLOTS - 1);
+        if (idx)
+            pending = pending >> idx | pending << (TW_SLOTS - idx);
+        uint64_t tick = (span + __builtin_ctzll(pending)) << shift;
+        if (tick < next)
+            next = tick;
+    }
+    return next;
+}
+
+/* When, in nanoseconds, tw_advance() has something to do next: at the
+ * latest when the first timer expires, maybe earlier to cascade. UINT64_MAX
+ * if there are no timers.
+ */
+static inline uint64_t tw_next(const struct timer_wheel *tw)
+{
+    uint64_t tick = tw_next_tick(tw);
+    return tick == UINT64_MAX ? tick : tick << TW_TICK_SHIFT;
+}
+
+static inline void tw_cascade(struct timer_wheel *tw, int level, int slot)
+{
+    LIST_HEAD(timers);
+
+    list_splice_init(&tw->slots[level][slot], &timers);
+    tw->pending[level] &= ~(1ULL << slot);
+
+    struct list_head *node, *safe;
+    list_for_each_safe (node, safe, &timers)
+        tw_enqueue(tw, list_entry(node, struct tw_timer, list));
+}
+
+/* Move the timers which expired at 'now', in nanoseconds, to 'expired' */
+static inline void tw_advance(struct timer_wheel *tw,
+                              uint64_t now,
+                              struct list_head *expired)
+{
+    uint64_t target = now >> TW_TICK_SHIFT;
+
+    while (tw->nr) {
+        uint64_t tick = tw_next_tick(tw);
+        if (tick > target)
+            break;
+        tw->now = tick;
+
+        /* Lower levels first, as Linux does */
+        for (int l = 1;
+             l < TW_LEVELS && !(tick & ((1ULL << (TW_BITS * l)) - 1)); ++l)
+            tw_cascade(tw, l, (tick >> (TW_BITS * l)) & (TW_SLOTS - 1));
+
+        int slot = tick & (TW_SLOTS - 1);
+        struct list_head *node, *safe;
+        list_for_each_safe (node, safe, &tw->slots[0][slot]) {
+            list_move_tail(node, expired);
+            tw->nr--;
+        }
+        tw->pending[0] &= ~(1ULL << slot);
+        tw->now = tick + 1;
+    }
+    /* Nothing is due up to 'target' any longer */
+    if (tw->now <= target)
+        tw->now = target + 1;
+}
@@ -1,185 +1,12 @@
 #define _GNU_SOURCE
-#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <ucontext.h>
 #include <unistd.h>
 
 #include "list.h"
-
-static int preempt_count = 0;
-static void preempt_disable(void)
-{
-    preempt_count++;
-}
-static void preempt_enable(void)
-{
-    preempt_count--;
-}
-
-static void local_irq_save(sigset_t *sig_set)
-{
-    sigset_t block_set;
-    sigfillset(&block_set);
-    sigdelset(&block_set, SIGINT);
-    sigprocmask(SIG_BLOCK, &block_set, sig_set);
-}
-
-static void local_irq_restore(sigset_t *sig_set)
-{
-    sigprocmask(SIG_SETMASK, sig_set, NULL);
-}
-
-#define task_printf(...)     \
-    ({                       \
-        preempt_disable();   \
-        printf(__VA_ARGS__); \
-        preempt_enable();    \
-    })
-
-typedef void(task_callback_t)(void *arg);
-
-struct task_struct {
-    struct list_head list;
-    ucontext_t context;
-    void *stack;
-    task_callback_t *callback;
-    void *arg;
-    bool reap_self;
-};
-
-static struct task_struct *task_current, task_main;
-static LIST_HEAD(task_reap);
-
-static void task_init(void)
-{
-    INIT_LIST_HEAD(&task_main.list);
-    task_current = &task_main;
-}
-
-static struct task_struct *task_alloc(task_callback_t *func, void *arg)
-{
-    struct task_struct *task = calloc(1, sizeof(*task));
-    task->stack = calloc(1, 1 << 20);
-    task->callback = func;
-    task->arg = arg;
-    return task;
-}
-
-static void task_destroy(struct task_struct *task)
-{
-    list_del(&task->list);
-    free(task->stack);
-    free(task);
-}
-
-static void task_switch_to(struct task_struct *from, struct task_struct *to)
-{
-    task_current = to;
-    swapcontext(&from->context, &to->context);
-}
-
-static void schedule(void)
-{
-    sigset_t set;
-    local_irq_save(&set);
-
-    struct task_struct *next_task =
-        list_first_entry(&task_current->list, struct task_struct, list);
-    if (next_task) {
-        if (task_current->reap_self)
-            list_move(&task_current->list, &task_reap);
-        task_switch_to(task_current, next_task);
-    }
-
-    struct task_struct *task, *tmp;
-    list_for_each_entry_safe (task, tmp, &task_reap, list) /* clean reaps */
-        task_destroy(task);
-
-    local_irq_restore(&set);
-}
-
-union task_ptr {
-    void *p;
-    int i[2];
-};
-
-static void local_irq_restore_trampoline(struct task_struct *task)
-{
-    sigdelset(&task->context.uc_sigmask, SIGALRM);
-    local_irq_restore(&task->context.uc_sigmask);
-}
-
-__attribute__((noreturn)) static void task_trampoline(int i0, int i1)
-{
-    union task_ptr ptr = {.i = {i0, i1}};
-    struct task_struct *task = ptr.p;
-
-    local_irq_restore_trampoline(task);
-    task->callback(task->arg);
-    task->reap_self = true;
-    schedule();
-
-    __builtin_unreachable(); /* shall not reach here */
-}
-
-static void task_add(task_callback_t *func, void *param)
-{
-    struct task_struct *task = task_alloc(func, param);
-    if (getcontext(&task->context) == -1)
-        abort();
-
-    task->context.uc_stack.ss_sp = task->stack;
-    task->context.uc_stack.ss_size = 1 << 20;
-    task->context.uc_stack.ss_flags = 0;
-    task->context.uc_link = NULL;
-
-    union task_ptr ptr = {.p = task};
-    makecontext(&task->context, (void (*)(void)) task_trampoline, 2, ptr.i[0],
-                ptr.i[1]);
-
-    sigaddset(&task->context.uc_sigmask, SIGALRM);
-
-    preempt_disable();
-    list_add_tail(&task->list, &task_main.list);
-    preempt_enable();
-}
-
-static void timer_handler(int signo, siginfo_t *info, ucontext_t *ctx)
-{
-    if (preempt_count)
-        return;
-    schedule();
-}
-
-static void timer_init(void)
-{
-    struct sigaction sa = {
-        .sa_handler = (void (*)(int)) timer_handler,
-        .sa_flags = SA_SIGINFO,
-    };
-    sigfillset(&sa.sa_mask);
-    sigaction(SIGALRM, &sa, NULL);
-}
-
-static void timer_create(unsigned int usecs)
-{
-    ualarm(usecs, usecs);
-}
-static void timer_cancel(void)
-{
-    ualarm(0, 0);
-}
-
-static void timer_wait(void)
-{
-    sigset_t mask;
-    sigprocmask(0, NULL, &mask);
-    sigdelset(&mask, SIGALRM);
-    sigsuspend(&mask);
-}
+#include "task_sched.h"
 
 typedef struct {
     uint32_t value;
@@ -236,8 +63,6 @@ struct pair {
     struct list_head *head, *next;
 };
 
-static size_t stk_size;
-
 __attribute__((nonnull(2, 3, 4))) static struct list_head * merge(void *priv,
                                list_cmp_func_t cmp,
                                struct list_head *a,
@@ -359,26 +184,28 @@ static struct pair find_run(void *priv,
 
 static struct list_head *merge_at(void *priv,
                                   list_cmp_func_t cmp,
-                                  struct list_head *at)
+                                  struct list_head *at,
+                                  size_t *stk_size)
 {
     size_t len = run_size(at) + run_size(at->prev);
     struct list_head *prev = at->prev->prev;
     struct list_head *list = merge(priv, cmp, at->prev, at);
     list->prev = prev;
     list->next->prev = (struct list_head *) len;
-    --stk_size;
+    --*stk_size;
     return list;
 }
 
 static struct list_head *merge_force_collapse(void *priv,
                                               list_cmp_func_t cmp,
-                                              struct list_head *tp)
+                                              struct list_head *tp,
+                                              size_t *stk_size)
 {
-    while (stk_size >= 3) {
+    while (*stk_size >= 3) {
         if (run_size(tp->prev->prev) < run_size(tp)) {
-            tp->prev = merge_at(priv, cmp, tp->prev);
+            tp->prev = merge_at(priv, cmp, tp->prev, stk_size);
         } else {
-            tp = merge_at(priv, cmp, tp);
+            tp = merge_at(priv, cmp, tp, stk_size);
         }
     }
     return tp;
@@ -386,21 +213,22 @@ static struct list_head *merge_force_collapse(void *priv,
 
 static struct list_head *merge_collapse(void *priv,
                                         list_cmp_func_t cmp,
-                                        struct list_head *tp)
+                                        struct list_head *tp,
+                                        size_t *stk_size)
 {
     int n;
-    while ((n = stk_size) >= 2) {
+    while ((n = *stk_size) >= 2) {
         if ((n >= 3 &&
              run_size(tp->prev->prev) <= run_size(tp->prev) + run_size(tp)) ||
             (n >= 4 && run_size(tp->prev->prev->prev) <=
                            run_size(tp->prev->prev) + run_size(tp->prev))) {
             if (run_size(tp->prev->prev) < run_size(tp)) {
-                tp->prev = merge_at(priv, cmp, tp->prev);
+                tp->prev = merge_at(priv, cmp, tp->prev, stk_size);
             } else {
-                tp = merge_at(priv, cmp, tp);
+                tp = merge_at(priv, cmp, tp, stk_size);
             }
         } else if (run_size(tp->prev) <= run_size(tp)) {
-            tp = merge_at(priv, cmp, tp);
+            tp = merge_at(priv, cmp, tp, stk_size);
         } else {
             break;
         }
@@ -411,7 +239,8 @@ static struct list_head *merge_collapse(void *priv,
 
 __attribute__((nonnull(2, 3))) void timsort(void *priv, struct list_head *head, list_cmp_func_t cmp)
 {
-    stk_size = 0;
+    /* Local, not static: several tasks may be sorting at the same time */
+    size_t stk_size = 0;
 
     struct list_head *list = head->next, *tp = NULL;
     if (head == head->prev)
@@ -427,11 +256,11 @@ __attribute__((nonnull(2, 3))) void timsort(void *priv, struct list_head *head,
         tp = result.head;
         list = result.next;
         stk_size++;
-        tp = merge_collapse(priv, cmp, tp);
+        tp = merge_collapse(priv, cmp, tp, &stk_size);
     } while (list);
 
     /* End of input; merge together all the runs. */
-    tp = merge_force_collapse(priv, cmp, tp);
+    tp = merge_force_collapse(priv, cmp, tp, &stk_size);
 
     /* The final merge; rebuild prev links */
     struct list_head *stk0 = tp, *stk1 = stk0->prev;
@@ -490,24 +319,13 @@ static void sort(void *arg)
     preempt_enable();
 }
 
-int main()
+int main(int argc, char *argv[])
 {
-    timer_init();
-    task_init();
+    sched_init(sched_workers(argc, argv));
 
     task_add(sort, "1"), task_add(sort, "2"), task_add(sort, "3");
 
-    preempt_disable();
-    timer_create(10000); /* 10 ms */
-
-    while (!list_empty(&task_main.list) || !list_empty(&task_reap)) {
-        preempt_enable();
-        timer_wait();
-        preempt_disable();
-    }
-
-    preempt_enable();
-    timer_cancel();
+    sched_run(timer_quantum(argc, argv)); /* 10 ms by default */
 
     return 0;
 }